@@ -0,0 +1,59 @@
+#pragma once
+
+#include <CL/cl.hpp>
+
+/// <summary>
+/// List of the tiles where the fluid moves. Tiles are flagged by the velocity magnitude, dilated by one tile and
+/// compacted into a list, so sparse kernels run one work-group per active tile and skip the quiet regions.
+/// </summary>
+class ActiveTiles
+{
+public:
+    ActiveTiles();
+
+    /// <summary>
+    /// Create the FlagActiveTiles and CompactActiveTiles kernels
+    /// </summary>
+    /// <param name="context"></param>
+    /// <param name="program"></param>
+    /// <param name="tile">: ACTIVE_TILE the program was built with</param>
+    void Init(const cl::Context& context, const cl::Program& program, int tile);
+
+    /// <summary>
+    /// Rebuild the list from a velocity field and read back its length
+    /// </summary>
+    /// <param name="queue"></param>
+    /// <param name="velocity"></param>
+    /// <param name="threshold">: speed above which a texel keeps its tile active</param>
+    /// <returns>: the number of active tiles</returns>
+    cl_uint Update(cl::CommandQueue& queue, const cl::Image2D& velocity, float threshold);
+
+    /// <summary>
+    /// Launch arguments covering the listed tiles, one work-group each
+    /// </summary>
+    /// <param name="queue"></param>
+    /// <returns>: the arguments</returns>
+    cl::EnqueueArgs Args(cl::CommandQueue& queue) const;
+
+    /// <summary>
+    /// Whether some tiles are quiet, otherwise a dense launch does the same work without the indirection
+    /// </summary>
+    /// <returns>: the flag</returns>
+    inline bool IsSparse() const { return m_count < m_tile_count; }
+
+    inline const cl::Buffer& GetList() const { return m_list; }
+    inline cl_uint GetCount() const { return m_count; }
+    inline cl_uint GetTileCount() const { return m_tile_count; }
+
+private:
+    cl::Context m_context;
+    cl::Kernel m_flag_kernel;
+    cl::Kernel m_compact_kernel;
+    cl::Buffer m_flags;
+    cl::Buffer m_list;
+    cl::Buffer m_count_buffer;
+    size_t m_capacity;
+    int m_tile;
+    cl_uint m_count;
+    cl_uint m_tile_count;
+};
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <CL/cl.hpp>
+
+/// <summary>
+/// Chooses the time step from the CFL condition. The maximum speed is reduced on the device and read back
+/// with a non-blocking read, so each frame is planned with the value measured one frame earlier.
+/// </summary>
+class AdaptiveTimeStep
+{
+public:
+    AdaptiveTimeStep();
+
+    /// <summary>
+    /// Create the MaxSpeed and ReduceMax kernels and the result buffer
+    /// </summary>
+    /// <param name="context"></param>
+    /// <param name="program"></param>
+    /// <param name="tile">: REDUCTION_TILE the program was built with</param>
+    void Init(const cl::Context& context, const cl::Program& program, int tile);
+
+    /// <summary>
+    /// Enqueue the reduction of a velocity field and the read of its result. Skipped while the previous read is in flight.
+    /// </summary>
+    /// <param name="queue"></param>
+    /// <param name="velocity"></param>
+    void Measure(cl::CommandQueue& queue, const cl::Image2D& velocity);
+
+    /// <summary>
+    /// Split a frame into steps that keep the fastest texel within the CFL number
+    /// </summary>
+    /// <param name="frame_step">: time step of the frame, also the largest step taken</param>
+    /// <param name="cfl">: maximum number of texels a value may travel per step</param>
+    /// <param name="dx">: grid scale</param>
+    /// <param name="max_substeps">: above it the steps get shorter instead, and the frame covers less time</param>
+    /// <param name="substeps">: receives the number of steps</param>
+    /// <returns>: the time step of each substep</returns>
+    float Plan(float frame_step, float cfl, float dx, int max_substeps, int& substeps);
+
+    /// <summary>
+    /// Latest maximum speed read back
+    /// </summary>
+    /// <returns>: the speed</returns>
+    inline float GetMaxSpeed() const { return m_max_speed; }
+
+private:
+    void Poll();
+
+    cl::Context m_context;
+    cl::Kernel m_max_kernel;
+    cl::Kernel m_reduce_kernel;
+    cl::Buffer m_partial;
+    cl::Buffer m_result;
+    cl::Event m_read_event;
+    size_t m_partial_count;
+    int m_tile;
+    float m_host_result;
+    float m_max_speed;
+    bool m_pending;
+};
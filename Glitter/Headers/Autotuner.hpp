@@ -0,0 +1,67 @@
+#pragma once
+
+#include <CL/cl.hpp>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+/// <summary>
+/// Picks the fastest work-group size per kernel on a device and persists the choice between runs
+/// </summary>
+class Autotuner
+{
+public:
+    /// <summary>
+    /// Load the stored results of the device, if they were tuned against the same kernel source
+    /// </summary>
+    /// <param name="device">: the device kernels are launched on</param>
+    /// <param name="cache_dir">: directory holding the tuning files</param>
+    /// <param name="kernel_source">: results are discarded when the source changed</param>
+    void Init(const cl::Device& device, const std::string& cache_dir, const std::string& kernel_source);
+
+    /// <summary>
+    /// Whether a work-group size is stored for the kernel
+    /// </summary>
+    /// <param name="kernel_name"></param>
+    /// <returns>: the flag</returns>
+    bool IsTuned(const std::string& kernel_name) const;
+
+    /// <summary>
+    /// Sweep the candidate 2D work-group sizes and keep the fastest one
+    /// </summary>
+    /// <param name="program">: program the kernel was built from</param>
+    /// <param name="kernel_name"></param>
+    /// <param name="global">: the range the kernel is launched with</param>
+    /// <param name="launch">: enqueues the kernel with the given local range and waits for it</param>
+    void Tune(const cl::Program& program, const std::string& kernel_name, const cl::NDRange& global,
+        const std::function<void(const cl::NDRange&)>& launch);
+
+    /// <summary>
+    /// Tuned local range of the kernel, or cl::NullRange when untuned or not a divisor of the global range
+    /// </summary>
+    /// <param name="kernel_name"></param>
+    /// <param name="global"></param>
+    /// <returns>: the local range</returns>
+    cl::NDRange Local(const std::string& kernel_name, const cl::NDRange& global) const;
+
+    /// <summary>
+    /// Write the results of the device to its tuning file
+    /// </summary>
+    /// <returns>: whether the file was written</returns>
+    bool Save() const;
+
+private:
+    struct LocalSize
+    {
+        size_t x;
+        size_t y;
+    };
+
+    std::vector<LocalSize> Candidates(const cl::Program& program, const std::string& kernel_name, const cl::NDRange& global) const;
+
+    cl::Device m_device;
+    std::string m_path;
+    std::string m_source_hash;
+    std::map<std::string, LocalSize> m_tuned;
+};
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <CL/cl.hpp>
+#include <chrono>
+#include <string>
+#include <vector>
+
+/// <summary>
+/// Wall-clock time spent in each phase of one simulation step, in seconds
+/// </summary>
+struct StepTimings
+{
+    double forces = 0.0;
+    double advection = 0.0;
+    double divergence = 0.0;
+    double pressure = 0.0;
+    double gradient = 0.0;
+    double diffusion = 0.0;
+    double vorticity = 0.0;
+    double dye = 0.0;
+    double display = 0.0;
+
+    inline double Total() const
+    {
+        return forces + advection + divergence + pressure + gradient + diffusion + vorticity + dye + display;
+    }
+
+    StepTimings& operator+=(const StepTimings& other);
+    StepTimings operator/(double divisor) const;
+};
+
+/// <summary>
+/// Seconds elapsed since the given time point
+/// </summary>
+/// <param name="start"></param>
+/// <returns>: the elapsed time</returns>
+inline double SecondsSince(const std::chrono::steady_clock::time_point& start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/// <summary>
+/// Sum and absolute sum over all channels of a field, used to detect changes in the results
+/// </summary>
+struct FieldChecksum
+{
+    double sum = 0.0;
+    double abs_sum = 0.0;
+};
+
+/// <summary>
+/// Outcome of running the benchmark at a single resolution
+/// </summary>
+struct BenchmarkResult
+{
+    int resolution = 0;
+    int steps = 0;
+    double steps_per_sec = 0.0;
+    StepTimings average;
+    FieldChecksum velocity;
+    FieldChecksum pressure;
+    FieldChecksum dye;
+};
+
+/// <summary>
+/// Collects full step benchmark results and compares them against the baselines stored in the repository
+/// </summary>
+class Benchmark
+{
+public:
+    /// <summary>
+    /// Create a benchmark for the given device
+    /// </summary>
+    /// <param name="device_name">: baselines are kept per device</param>
+    /// <param name="baseline_path">: text file holding the baselines</param>
+    /// <param name="threshold">: allowed relative throughput drop, e.g. 0.1 for 10%</param>
+    Benchmark(const std::string& device_name, const std::string& baseline_path, float threshold);
+
+    /// <summary>
+    /// Read back an RGBA float image and compute its checksum
+    /// </summary>
+    /// <returns>: the checksum</returns>
+    static FieldChecksum Checksum(cl::CommandQueue& queue, const cl::Image2D& image, int width, int height);
+
+    void AddResult(const BenchmarkResult& result);
+
+    /// <summary>
+    /// Print throughput, per phase breakdown and checksums of all results
+    /// </summary>
+    void Report() const;
+
+    /// <summary>
+    /// Compare the results against the stored baselines
+    /// </summary>
+    /// <returns>: false if any resolution dropped by more than the threshold</returns>
+    bool CheckBaselines() const;
+
+    /// <summary>
+    /// Store the current results as the new baselines of this device
+    /// </summary>
+    /// <returns>: whether the file was written</returns>
+    bool SaveBaselines() const;
+
+private:
+    struct Baseline
+    {
+        std::string device;
+        int resolution;
+        double steps_per_sec;
+    };
+
+    std::vector<Baseline> LoadBaselines() const;
+
+    std::string m_device_name;
+    std::string m_baseline_path;
+    float m_threshold;
+    std::vector<BenchmarkResult> m_results;
+};
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <CL/cl.hpp>
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+/// <summary>
+/// Fixed size header at the start of a checkpoint file, followed by one CheckpointField and its payload per field
+/// </summary>
+struct CheckpointHeader
+{
+    char magic[4] = { '2', 'D', 'F', 'C' };
+    uint32_t version = 3;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t channel_order = 0;
+    uint32_t channel_type = 0;
+    uint32_t element_size = 0;
+    uint32_t field_count = 0;
+    uint64_t step = 0;
+
+    // GUI parameters
+    float viscosity = 0.0f;
+    float dx = 0.0f;
+    float force_scale = 0.0f;
+    float mix_bias = 0.0f;
+    int32_t click_mode = 0;
+    int32_t selected_index = 0;
+    uint32_t flags = 0;
+    float smoke_lift = 0.0f;
+    float smoke_weight = 0.0f;
+    uint32_t reserved = 0;              // Explicit tail, the header is written as raw bytes
+};
+
+static_assert(sizeof(CheckpointHeader) == 80, "CheckpointHeader must have no implicit padding");
+
+/// <summary>
+/// Bits of CheckpointHeader::flags
+/// </summary>
+enum CheckpointFlag : uint32_t {
+    CHECKPOINT_APPLY_GRAVITY = 1 << 0,
+    CHECKPOINT_DYE_EXTREME = 1 << 1,
+    CHECKPOINT_NORMALIZE_VEL = 1 << 2,
+    CHECKPOINT_STD_TIMESTEP = 1 << 3,
+    CHECKPOINT_FORCE_DIR = 1 << 4,
+    CHECKPOINT_MACCORMACK = 1 << 5,
+    CHECKPOINT_BACKTRACE_RK2 = 1 << 6,
+    CHECKPOINT_BACKTRACE_RK3 = 1 << 7,
+    CHECKPOINT_ADAPTIVE_TIMESTEP = 1 << 8,
+    CHECKPOINT_STAGGERED_GRID = 1 << 9,
+    CHECKPOINT_SPARSE_TILES = 1 << 10,
+    CHECKPOINT_SMOKE_BUOYANCY = 1 << 11,
+    CHECKPOINT_FUSED_ADVECTION = 1 << 12,
+    CHECKPOINT_FLIP = 1 << 13,
+    CHECKPOINT_LBM = 1 << 14
+};
+
+/// <summary>
+/// Header of a single field payload
+/// </summary>
+struct CheckpointField
+{
+    uint32_t id = 0;
+    uint32_t compressed = 0;
+    uint64_t raw_size = 0;
+    uint64_t payload_size = 0;
+};
+
+static_assert(sizeof(CheckpointField) == 24, "CheckpointField must have no implicit padding");
+
+/// <summary>
+/// Writes checkpoints in the background. The images are read into pinned host memory with non-blocking reads,
+/// and a writer thread waits for them, optionally compresses the payloads and writes the file.
+/// </summary>
+class CheckpointWriter
+{
+public:
+    /// <summary>
+    /// Allocate the pinned staging memory for the given fields
+    /// </summary>
+    /// <param name="context"></param>
+    /// <param name="queue">: queue the image reads are enqueued on</param>
+    /// <param name="field_sizes">: size in bytes of each image per checkpoint</param>
+    /// <param name="compress">: zlib compress the byte shuffled payloads</param>
+    CheckpointWriter(const cl::Context& context, const cl::CommandQueue& queue, const std::vector<size_t>& field_sizes, bool compress);
+    ~CheckpointWriter();
+
+    /// <summary>
+    /// Whether the previous checkpoint is still being written
+    /// </summary>
+    /// <returns>: the flag</returns>
+    inline bool IsBusy() const { return m_busy; }
+
+    /// <summary>
+    /// Enqueue the reads of the images and write the checkpoint once they complete.
+    /// Returns immediately; the checkpoint is skipped if the previous one is still being written.
+    /// </summary>
+    /// <param name="path">: written to a temporary file first, then renamed</param>
+    /// <param name="header"></param>
+    /// <param name="images">: the image fields, in the order of their ids</param>
+    /// <param name="buffers">: buffer fields, with the ids following the images</param>
+    /// <returns>: whether the checkpoint was started</returns>
+    bool Write(const std::string& path, const CheckpointHeader& header, const std::vector<cl::Image2D>& images,
+        const std::vector<cl::Buffer>& buffers = std::vector<cl::Buffer>());
+
+    /// <summary>
+    /// Block until the checkpoint in flight has been written
+    /// </summary>
+    void Wait();
+
+private:
+    void WriteFile(std::string path, CheckpointHeader header, std::vector<cl::Event> events);
+
+    cl::CommandQueue m_queue;
+    std::vector<size_t> m_field_sizes;
+    bool m_compress;
+    std::vector<cl::Buffer> m_staging;
+    std::vector<void*> m_mapped;
+    std::thread m_thread;
+    std::atomic<bool> m_busy;
+};
+
+/// <summary>
+/// Read a checkpoint file, decompressing the payloads
+/// </summary>
+/// <param name="path"></param>
+/// <param name="header">: the header of the file</param>
+/// <param name="fields">: raw contents of each field, in the order of their ids</param>
+/// <returns>: whether the file was valid</returns>
+bool LoadCheckpoint(const std::string& path, CheckpointHeader& header, std::vector<std::vector<unsigned char>>& fields);
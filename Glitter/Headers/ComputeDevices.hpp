@@ -0,0 +1,33 @@
+#pragma once
+
+#include <CL/cl.hpp>
+#include <string>
+#include <vector>
+
+/// <summary>
+/// An OpenCL device, or a sub-device of a partitioned CPU, for the modes that use more than the display device
+/// </summary>
+struct ComputeDevice
+{
+    cl::Platform platform;
+    cl::Device device;
+    std::string name;
+};
+
+/// <summary>
+/// List the devices of every platform
+/// </summary>
+/// <param name="cpu_partitions">: equal sub-devices per CPU device, 0 or 1 keeps it whole</param>
+/// <returns>: the devices, in platform order</returns>
+std::vector<ComputeDevice> ListComputeDevices(int cpu_partitions);
+
+/// <summary>
+/// Create a context holding only the given device and build the simulation program for it
+/// </summary>
+/// <param name="device"></param>
+/// <param name="kernel_source"></param>
+/// <param name="build_options"></param>
+/// <param name="context">: receives the context</param>
+/// <param name="program">: receives the built program</param>
+/// <returns>: whether the program was built, the build log is printed otherwise</returns>
+bool BuildForDevice(const ComputeDevice& device, const std::string& kernel_source, const std::string& build_options, cl::Context& context, cl::Program& program);
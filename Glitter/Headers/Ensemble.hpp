@@ -0,0 +1,85 @@
+#pragma once
+
+#include <CL/cl.hpp>
+#include <cstdint>
+#include <vector>
+
+/// <summary>
+/// Parameters of one ensemble member, laid out like the EnsembleMember struct in the kernels
+/// </summary>
+struct EnsembleMember
+{
+    cl_float viscosity;
+    cl_float dx;
+    cl_float force_scale;   // Random force per step, 0 disables it
+    cl_uint seed;           // Stream of the random force
+};
+
+/// <summary>
+/// Summary of a member's velocity field
+/// </summary>
+struct EnsembleStats
+{
+    double kinetic_energy;  // Mean over the cells
+    double max_speed;
+};
+
+/// <summary>
+/// Many small independent simulations packed into the layers of 2D image arrays. Each pass of the velocity solver is
+/// one launch over (width, height, members), so small grids still fill the device.
+/// </summary>
+class Ensemble
+{
+public:
+    Ensemble();
+
+    /// <summary>
+    /// Create the kernels
+    /// </summary>
+    /// <param name="context"></param>
+    /// <param name="program"></param>
+    /// <param name="jacobi_reps">: Jacobi sweeps of the pressure and diffusion solves</param>
+    void Init(const cl::Context& context, const cl::Program& program, int jacobi_reps);
+
+    /// <summary>
+    /// Allocate the members at rest
+    /// </summary>
+    /// <param name="queue"></param>
+    /// <param name="size">: width and height of every member grid</param>
+    /// <param name="members"></param>
+    void Create(cl::CommandQueue& queue, int size, const std::vector<EnsembleMember>& members);
+
+    /// <summary>
+    /// Advect with the random force, project and diffuse the velocity of every member
+    /// </summary>
+    /// <param name="queue"></param>
+    /// <param name="time_step"></param>
+    /// <param name="step">: step of the random force</param>
+    void Step(cl::CommandQueue& queue, float time_step, uint32_t step);
+
+    /// <summary>
+    /// Read the velocities back and summarize them, blocking
+    /// </summary>
+    /// <param name="queue"></param>
+    /// <returns>: one entry per member</returns>
+    std::vector<EnsembleStats> Measure(cl::CommandQueue& queue) const;
+
+    inline int GetCount() const { return static_cast<int>(m_members.size()); }
+    inline int GetSize() const { return m_size; }
+
+private:
+    cl::Context m_context;
+    cl::Kernel m_advect_kernel;
+    cl::Kernel m_divergence_kernel;
+    cl::Kernel m_jacobi_kernel;
+    cl::Kernel m_gradient_kernel;
+    cl::Buffer m_member_buffer;
+    cl::Image2DArray m_velocity;
+    cl::Image2DArray m_velocity_new;
+    cl::Image2DArray m_divergence;
+    cl::Image2DArray m_pressure;
+    cl::Image2DArray m_pressure_new;
+    std::vector<EnsembleMember> m_members;
+    int m_size;
+    int m_jacobi_reps;
+};
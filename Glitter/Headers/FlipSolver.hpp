@@ -0,0 +1,83 @@
+#pragma once
+
+#include <CL/cl.hpp>
+#include <vector>
+
+/// <summary>
+/// FLIP/PIC velocity transport. Particles carry the velocity: each step they take the grid change since the last
+/// transfer, move through the grid, are radix sorted by cell and gathered back onto the grid, which the pressure
+/// solver then projects. The sort makes the particle-to-grid transfer a gather without atomics.
+/// </summary>
+class FlipSolver
+{
+public:
+    FlipSolver();
+
+    /// <summary>
+    /// Create the kernels
+    /// </summary>
+    /// <param name="context"></param>
+    /// <param name="program"></param>
+    /// <param name="scan_tile">: SCAN_TILE the program was built with</param>
+    /// <param name="particles_per_cell"></param>
+    void Init(const cl::Context& context, const cl::Program& program, int scan_tile, int particles_per_cell);
+
+    /// <summary>
+    /// Transfer the grid to the particles, move them and transfer them back. The particles are seeded from the grid
+    /// on the first step, and again after Invalidate or a change of the grid size.
+    /// </summary>
+    /// <param name="queue"></param>
+    /// <param name="velocity">: current grid velocity</param>
+    /// <param name="out">: receives the velocity gathered from the particles</param>
+    /// <param name="time_step"></param>
+    /// <param name="rdx">: 1 / grid scale</param>
+    /// <param name="flip_ratio">: 1 for pure FLIP, 0 for pure PIC</param>
+    /// <param name="step">: seeds the particle positions</param>
+    /// <param name="mask">: obstacles</param>
+    /// <param name="mask_pitch"></param>
+    void Advance(cl::CommandQueue& queue, const cl::Image2D& velocity, const cl::Image2D& out, float time_step, float rdx, float flip_ratio,
+        uint64_t step, const cl::Buffer& mask, int mask_pitch);
+
+    /// <summary>
+    /// Drop the particles, e.g. after a reset or while another solver owns the velocity
+    /// </summary>
+    inline void Invalidate() { m_valid = false; }
+
+private:
+    void Allocate(int width, int height);
+    void Sort(cl::CommandQueue& queue);
+    void Scan(cl::CommandQueue& queue, const cl::Buffer& data, size_t n, size_t level);
+
+    cl::Context m_context;
+    cl::Kernel m_seed_kernel;
+    cl::Kernel m_update_kernel;
+    cl::Kernel m_keys_kernel;
+    cl::Kernel m_count_kernel;
+    cl::Kernel m_scan_kernel;
+    cl::Kernel m_add_kernel;
+    cl::Kernel m_scatter_kernel;
+    cl::Kernel m_reorder_kernel;
+    cl::Kernel m_clear_kernel;
+    cl::Kernel m_ranges_kernel;
+    cl::Kernel m_grid_kernel;
+
+    cl::Buffer m_pos[2];
+    cl::Buffer m_vel[2];
+    cl::Buffer m_keys[2];
+    cl::Buffer m_values[2];
+    cl::Buffer m_counts;
+    cl::Buffer m_starts;
+    cl::Buffer m_ends;
+    std::vector<cl::Buffer> m_scan_sums;
+    cl::Image2D m_grid_prev;
+
+    int m_scan_tile;
+    int m_ppc;
+    int m_width;
+    int m_height;
+    int m_count;
+    int m_threads;
+    int m_passes;
+    int m_sorted;
+    bool m_valid;
+};
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <CL/cl.hpp>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum CaptureFormat {
+    CAPTURE_PNG, CAPTURE_RAW
+};
+
+/// <summary>
+/// Captures frames of a field to disk without stalling the queue. Each frame is read with a non-blocking read
+/// into one slot of a ring of pinned host buffers, and a writer thread encodes the slot once the read completed.
+/// Frames are dropped when all slots are in use.
+/// </summary>
+class FrameCapture
+{
+public:
+    /// <summary>
+    /// Allocate the ring of pinned staging buffers and start the writer thread
+    /// </summary>
+    /// <param name="context"></param>
+    /// <param name="queue">: queue the image reads are enqueued on</param>
+    /// <param name="width"></param>
+    /// <param name="height"></param>
+    /// <param name="directory">: frames are written as frame_[step].png or .raw in here</param>
+    /// <param name="format"></param>
+    /// <param name="slots">: number of frames that can be in flight</param>
+    FrameCapture(const cl::Context& context, const cl::CommandQueue& queue, int width, int height,
+        const std::string& directory, CaptureFormat format, int slots = 4);
+    ~FrameCapture();
+
+    /// <summary>
+    /// Enqueue the read of an RGBA float image and hand it to the writer thread
+    /// </summary>
+    /// <param name="image"></param>
+    /// <param name="step">: used for the file name</param>
+    /// <returns>: false if the frame was dropped because all slots are in use</returns>
+    bool Capture(const cl::Image2D& image, uint64_t step);
+
+    /// <summary>
+    /// Number of frames dropped so far
+    /// </summary>
+    /// <returns>: the count</returns>
+    inline uint64_t GetDroppedFrames() const { return m_dropped; }
+
+private:
+    struct Slot
+    {
+        cl::Buffer buffer;
+        float* data;
+        cl::Event read_event;
+        uint64_t step;
+        bool in_use;
+    };
+
+    void WriterLoop();
+    void Encode(const Slot& slot);
+
+    cl::CommandQueue m_queue;
+    int m_width;
+    int m_height;
+    std::string m_directory;
+    CaptureFormat m_format;
+
+    std::vector<Slot> m_slots;
+    std::deque<size_t> m_pending;
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    std::thread m_writer;
+    bool m_stop;
+    uint64_t m_dropped;
+};
@@ -2,6 +2,7 @@
 
 #include "Timer.hpp"
 #include <string>
+#include <vector>
 #include <GLFW/glfw3.h>
 #include <imgui.h>
 #include <backends/imgui_impl_glfw.h>
@@ -15,6 +16,17 @@ enum RenderedTexture {
     VELOCITY, PRESSURE, DYE
 };
 
+/// <summary>
+/// Segment of the cursor path between two cursor events
+/// </summary>
+struct CursorSegment
+{
+    double x0;
+    double y0;
+    double x1;
+    double y1;
+};
+
 /// <summary>
 /// GUI wrapper that handles all imgui related calls
 /// </summary>
@@ -49,6 +61,12 @@ public:
     /// </summary>
     void ResetForceEnabled();
 
+    /// <summary>
+    /// Set the random force flag
+    /// </summary>
+    /// <param name="flag"></param>
+    void SetForceEnabled(bool flag);
+
     /// <summary>
     /// Returns the scale of the random force
     /// </summary>
@@ -67,6 +85,31 @@ public:
     /// <returns>: the bias</returns>
     float GetMixBias();
 
+    /// <summary>
+    /// Set the scale of the random force
+    /// </summary>
+    /// <param name="scale"></param>
+    void SetForceScale(float scale);
+
+    /// <summary>
+    /// Set whether the random force direction should be randomized
+    /// </summary>
+    /// <param name="flag"></param>
+    void SetForceDirFlag(bool flag);
+
+    /// <summary>
+    /// Set the bias for the display texture mixing
+    /// </summary>
+    /// <param name="bias"></param>
+    void SetMixBias(float bias);
+
+    /// <summary>
+    /// Apply a key press that changes the simulation state (G, R and M)
+    /// </summary>
+    /// <param name="key">: the GLFW key</param>
+    /// <returns>: whether the key was handled</returns>
+    bool ApplySimulationKey(int key);
+
     /// <summary>
     /// Resets all input flags
     /// </summary>
@@ -83,6 +126,8 @@ public:
         mouse_prev_ypos = mouse_ypos;
         mouse_xpos = xpos;
         mouse_ypos = ypos;
+
+        cursor_path.push_back({ mouse_prev_xpos, mouse_prev_ypos, xpos, ypos });
     }
 
 //private:
@@ -95,15 +140,35 @@ public:
     double mouse_ypos;
     double mouse_prev_xpos;
     double mouse_prev_ypos;
+    std::vector<CursorSegment> cursor_path;     // Cursor movement since the last step
     bool cursor_enabled;
     bool clicking_enabled;
     bool clicked;
     bool reset_pressed;
+    bool checkpoint_pressed;
+    bool capture_enabled;
     bool dye_extreme_mode;
     bool gui_enabled;
     bool apply_gravity;
     bool normalize_vel_dir;
     bool std_timestep;
+    bool maccormack_advection;
+    int backtrace_order;        // 1: Euler, 2: RK2, 3: RK3
+    bool adaptive_timestep;
+    bool staggered_grid;
+    bool paint_obstacles;
+    bool sparse_tiles;
+    bool smoke_buoyancy;
+    bool fused_advection;
+    bool show_tracers;
+    bool flip_mode;
+    bool lbm_solver;
+    bool clear_obstacles_pressed;
+    float cfl_number;           // Texels a value may travel per step
+    float smoke_lift;           // Buoyancy per unit of temperature
+    float smoke_weight;         // Gravity per unit of smoke density
+    float tracer_life;          // Simulated time before a tracer respawns
+    float flip_ratio;           // 1: FLIP, 0: PIC
     int selected_index;
     float viscosity;
     float dx;
@@ -0,0 +1,111 @@
+#pragma once
+
+#include "GUI.hpp"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+enum InputEventType : uint32_t {
+    INPUT_MOUSE_MOVE, INPUT_MOUSE_BUTTON, INPUT_KEY, INPUT_PARAM, INPUT_STEP
+};
+
+enum InputParam : uint32_t {
+    PARAM_VISCOSITY, PARAM_DX, PARAM_FORCE_SCALE, PARAM_FORCE_DIR, PARAM_RAND_FORCE, PARAM_GRAVITY,
+    PARAM_DYE_EXTREME, PARAM_NORMALIZE_VEL, PARAM_STD_TIMESTEP, PARAM_CLICKING, PARAM_SELECTED, PARAM_MIX_BIAS,
+    PARAM_CLICK_MODE, PARAM_MACCORMACK, PARAM_BACKTRACE_ORDER, PARAM_ADAPTIVE_TIMESTEP, PARAM_CFL_NUMBER,
+    PARAM_STAGGERED_GRID, PARAM_PAINT_OBSTACLES, PARAM_CLEAR_OBSTACLES, PARAM_SPARSE_TILES,
+    PARAM_SMOKE_BUOYANCY, PARAM_SMOKE_LIFT, PARAM_SMOKE_WEIGHT, PARAM_FUSED_ADVECTION, PARAM_FLIP_MODE, PARAM_FLIP_RATIO,
+    PARAM_LBM_SOLVER,
+    PARAM_COUNT
+};
+
+/// <summary>
+/// One recorded input event. Events of a step are followed by an INPUT_STEP event holding its time step.
+/// </summary>
+struct InputEvent
+{
+    uint64_t step;
+    double timestamp;
+    uint32_t type;
+    uint32_t id;
+    double a;
+    double b;
+};
+
+/// <summary>
+/// Records mouse input, mode switches and GUI parameter changes per simulation step
+/// </summary>
+class InputRecorder
+{
+public:
+    InputRecorder();
+
+    void RecordMouseMove(double xpos, double ypos);
+    void RecordMouseButton(bool pressed);
+    void RecordKey(int key);
+
+    /// <summary>
+    /// Record the GUI parameters that changed since the last snapshot, called right before a step
+    /// </summary>
+    /// <param name="gui"></param>
+    void RecordParameters(GUI& gui);
+
+    /// <summary>
+    /// Take a snapshot without recording, called after a step since the step itself resets some flags
+    /// </summary>
+    /// <param name="gui"></param>
+    void Snapshot(GUI& gui);
+
+    /// <summary>
+    /// Close the current step
+    /// </summary>
+    /// <param name="time_step">: the time step the step was taken with</param>
+    void EndStep(float time_step);
+
+    bool Save(const std::string& path) const;
+
+private:
+    void Record(InputEventType type, uint32_t id, double a, double b);
+    static void ReadParameters(GUI& gui, double* params);
+
+    uint64_t m_step;
+    double m_start_time;
+    bool m_has_snapshot;
+    double m_params[PARAM_COUNT];
+    std::vector<InputEvent> m_events;
+};
+
+/// <summary>
+/// Feeds a recorded input log back into the GUI step by step
+/// </summary>
+class InputReplayer
+{
+public:
+    InputReplayer();
+
+    bool Load(const std::string& path);
+
+    /// <summary>
+    /// Whether all recorded steps have been replayed
+    /// </summary>
+    /// <returns>: the flag</returns>
+    inline bool IsFinished() const { return m_next >= m_events.size(); }
+
+    /// <summary>
+    /// Number of steps in the log
+    /// </summary>
+    /// <returns>: the count</returns>
+    inline uint64_t GetStepCount() const { return m_step_count; }
+
+    /// <summary>
+    /// Apply the events of the next step to the GUI
+    /// </summary>
+    /// <param name="gui"></param>
+    /// <returns>: the recorded time step of that step</returns>
+    float ApplyStep(GUI& gui);
+
+private:
+    std::vector<InputEvent> m_events;
+    size_t m_next;
+    uint64_t m_step_count;
+};
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <CL/cl.hpp>
+
+/// <summary>
+/// D2Q9 lattice Boltzmann velocity solver. One fused stream-collide kernel per step updates a single lattice buffer in
+/// place with the AA access pattern, and writes the macroscopic velocity into the grid image the rest of the pipeline
+/// uses. There is no pressure solve; forces applied to the grid since the last step are fed back into the lattice.
+/// </summary>
+class LatticeBoltzmann
+{
+public:
+    LatticeBoltzmann();
+
+    /// <summary>
+    /// Create the LbmInit and LbmStreamCollide kernels
+    /// </summary>
+    /// <param name="context"></param>
+    /// <param name="program"></param>
+    void Init(const cl::Context& context, const cl::Program& program);
+
+    /// <summary>
+    /// Run one lattice step. The lattice starts at equilibrium with the grid velocity on the first step, and again after
+    /// Invalidate or a change of the grid size.
+    /// </summary>
+    /// <param name="queue"></param>
+    /// <param name="velocity">: current grid velocity, including the forces of this step</param>
+    /// <param name="out">: receives the lattice velocity</param>
+    /// <param name="time_step"></param>
+    /// <param name="rdx">: 1 / grid scale</param>
+    /// <param name="viscosity">: kinematic viscosity in grid units, sets the relaxation time</param>
+    /// <param name="mask">: obstacles</param>
+    /// <param name="mask_pitch"></param>
+    void Advance(cl::CommandQueue& queue, const cl::Image2D& velocity, const cl::Image2D& out, float time_step, float rdx, float viscosity,
+        const cl::Buffer& mask, int mask_pitch);
+
+    inline void Invalidate() { m_valid = false; }
+
+private:
+    cl::Context m_context;
+    cl::Kernel m_init_kernel;
+    cl::Kernel m_step_kernel;
+    cl::Buffer m_lattice;
+    cl::Image2D m_velocity_prev;
+    int m_width;
+    int m_height;
+    int m_odd;
+    bool m_valid;
+};
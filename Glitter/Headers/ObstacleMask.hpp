@@ -0,0 +1,79 @@
+#pragma once
+
+#include <CL/cl.hpp>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/// <summary>
+/// Solid cells of the grid, packed to one bit per cell with 32 cells of a row per word. The kernels fetch a
+/// single word for the cell they test, instead of a texel of a float image.
+/// </summary>
+class ObstacleMask
+{
+public:
+    ObstacleMask();
+
+    /// <summary>
+    /// Allocate an empty mask for the grid
+    /// </summary>
+    /// <param name="context"></param>
+    /// <param name="width"></param>
+    /// <param name="height"></param>
+    void Init(const cl::Context& context, int width, int height);
+
+    /// <summary>
+    /// Mark the dark pixels of an image as solid, resampled to the grid. The first image row is the first grid
+    /// row, like the initial dye texture.
+    /// </summary>
+    /// <param name="path"></param>
+    /// <returns>: whether the image was loaded</returns>
+    bool Load(const std::string& path);
+
+    /// <summary>
+    /// Set or clear the cells along a segment of the cursor path
+    /// </summary>
+    /// <param name="x0">: start x in window coordinates</param>
+    /// <param name="y0">: start y in window coordinates, pointing down</param>
+    /// <param name="x1">: end x</param>
+    /// <param name="y1">: end y</param>
+    /// <param name="radius">: brush radius in cells</param>
+    /// <param name="solid">: set the cells instead of clearing them</param>
+    void Paint(double x0, double y0, double x1, double y1, float radius, bool solid);
+
+    void Clear();
+
+    /// <summary>
+    /// Replace the mask with packed words saved from a mask of the same size
+    /// </summary>
+    /// <param name="data">: the words, as returned by GetBuffer</param>
+    /// <returns>: whether the size matched</returns>
+    bool Restore(const std::vector<unsigned char>& data);
+
+    /// <summary>
+    /// Copy the mask to the device if it changed since the last upload
+    /// </summary>
+    /// <param name="queue"></param>
+    void Upload(cl::CommandQueue& queue);
+
+    inline const cl::Buffer& GetBuffer() const { return m_buffer; }
+
+    inline size_t GetSize() const { return m_bits.size() * sizeof(uint32_t); }
+
+    /// <summary>
+    /// Words per row as passed to the kernels, 0 while no cell is solid so they skip the lookups
+    /// </summary>
+    /// <returns>: the pitch</returns>
+    inline cl_int GetPitch() const { return m_solid_count > 0 ? m_pitch : 0; }
+
+private:
+    void Set(int x, int y, bool solid);
+
+    cl::Buffer m_buffer;
+    std::vector<uint32_t> m_bits;
+    int m_width;
+    int m_height;
+    cl_int m_pitch;
+    size_t m_solid_count;
+    bool m_dirty;
+};
@@ -0,0 +1,123 @@
+#pragma once
+
+#include "ComputeDevices.hpp"
+#include <CL/cl.hpp>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+/// <summary>
+/// One grid split into horizontal slabs over several devices. Each slab keeps its rows plus a halo row below and
+/// above; the halos between slabs are refreshed after every pass whose result the next pass reads at a neighbor,
+/// those at the grid edges stay zero like the clamped reads of the undivided grid. The edge rows of a pass are
+/// computed first, so their transfer to the neighbors overlaps the interior rows. Backtraces are clamped to the slab
+/// image including its halos, so advection matches the undivided grid for |u| * dt / dx up to one texel per step;
+/// faster flow across a seam samples the halo row instead of the cells further out.
+/// </summary>
+class SlabDecomposition
+{
+public:
+    SlabDecomposition();
+    ~SlabDecomposition();
+
+    /// <summary>
+    /// Build the program on each device
+    /// </summary>
+    /// <param name="kernel_source"></param>
+    /// <param name="build_options"></param>
+    /// <param name="max_devices">: slabs to use at most, 0 for all devices</param>
+    /// <param name="cpu_partitions">: sub-devices per CPU device, each takes a slab</param>
+    /// <returns>: whether any device is usable</returns>
+    bool Init(const std::string& kernel_source, const std::string& build_options, int max_devices, int cpu_partitions);
+
+    /// <summary>
+    /// Split a grid at rest over the slabs, each gets an equal share of the rows. Slabs beyond one per row are dropped.
+    /// </summary>
+    /// <param name="width"></param>
+    /// <param name="height"></param>
+    void Create(int width, int height);
+
+    /// <summary>
+    /// Random force, advection, projection and diffusion of the velocity, the passes of the collocated solver
+    /// </summary>
+    /// <param name="time_step"></param>
+    /// <param name="viscosity"></param>
+    /// <param name="dx"></param>
+    /// <param name="force_scale"></param>
+    /// <param name="step">: step of the random force</param>
+    /// <param name="jacobi_reps"></param>
+    void Step(float time_step, float viscosity, float dx, float force_scale, uint32_t step, int jacobi_reps);
+
+    /// <summary>
+    /// Wait for all slabs
+    /// </summary>
+    void Finish();
+
+    /// <summary>
+    /// Mean kinetic energy over the whole grid, read back blocking
+    /// </summary>
+    /// <returns>: the energy</returns>
+    double KineticEnergy();
+
+    inline size_t GetSlabCount() const { return m_slabs.size(); }
+
+private:
+    struct Slab
+    {
+        ~Slab();
+
+        std::string name;
+        cl::Context context;
+        cl::Program program;
+        cl::CommandQueue compute;
+        cl::CommandQueue transfer;
+        cl::Kernel force_kernel;
+        cl::Kernel advect_kernel;
+        cl::Kernel divergence_kernel;
+        cl::Kernel jacobi_kernel;
+        cl::Kernel gradient_kernel;
+        cl::Buffer no_obstacles;
+        cl::Image2D velocity;
+        cl::Image2D velocity_new;
+        cl::Image2D divergence;
+        cl::Image2D pressure;
+        cl::Image2D pressure_new;
+        int first_row;                      // Row of the whole grid held by local row 1
+        int rows;
+        cl::Buffer staging_low;
+        cl::Buffer staging_high;
+        float* send_low = NULL;             // Mapped staging of the first row, sent to the slab below
+        float* send_high = NULL;            // Mapped staging of the last row, sent to the slab above
+        cl::Event edge_done;
+        cl::Event pass_done;
+        cl::Event read_low;
+        cl::Event read_high;
+        std::vector<cl::Event> halo_writes; // Halo writes into this slab, waited for by its next pass
+        std::vector<cl::Event> outgoing;    // Writes from this slab's staging into the neighbors
+    };
+
+    /// <summary>
+    /// Run a kernel over the rows of every slab and send the edge rows of its output to the neighbors
+    /// </summary>
+    /// <param name="kernel">: kernel of the slab, its arguments set by set_args</param>
+    /// <param name="set_args"></param>
+    /// <param name="written">: image the kernel writes</param>
+    /// <param name="exchange">: whether the next passes read the output at neighbors</param>
+    void Pass(cl::Kernel Slab::* kernel, const std::function<void(Slab&)>& set_args, cl::Image2D Slab::* written, bool exchange);
+
+    void Swap(cl::Image2D Slab::* a, cl::Image2D Slab::* b);
+
+    /// <summary>
+    /// Replace the edge row staging of a slab with pinned buffers of the given size, mapped until the slab is released
+    /// </summary>
+    /// <param name="slab"></param>
+    /// <param name="size">: bytes per row</param>
+    static void MapStaging(Slab& slab, size_t size);
+
+    static void UnmapStaging(Slab& slab);
+
+    std::vector<std::unique_ptr<Slab>> m_slabs;
+    int m_width;
+};
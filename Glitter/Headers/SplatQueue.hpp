@@ -0,0 +1,63 @@
+#pragma once
+
+#include <CL/cl.hpp>
+#include <vector>
+
+/// <summary>
+/// Splat along a segment, laid out like the Splat struct in the kernels
+/// </summary>
+struct Splat
+{
+    cl_float4 segment;  // x0, y0, x1, y1 in image coordinates
+    cl_float4 value;
+    cl_float radius;
+    cl_int blend;
+    cl_int padding[2];
+};
+
+/// <summary>
+/// Collects the splats of a step and applies them to a field with a single launch over their common bounding box
+/// </summary>
+class SplatQueue
+{
+public:
+    SplatQueue();
+
+    /// <summary>
+    /// Create the SplatBatch kernel and the splat buffer
+    /// </summary>
+    /// <param name="context"></param>
+    /// <param name="program"></param>
+    /// <param name="capacity">: initial number of splats the buffer holds, grown on demand</param>
+    void Init(const cl::Context& context, const cl::Program& program, size_t capacity = 256);
+
+    /// <summary>
+    /// Queue a splat interpolated along a segment of the cursor path
+    /// </summary>
+    /// <param name="x0">: start x in window coordinates</param>
+    /// <param name="y0">: start y in window coordinates, pointing down</param>
+    /// <param name="x1">: end x</param>
+    /// <param name="y1">: end y</param>
+    /// <param name="radius">: radius in texels</param>
+    /// <param name="value">: value added along the segment, or blended towards</param>
+    /// <param name="blend">: blend towards the value instead of adding it</param>
+    void Add(double x0, double y0, double x1, double y1, float radius, const cl_float4& value, bool blend);
+
+    inline bool IsEmpty() const { return m_splats.empty(); }
+    inline size_t Size() const { return m_splats.size(); }
+
+    /// <summary>
+    /// Upload the queued splats, apply them all in one launch and clear the queue
+    /// </summary>
+    /// <param name="queue"></param>
+    /// <param name="field">: the field to splat into</param>
+    /// <param name="scratch">: image of the same size the bounding box is written to first</param>
+    void Apply(cl::CommandQueue& queue, cl::Image2D& field, cl::Image2D& scratch);
+
+private:
+    cl::Context m_context;
+    cl::Kernel m_kernel;
+    cl::Buffer m_buffer;
+    size_t m_capacity;
+    std::vector<Splat> m_splats;
+};
@@ -0,0 +1,132 @@
+#pragma once
+
+#include "ComputeDevices.hpp"
+#include "Ensemble.hpp"
+#include <CL/cl.hpp>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/// <summary>
+/// Evenly spaced values from min to max
+/// </summary>
+struct SweepRange
+{
+    double min;
+    double max;
+    int count;
+
+    inline double Value(int i) const { return (count > 1) ? min + (max - min) * i / (count - 1) : min; }
+};
+
+/// <summary>
+/// Parameter sweep read from a text file, one setting per line, '#' starts a comment:
+///   viscosity MIN MAX COUNT
+///   dx MIN MAX COUNT
+///   jacobi MIN MAX COUNT
+///   resolution MIN MAX COUNT
+///   steps N
+///   batch N            members per job
+///   force SCALE        random force of every member
+/// Settings that are left out keep a single default value.
+/// </summary>
+struct SweepSpec
+{
+    SweepRange viscosity = { 0.5, 0.5, 1 };
+    SweepRange dx = { 1.0, 1.0, 1 };
+    SweepRange jacobi = { 20.0, 20.0, 1 };
+    SweepRange resolution = { 128.0, 128.0, 1 };
+    int steps = 200;
+    int batch = 16;
+    float force_scale = 0.5f;
+
+    bool Load(const std::string& path);
+};
+
+/// <summary>
+/// Members of one resolution and Jacobi count, advanced together as one ensemble
+/// </summary>
+struct SweepJob
+{
+    int resolution;
+    int jacobi_reps;
+    std::vector<EnsembleMember> members;
+};
+
+/// <summary>
+/// Final state of one sweep member
+/// </summary>
+struct SweepResult
+{
+    size_t job;
+    std::string device;
+    int resolution;
+    int jacobi_reps;
+    EnsembleMember member;
+    EnsembleStats stats;
+    double job_seconds;
+};
+
+/// <summary>
+/// Runs sweep jobs on every OpenCL device of every platform, one worker thread per device. CPU devices may be split
+/// into sub-devices with a worker each. Jobs are dealt out largest first; a worker takes jobs from the front of its own
+/// queue and steals from the back of the others' queues when it runs dry.
+/// </summary>
+class SweepScheduler
+{
+public:
+    /// <summary>
+    /// Create a context, queue and program for each device
+    /// </summary>
+    /// <param name="kernel_source">: source of the simulation program</param>
+    /// <param name="build_options"></param>
+    /// <param name="cpu_partitions">: sub-devices per CPU device, 0 or 1 keeps it whole</param>
+    SweepScheduler(const std::string& kernel_source, const std::string& build_options, int cpu_partitions);
+
+    inline size_t GetWorkerCount() const { return m_workers.size(); }
+
+    /// <summary>
+    /// Expand the sweep into jobs and run them all, blocking
+    /// </summary>
+    /// <param name="spec"></param>
+    void Run(const SweepSpec& spec);
+
+    /// <summary>
+    /// Print the work done per device and the aggregate throughput
+    /// </summary>
+    void Report() const;
+
+    /// <summary>
+    /// Write one CSV line per member
+    /// </summary>
+    /// <param name="path"></param>
+    /// <returns>: whether the file was written</returns>
+    bool WriteSummary(const std::string& path) const;
+
+private:
+    struct Worker
+    {
+        std::string name;
+        cl::Context context;
+        cl::CommandQueue queue;
+        cl::Program program;
+        std::deque<size_t> jobs;
+        std::mutex mutex;
+        int completed = 0;
+        int stolen = 0;
+        double busy = 0.0;
+    };
+
+    bool NextJob(size_t worker, size_t& job);
+    void WorkerLoop(size_t worker);
+
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    std::vector<SweepJob> m_jobs;
+    std::vector<SweepResult> m_results;
+    std::mutex m_results_mutex;
+    int m_steps;
+    double m_elapsed;
+};
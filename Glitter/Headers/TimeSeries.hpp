@@ -0,0 +1,171 @@
+#pragma once
+
+#include <CL/cl.hpp>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Layout of a time-series file:
+//   TimeSeriesHeader
+//   TimeSeriesEntry[capacity]    fixed size index, the first frame_count entries are valid
+//   frame payloads               each starts on a page boundary at its entry's offset
+// Readers can map the file and access any frame in place.
+
+enum TimeSeriesFormat : uint32_t {
+    SERIES_FLOAT32 = 0, SERIES_FLOAT16 = 1
+};
+
+enum TimeSeriesField : uint32_t {
+    SERIES_VELOCITY = 0, SERIES_PRESSURE = 1, SERIES_DYE = 2
+};
+
+struct TimeSeriesHeader
+{
+    char magic[4] = { '2', 'D', 'T', 'S' };
+    uint32_t version = 1;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t channels = 4;
+    uint32_t capacity = 0;
+    uint32_t frame_count = 0;
+    uint32_t reserved = 0;
+};
+
+struct TimeSeriesEntry
+{
+    uint64_t step;
+    double time;
+    uint64_t offset;
+    uint32_t field;
+    uint32_t format;
+};
+
+/// <summary>
+/// File mapped into memory, using mmap or the Windows file mapping API
+/// </summary>
+class MappedFile
+{
+public:
+    MappedFile();
+    ~MappedFile();
+
+    /// <summary>
+    /// Map an existing file read-only, or create a writable file of the given size
+    /// </summary>
+    /// <param name="path"></param>
+    /// <param name="size">: size of a created file, ignored when read-only</param>
+    /// <param name="writable">: create the file and map it writable</param>
+    /// <returns>: whether the file was mapped</returns>
+    bool Open(const std::string& path, size_t size, bool writable);
+
+    /// <summary>
+    /// Grow a writable file and map it again. Pointers into the old mapping become invalid.
+    /// </summary>
+    /// <param name="size"></param>
+    /// <returns>: whether the file was mapped again</returns>
+    bool Resize(size_t size);
+
+    /// <summary>
+    /// Write the dirty pages back to the file
+    /// </summary>
+    void Flush();
+
+    void Close();
+
+    inline unsigned char* Data() const { return m_data; }
+    inline size_t Size() const { return m_size; }
+
+private:
+    bool Map();
+    void Unmap();
+
+    void* m_file;
+    void* m_mapping;
+    int m_fd;
+    unsigned char* m_data;
+    size_t m_size;
+    bool m_writable;
+};
+
+/// <summary>
+/// Appends frames of RGBA float images to a memory-mapped time-series file. Frames are read straight into the
+/// mapping with non-blocking reads; float16 frames are packed on the device first and halve the output size.
+/// </summary>
+class TimeSeriesWriter
+{
+public:
+    /// <summary>
+    /// Create the file with room for the index
+    /// </summary>
+    /// <param name="context"></param>
+    /// <param name="queue">: queue the reads are enqueued on</param>
+    /// <param name="program">: provides the PackHalf kernel</param>
+    /// <param name="path"></param>
+    /// <param name="width"></param>
+    /// <param name="height"></param>
+    /// <param name="capacity">: maximum number of frames in the index</param>
+    /// <param name="half">: store the frames as float16</param>
+    TimeSeriesWriter(const cl::Context& context, const cl::CommandQueue& queue, const cl::Program& program,
+        const std::string& path, int width, int height, uint32_t capacity, bool half);
+    ~TimeSeriesWriter();
+
+    inline bool IsOpen() const { return m_file.Data() != NULL; }
+
+    /// <summary>
+    /// Enqueue the transfer of a frame into the file. It becomes visible to readers after the next Commit.
+    /// </summary>
+    /// <param name="image">: RGBA float image of the writer's size</param>
+    /// <param name="field"></param>
+    /// <param name="step"></param>
+    /// <param name="time">: simulated time of the frame</param>
+    /// <returns>: false when the index is full</returns>
+    bool Append(const cl::Image2D& image, TimeSeriesField field, uint64_t step, double time);
+
+    /// <summary>
+    /// Wait for the transfers in flight and publish their frames in the header
+    /// </summary>
+    void Commit();
+
+private:
+    size_t FrameSize() const;
+
+    cl::CommandQueue m_queue;
+    cl::Kernel m_pack_kernel;
+    cl::Buffer m_half_buffer;
+    MappedFile m_file;
+    int m_width;
+    int m_height;
+    uint32_t m_capacity;
+    bool m_half;
+    uint32_t m_appended;
+    size_t m_end;
+    std::vector<cl::Event> m_pending;
+};
+
+/// <summary>
+/// Zero-copy access to the frames of a time-series file
+/// </summary>
+class TimeSeriesReader
+{
+public:
+    bool Open(const std::string& path);
+
+    inline const TimeSeriesHeader& Header() const { return *reinterpret_cast<const TimeSeriesHeader*>(m_file.Data()); }
+    inline uint32_t FrameCount() const { return Header().frame_count; }
+    inline const TimeSeriesEntry& Entry(uint32_t index) const
+    {
+        return reinterpret_cast<const TimeSeriesEntry*>(m_file.Data() + sizeof(TimeSeriesHeader))[index];
+    }
+
+    /// <summary>
+    /// Pointer to the payload of a frame, float or uint16_t half values depending on its format
+    /// </summary>
+    /// <param name="index"></param>
+    /// <returns>: the pointer into the mapping</returns>
+    inline const void* FrameData(uint32_t index) const { return m_file.Data() + Entry(index).offset; }
+
+    static float HalfToFloat(uint16_t value);
+
+private:
+    MappedFile m_file;
+};
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <CL/cl.hpp>
+
+/// <summary>
+/// Passive tracer particles advected through the velocity field. Positions and ages are stored SoA in a pair of
+/// GL vertex buffers shared with CL: each step advects the particles of one buffer with RK2, compacts the survivors
+/// into the other with an atomic counter and respawns the free slots behind them, then the new buffer is drawn as
+/// points without passing through the host.
+/// </summary>
+class TracerParticles
+{
+public:
+    TracerParticles();
+
+    /// <summary>
+    /// Create the shared buffers, their vertex arrays and the kernels. The particles start dead and spawn on the first step.
+    /// </summary>
+    /// <param name="context"></param>
+    /// <param name="program"></param>
+    /// <param name="capacity">: number of particles, none are created for 0</param>
+    /// <param name="width">: grid width, the extent of the spawn region</param>
+    /// <param name="height">: grid height</param>
+    void Init(const cl::Context& context, const cl::Program& program, int capacity, int width, int height);
+
+    /// <summary>
+    /// Advect the particles, recycle the dead ones and swap the buffers
+    /// </summary>
+    /// <param name="queue"></param>
+    /// <param name="velocity"></param>
+    /// <param name="time_step"></param>
+    /// <param name="rdx">: 1 / grid scale</param>
+    /// <param name="max_age">: lifetime of a particle in simulated time</param>
+    /// <param name="step">: seeds the respawn positions</param>
+    /// <param name="mask">: obstacles, particles entering them die</param>
+    /// <param name="mask_pitch"></param>
+    void Step(cl::CommandQueue& queue, const cl::Image2D& velocity, float time_step, float rdx, float max_age, uint64_t step,
+        const cl::Buffer& mask, int mask_pitch);
+
+    /// <summary>
+    /// Draw the particles as points with the bound shader, after CL released the buffers
+    /// </summary>
+    void Draw() const;
+
+    void Cleanup();
+
+    inline bool IsEnabled() const { return m_capacity > 0; }
+    inline int GetCapacity() const { return m_capacity; }
+
+private:
+    GLuint m_vbo[2];
+    GLuint m_vao[2];
+    cl::BufferGL m_buffers[2];
+    cl::Buffer m_alive;
+    cl::Kernel m_advect_kernel;
+    cl::Kernel m_respawn_kernel;
+    int m_capacity;
+    int m_width;
+    int m_height;
+    int m_current;
+};
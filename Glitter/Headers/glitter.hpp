@@ -11,6 +11,7 @@
 
 // Local Headers
 #include <Timer.hpp>
+#include <Autotuner.hpp>
 
 // Define Some Constants
 const int mWidth = 1024;
@@ -28,15 +29,27 @@ std::string kernel_source;
 cl::Program::Sources sources;
 cl::CommandQueue queue;
 cl::Program program;
+Autotuner autotuner;
 cl::Buffer test_buffer;
 cl::Buffer debug_buffer;
 cl::Kernel test_kernel;
 cl::Kernel debug_kernel;
 cl::Kernel advect_kernel;
+cl::Kernel advect_tiles_kernel;
+cl::Kernel advect_fields_kernel;
 cl::Kernel divergence_kernel;
 cl::Kernel jacobi_kernel;
+cl::Kernel jacobi_tiles_kernel;
 cl::Kernel gradient_kernel;
-cl::Kernel vorticity_kernel;
+cl::Kernel maccormack_kernel;
+cl::Kernel jacobi_divergence_kernel;
+cl::Kernel gradient_boundary_kernel;
+cl::Kernel advect_face_kernel;
+cl::Kernel divergence_staggered_kernel;
+cl::Kernel jacobi_staggered_kernel;
+cl::Kernel gradient_face_kernel;
+cl::Kernel centers_to_faces_kernel;
+cl::Kernel faces_to_centers_kernel;
 cl::Kernel vorticity_confiner_kernel;
 cl::Kernel display_convert_kernel;
 cl::Kernel boundary_kernel;
@@ -48,11 +61,10 @@ cl::Kernel tex_neg_randomize_kernel;
 cl::Kernel neg_check_kernel;
 cl::Kernel click_effect_test_kernel;
 cl::Kernel image_reset_kernel;
-cl::Kernel click_effect_kernel;
-cl::Kernel add_dye_kernel;
-cl::Kernel add_vel_kernel;
 cl::Kernel gravity_kernel;
+cl::Kernel advect_smoke_kernel;
 cl::Kernel vel_init_kernel;
+cl::Kernel resample_kernel;
 
 cl::NDRange global_tex(mWidth, mHeight);
 cl::NDRange global(10);
@@ -86,12 +98,19 @@ unsigned int indices[] = {
 //#define STD_TIMESTEP
 #define VORTICITY
 #define NEUMANN_BOUND
+#define FUSED_PROJECTION
 //#define DISABLE_SIM
 #define RESET_TEXTURES
 #define RESET_PRESSURE_EACH_ITER
 //#define INITIALIZE_VEL
 #define INITIALIZE_DYE_FROM_TEX
 #define JACOBI_REPS 20
+#define VORTICITY_TILE 16
+#define REDUCTION_TILE 16
+#define ACTIVE_TILE 16
+#define SCAN_TILE 256
+#define ACTIVE_TILE_THRESHOLD 1e-3f
+#define SMOKE_COOLING 0.995f
 
 #ifdef TEXTURE_TEST
 cl::make_kernel<cl::Image2D> tester(test_kernel);
@@ -100,27 +119,39 @@ cl::make_kernel<cl::Image2D, cl::Buffer> debug_tester(debug_kernel);
 cl::make_kernel<cl::Buffer> tester(test_kernel);
 #endif // TEXTURE_TEST
 
-cl::make_kernel<float, float, float, cl::Image2D, cl::Image2D, cl::Image2D> advecter(advect_kernel);
+cl::make_kernel<float, float, float, int, cl::Image2D, cl::Image2D, cl::Image2D, cl::Buffer, int> advecter(advect_kernel);
+cl::make_kernel<float, float, float, int, cl::Image2D, cl::Image2D, cl::Image2D, cl::Buffer, int, cl::Buffer> tile_advecter(advect_tiles_kernel);
+cl::make_kernel<float, float, float, int, int, cl::Image2D, cl::Image2D, cl::Image2D, cl::Image2D, cl::Image2D, cl::Image2D, cl::Image2D, cl::Image2D, cl::Image2D,
+    cl::Buffer, int> field_advecter(advect_fields_kernel);
+cl::make_kernel<float, float, float, int, cl::Image2D, cl::Image2D, cl::Image2D, cl::Image2D, cl::Buffer, int> maccormack_advecter(maccormack_kernel);
 cl::make_kernel<cl::Image2D, cl::Image2D> tex_copier(tex_copy_kernel);
-cl::make_kernel<float, cl::Image2D, cl::Image2D> divergencer(divergence_kernel);
-cl::make_kernel<float, float, cl::Image2D, cl::Image2D, cl::Image2D> jacobier(divergence_kernel);
-cl::make_kernel<float, cl::Image2D, cl::Image2D, cl::Image2D> gradienter(gradient_kernel);
-cl::make_kernel<float, cl::Image2D, cl::Image2D> vorticitier(vorticity_kernel);
-cl::make_kernel<float, float, float, float, cl::Image2D, cl::Image2D, cl::Image2D> vorticity_confiner(vorticity_confiner_kernel);
+cl::make_kernel<float, cl::Image2D, cl::Image2D, cl::Buffer, int> divergencer(divergence_kernel);
+cl::make_kernel<float, float, cl::Image2D, cl::Image2D, cl::Image2D, cl::Buffer, int> jacobier(divergence_kernel);
+cl::make_kernel<float, float, cl::Image2D, cl::Image2D, cl::Image2D, cl::Buffer, int, cl::Buffer> tile_jacobier(jacobi_tiles_kernel);
+cl::make_kernel<float, cl::Image2D, cl::Image2D, cl::Image2D, cl::Buffer, int> gradienter(gradient_kernel);
+cl::make_kernel<float, float, float, cl::Image2D, cl::Image2D, cl::Image2D, cl::Image2D, cl::Buffer, int> jacobi_divergencer(jacobi_divergence_kernel);
+cl::make_kernel<float, float, cl::Image2D, cl::Image2D, cl::Image2D, cl::Buffer, int> gradient_bounder(gradient_boundary_kernel);
+cl::make_kernel<float, float, int, int, cl::Image2D, cl::Image2D, cl::Image2D, cl::Image2D, cl::Buffer, int> face_advecter(advect_face_kernel);
+cl::make_kernel<float, cl::Image2D, cl::Image2D, cl::Image2D> staggered_divergencer(divergence_staggered_kernel);
+cl::make_kernel<float, float, cl::Image2D, cl::Image2D, cl::Image2D, cl::Buffer, int> staggered_jacobier(jacobi_staggered_kernel);
+cl::make_kernel<float, int, cl::Image2D, cl::Image2D, cl::Image2D, cl::Buffer, int> face_gradienter(gradient_face_kernel);
+cl::make_kernel<int, cl::Image2D, cl::Image2D, cl::Image2D, cl::Image2D, cl::Buffer, int> centers_to_facer(centers_to_faces_kernel);
+cl::make_kernel<cl::Image2D, cl::Image2D, cl::Image2D, cl::Image2D> faces_to_centerer(faces_to_centers_kernel);
+cl::make_kernel<float, float, float, float, cl::Image2D, cl::Image2D> vorticity_confiner(vorticity_confiner_kernel);
 cl::make_kernel<float, cl::Image2D, cl::Image2D> boundarier(boundary_kernel);
 cl::make_kernel<cl::Image2D, cl::Image2D> display_converter(display_convert_kernel);
 cl::make_kernel<float, cl::Image2D, cl::Image2D, cl::Image2D> mixer(mix_kernel);
-cl::make_kernel<cl::Image2D> tex_randomizer(tex_randomize_kernel);
-cl::make_kernel<cl::Image2D> tex_neg_randomizer(tex_neg_randomize_kernel);
+cl::make_kernel<unsigned int, cl::Image2D> tex_randomizer(tex_randomize_kernel);
+cl::make_kernel<unsigned int, cl::Image2D> tex_neg_randomizer(tex_neg_randomize_kernel);
 cl::make_kernel<cl::Image2D, cl::Image2D> neg_checker(neg_check_kernel);
-cl::make_kernel<float, int, cl::Image2D, cl::Image2D> force_randomizer(force_randomize_kernel);
+cl::make_kernel<float, int, unsigned int, cl::Image2D, cl::Image2D> force_randomizer(force_randomize_kernel);
 cl::make_kernel<int, int, cl::Image2D> click_effect_tester(click_effect_test_kernel);
 cl::make_kernel<cl::Image2D> image_resetter(image_reset_kernel);
-cl::make_kernel<int, int, float, int, cl::Image2D, cl::Image2D> click_effecter(click_effect_kernel);
-cl::make_kernel<int, int, float, int, cl::Image2D> dye_adder(add_dye_kernel);
-cl::make_kernel<int, int, int, int, float, int, int, cl::Image2D, cl::Image2D> vel_adder(add_vel_kernel);
 cl::make_kernel<float, cl::Image2D, cl::Image2D> gravitier(gravity_kernel);
+cl::make_kernel<float, float, int, float, float, float, cl_float4, cl::Image2D, cl::Image2D, cl::Image2D, cl::Image2D, cl::Image2D, cl::Image2D, cl::Image2D,
+    cl::Image2D, cl::Buffer, int> smoke_advecter(advect_smoke_kernel);
 cl::make_kernel<cl::Image2D> velocity_initializer(vel_init_kernel);
+cl::make_kernel<cl::Image2D, cl::Image2D> resampler(resample_kernel);
 
 // Images
 cl::Image2D init_texture;
@@ -130,10 +161,24 @@ cl::Image2D new_vel;
 cl::Image2D velocity_divergence;
 cl::Image2D old_pressure;
 cl::Image2D new_pressure;
-cl::Image2D vorticity;
 cl::Image2D display_texture;
 cl::Image2D dye_texture;
 cl::Image2D dye_texture_new;
+cl::Image2D advection_scratch;
+
+// Staggered grid: single channel u and v face images, and the collocated velocity last written from them
+cl::Image2D face_u;
+cl::Image2D face_u_new;
+cl::Image2D face_v;
+cl::Image2D face_v_new;
+cl::Image2D staggered_centers;
+bool staggered_faces_valid = false;
+
+// Smoke: single channel temperature and density advected with the dye
+cl::Image2D temperature;
+cl::Image2D temperature_new;
+cl::Image2D smoke_density;
+cl::Image2D smoke_density_new;
 
 // Reference: https://github.com/nothings/stb/blob/master/stb_image.h#L4
 // To use stb_image, add this in *one* C++ source file.
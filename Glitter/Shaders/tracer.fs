@@ -0,0 +1,9 @@
+#version 330 core
+out vec4 FragColor;
+
+in float Fade;
+
+void main()
+{
+	FragColor = vec4(1.0, 1.0, 1.0, 0.4 * Fade);
+}
\ No newline at end of file
@@ -0,0 +1,17 @@
+#version 330 core
+layout (location = 0) in vec2 aPos;
+layout (location = 1) in float aAge;
+
+out float Fade;
+
+// grid size and particle lifetime
+uniform float width;
+uniform float height;
+uniform float max_age;
+
+void main()
+{
+	// Texel centers to clip space, the first row is the bottom of the screen
+	gl_Position = vec4((aPos.x + 0.5) / width * 2.0 - 1.0, (aPos.y + 0.5) / height * 2.0 - 1.0, 0.0, 1.0);
+	Fade = clamp(1.0 - aAge / max_age, 0.0, 1.0);
+}
\ No newline at end of file
@@ -0,0 +1,61 @@
+#include "ActiveTiles.hpp"
+
+ActiveTiles::ActiveTiles()
+    :
+    m_capacity(0),
+    m_tile(16),
+    m_count(0),
+    m_tile_count(0)
+{
+}
+
+void ActiveTiles::Init(const cl::Context& context, const cl::Program& program, int tile)
+{
+    m_context = context;
+    m_tile = tile;
+    m_flag_kernel = cl::Kernel(program, "FlagActiveTiles");
+    m_compact_kernel = cl::Kernel(program, "CompactActiveTiles");
+    m_count_buffer = cl::Buffer(m_context, CL_MEM_READ_WRITE, sizeof(cl_uint));
+}
+
+cl_uint ActiveTiles::Update(cl::CommandQueue& queue, const cl::Image2D& velocity, float threshold)
+{
+    const size_t width = velocity.getImageInfo<CL_IMAGE_WIDTH>();
+    const size_t height = velocity.getImageInfo<CL_IMAGE_HEIGHT>();
+    const size_t tiles_x = (width + m_tile - 1) / m_tile;
+    const size_t tiles_y = (height + m_tile - 1) / m_tile;
+
+    // Grown for larger fields, e.g. between benchmark resolutions
+    if (tiles_x * tiles_y > m_capacity)
+    {
+        m_capacity = tiles_x * tiles_y;
+        m_flags = cl::Buffer(m_context, CL_MEM_READ_WRITE, m_capacity * sizeof(cl_uint));
+        m_list = cl::Buffer(m_context, CL_MEM_READ_WRITE, m_capacity * sizeof(cl_uint));
+    }
+    m_tile_count = static_cast<cl_uint>(tiles_x * tiles_y);
+
+    const cl_uint zero = 0;
+    queue.enqueueWriteBuffer(m_count_buffer, CL_FALSE, 0, sizeof(cl_uint), &zero);
+
+    m_flag_kernel.setArg(0, threshold);
+    m_flag_kernel.setArg(1, velocity);
+    m_flag_kernel.setArg(2, m_flags);
+    queue.enqueueNDRangeKernel(m_flag_kernel, cl::NullRange, cl::NDRange(tiles_x * m_tile, tiles_y * m_tile), cl::NDRange(m_tile, m_tile));
+
+    m_compact_kernel.setArg(0, static_cast<cl_int>(tiles_x));
+    m_compact_kernel.setArg(1, static_cast<cl_int>(tiles_y));
+    m_compact_kernel.setArg(2, m_flags);
+    m_compact_kernel.setArg(3, m_list);
+    m_compact_kernel.setArg(4, m_count_buffer);
+    queue.enqueueNDRangeKernel(m_compact_kernel, cl::NullRange, cl::NDRange(tiles_x, tiles_y));
+
+    // OpenCL 1.2 has no indirect dispatch, so the launch size comes back to the host
+    queue.enqueueReadBuffer(m_count_buffer, CL_TRUE, 0, sizeof(cl_uint), &m_count);
+
+    return m_count;
+}
+
+cl::EnqueueArgs ActiveTiles::Args(cl::CommandQueue& queue) const
+{
+    return cl::EnqueueArgs(queue, cl::NDRange(m_count * m_tile, m_tile), cl::NDRange(m_tile, m_tile));
+}
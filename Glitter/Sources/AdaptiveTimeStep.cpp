@@ -0,0 +1,86 @@
+#include "AdaptiveTimeStep.hpp"
+#include <algorithm>
+#include <cmath>
+
+AdaptiveTimeStep::AdaptiveTimeStep()
+    :
+    m_partial_count(0),
+    m_tile(16),
+    m_host_result(0.0f),
+    m_max_speed(0.0f),
+    m_pending(false)
+{
+}
+
+void AdaptiveTimeStep::Init(const cl::Context& context, const cl::Program& program, int tile)
+{
+    m_context = context;
+    m_tile = tile;
+    m_max_kernel = cl::Kernel(program, "MaxSpeed");
+    m_reduce_kernel = cl::Kernel(program, "ReduceMax");
+    m_result = cl::Buffer(m_context, CL_MEM_READ_WRITE, sizeof(float));
+}
+
+void AdaptiveTimeStep::Measure(cl::CommandQueue& queue, const cl::Image2D& velocity)
+{
+    Poll();
+    if (m_pending)
+        return;
+
+    const size_t width = velocity.getImageInfo<CL_IMAGE_WIDTH>();
+    const size_t height = velocity.getImageInfo<CL_IMAGE_HEIGHT>();
+    const size_t groups_x = (width + m_tile - 1) / m_tile;
+    const size_t groups_y = (height + m_tile - 1) / m_tile;
+
+    // Grown for larger fields, e.g. between benchmark resolutions
+    if (groups_x * groups_y > m_partial_count)
+    {
+        m_partial_count = groups_x * groups_y;
+        m_partial = cl::Buffer(m_context, CL_MEM_READ_WRITE, m_partial_count * sizeof(float));
+    }
+
+    m_max_kernel.setArg(0, velocity);
+    m_max_kernel.setArg(1, m_partial);
+    queue.enqueueNDRangeKernel(m_max_kernel, cl::NullRange, cl::NDRange(groups_x * m_tile, groups_y * m_tile), cl::NDRange(m_tile, m_tile));
+
+    m_reduce_kernel.setArg(0, static_cast<cl_int>(groups_x * groups_y));
+    m_reduce_kernel.setArg(1, m_partial);
+    m_reduce_kernel.setArg(2, m_result);
+    queue.enqueueNDRangeKernel(m_reduce_kernel, cl::NullRange, cl::NDRange(m_tile * m_tile), cl::NDRange(m_tile * m_tile));
+
+    queue.enqueueReadBuffer(m_result, CL_FALSE, 0, sizeof(float), &m_host_result, NULL, &m_read_event);
+    queue.flush();
+    m_pending = true;
+}
+
+float AdaptiveTimeStep::Plan(float frame_step, float cfl, float dx, int max_substeps, int& substeps)
+{
+    Poll();
+
+    substeps = 1;
+
+    // A still field allows any step
+    if (!(m_max_speed > 0.0f) || cfl <= 0.0f)
+        return frame_step;
+
+    // Values travel time_step * speed / dx texels per step
+    const float stable_step = cfl * dx / m_max_speed;
+    if (stable_step >= frame_step)
+        return frame_step;
+
+    substeps = std::min(std::max(1, static_cast<int>(std::ceil(frame_step / stable_step))), std::max(1, max_substeps));
+
+    return std::min(frame_step / substeps, stable_step);
+}
+
+void AdaptiveTimeStep::Poll()
+{
+    // Negative statuses are errors, which end the read as well
+    if (!m_pending || m_read_event.getInfo<CL_EVENT_COMMAND_EXECUTION_STATUS>() > CL_COMPLETE)
+        return;
+
+    // A blown up field reports an infinite or NaN speed, which is kept out of the planning
+    if (std::isfinite(m_host_result))
+        m_max_speed = m_host_result;
+    m_pending = false;
+}
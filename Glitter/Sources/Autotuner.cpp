@@ -0,0 +1,157 @@
+#include "Autotuner.hpp"
+#include <cctype>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+// FNV-1a, stable across runs and compilers unlike std::hash
+static std::string HashSource(const std::string& source)
+{
+    unsigned long long hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < source.size(); i++)
+    {
+        hash ^= static_cast<unsigned char>(source[i]);
+        hash *= 1099511628211ULL;
+    }
+
+    std::ostringstream stream;
+    stream << std::hex << hash;
+    return stream.str();
+}
+
+void Autotuner::Init(const cl::Device& device, const std::string& cache_dir, const std::string& kernel_source)
+{
+    m_device = device;
+    m_tuned.clear();
+
+    // One tuning file per device and driver
+    const std::string version = device.getInfo<CL_DRIVER_VERSION>();
+    std::string file_name = device.getInfo<CL_DEVICE_NAME>() + "_" + version;
+    for (size_t i = 0; i < file_name.size(); i++)
+        if (!std::isalnum(static_cast<unsigned char>(file_name[i])))
+            file_name[i] = '_';
+    m_path = cache_dir + "/" + file_name + ".tuning";
+    m_source_hash = HashSource(kernel_source);
+
+    std::ifstream file(m_path.c_str());
+    if (!file.is_open())
+        return;
+
+    std::string tag, hash;
+    file >> tag >> hash;
+    if (tag != "source" || hash != m_source_hash)
+    {
+        std::cout << "Kernel source changed, discarding work-group tuning: " << m_path << std::endl;
+        return;
+    }
+
+    std::string name;
+    LocalSize local;
+    while (file >> name >> local.x >> local.y)
+        m_tuned[name] = local;
+
+    std::cout << "Loaded work-group tuning for " << m_tuned.size() << " kernels from: " << m_path << std::endl;
+}
+
+bool Autotuner::IsTuned(const std::string& kernel_name) const
+{
+    return m_tuned.find(kernel_name) != m_tuned.end();
+}
+
+void Autotuner::Tune(const cl::Program& program, const std::string& kernel_name, const cl::NDRange& global,
+    const std::function<void(const cl::NDRange&)>& launch)
+{
+    const int reps = 5;
+    const std::vector<LocalSize> candidates = Candidates(program, kernel_name, global);
+
+    double best_time = 0.0;
+    LocalSize best = { 0, 0 };
+    for (size_t i = 0; i < candidates.size(); i++)
+    {
+        const cl::NDRange local = (global.dimensions() == 1) ? cl::NDRange(candidates[i].x) : cl::NDRange(candidates[i].x, candidates[i].y);
+
+        // Warm up once, then time the repetitions
+        launch(local);
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (int r = 0; r < reps; r++)
+            launch(local);
+        const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        if (best.x == 0 || elapsed < best_time)
+        {
+            best_time = elapsed;
+            best = candidates[i];
+        }
+    }
+
+    if (best.x == 0)
+        return;
+
+    m_tuned[kernel_name] = best;
+    std::cout << "Tuned " << kernel_name << ": " << best.x << "x" << best.y << " (" << 1000.0 * best_time / reps << " ms)" << std::endl;
+}
+
+cl::NDRange Autotuner::Local(const std::string& kernel_name, const cl::NDRange& global) const
+{
+    std::map<std::string, LocalSize>::const_iterator it = m_tuned.find(kernel_name);
+    if (it == m_tuned.end())
+        return cl::NullRange;
+
+    const LocalSize& local = it->second;
+    if (global.dimensions() == 1)
+        return (global[0] % local.x == 0) ? cl::NDRange(local.x) : cl::NullRange;
+
+    if (global[0] % local.x != 0 || global[1] % local.y != 0)
+        return cl::NullRange;
+
+    return cl::NDRange(local.x, local.y);
+}
+
+bool Autotuner::Save() const
+{
+    std::ofstream file(m_path.c_str());
+    if (!file.is_open())
+    {
+        std::cout << "ERROR::AUTOTUNER::COULD_NOT_WRITE: " << m_path << std::endl;
+        return false;
+    }
+
+    file << "source " << m_source_hash << "\n";
+    for (std::map<std::string, LocalSize>::const_iterator it = m_tuned.begin(); it != m_tuned.end(); ++it)
+        file << it->first << " " << it->second.x << " " << it->second.y << "\n";
+
+    return true;
+}
+
+std::vector<Autotuner::LocalSize> Autotuner::Candidates(const cl::Program& program, const std::string& kernel_name, const cl::NDRange& global) const
+{
+    static const LocalSize tiles_2D[] = {
+        { 8, 8 }, { 16, 8 }, { 8, 16 }, { 16, 16 }, { 32, 4 }, { 4, 32 },
+        { 32, 8 }, { 8, 32 }, { 64, 4 }, { 32, 16 }, { 64, 1 }, { 128, 1 }, { 32, 32 }
+    };
+    static const LocalSize tiles_1D[] = { { 32, 1 }, { 64, 1 }, { 128, 1 }, { 256, 1 }, { 512, 1 } };
+
+    const cl::Kernel kernel(program, kernel_name.c_str());
+    const size_t max_size = kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(m_device);
+    const std::vector<size_t> max_items = m_device.getInfo<CL_DEVICE_MAX_WORK_ITEM_SIZES>();
+
+    const bool is_1D = global.dimensions() == 1;
+    const LocalSize* tiles = is_1D ? tiles_1D : tiles_2D;
+    const size_t count = is_1D ? sizeof(tiles_1D) / sizeof(LocalSize) : sizeof(tiles_2D) / sizeof(LocalSize);
+
+    std::vector<LocalSize> candidates;
+    for (size_t i = 0; i < count; i++)
+    {
+        const LocalSize& tile = tiles[i];
+        if (tile.x * tile.y > max_size || tile.x > max_items[0] || (!is_1D && tile.y > max_items[1]))
+            continue;
+        if (global[0] % tile.x != 0 || (!is_1D && global[1] % tile.y != 0))
+            continue;
+
+        candidates.push_back(tile);
+    }
+
+    return candidates;
+}
@@ -0,0 +1,189 @@
+#include "Benchmark.hpp"
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+StepTimings& StepTimings::operator+=(const StepTimings& other)
+{
+    forces += other.forces;
+    advection += other.advection;
+    divergence += other.divergence;
+    pressure += other.pressure;
+    gradient += other.gradient;
+    diffusion += other.diffusion;
+    vorticity += other.vorticity;
+    dye += other.dye;
+    display += other.display;
+
+    return *this;
+}
+
+StepTimings StepTimings::operator/(double divisor) const
+{
+    StepTimings result;
+    result.forces = forces / divisor;
+    result.advection = advection / divisor;
+    result.divergence = divergence / divisor;
+    result.pressure = pressure / divisor;
+    result.gradient = gradient / divisor;
+    result.diffusion = diffusion / divisor;
+    result.vorticity = vorticity / divisor;
+    result.dye = dye / divisor;
+    result.display = display / divisor;
+
+    return result;
+}
+
+Benchmark::Benchmark(const std::string& device_name, const std::string& baseline_path, float threshold)
+    :
+    m_device_name(device_name),
+    m_baseline_path(baseline_path),
+    m_threshold(threshold)
+{
+}
+
+FieldChecksum Benchmark::Checksum(cl::CommandQueue& queue, const cl::Image2D& image, int width, int height)
+{
+    std::vector<float> data(static_cast<size_t>(width) * height * 4);
+
+    cl::size_t<3> origin;
+    cl::size_t<3> region;
+    region[0] = width;
+    region[1] = height;
+    region[2] = 1;
+    queue.enqueueReadImage(image, CL_TRUE, origin, region, 0, 0, &data[0]);
+
+    FieldChecksum checksum;
+    for (size_t i = 0; i < data.size(); i++)
+    {
+        checksum.sum += data[i];
+        checksum.abs_sum += std::fabs(data[i]);
+    }
+
+    return checksum;
+}
+
+void Benchmark::AddResult(const BenchmarkResult& result)
+{
+    m_results.push_back(result);
+}
+
+void Benchmark::Report() const
+{
+    std::cout << "Benchmark on: " << m_device_name << "\n";
+
+    for (size_t i = 0; i < m_results.size(); i++)
+    {
+        const BenchmarkResult& r = m_results[i];
+        const StepTimings& t = r.average;
+
+        std::cout << std::fixed << std::setprecision(3);
+        std::cout << r.resolution << "x" << r.resolution << ": " << r.steps << " steps, "
+            << r.steps_per_sec << " steps/s, " << 1000.0 * t.Total() << " ms/step\n";
+        std::cout << "    forces " << 1000.0 * t.forces
+            << " | advection " << 1000.0 * t.advection
+            << " | divergence " << 1000.0 * t.divergence
+            << " | pressure " << 1000.0 * t.pressure
+            << " | gradient " << 1000.0 * t.gradient
+            << " | diffusion " << 1000.0 * t.diffusion
+            << " | vorticity " << 1000.0 * t.vorticity
+            << " | dye " << 1000.0 * t.dye
+            << " | display " << 1000.0 * t.display << " (ms)\n";
+
+        std::cout << std::scientific << std::setprecision(9);
+        std::cout << "    checksums: velocity " << r.velocity.sum << " / " << r.velocity.abs_sum
+            << ", pressure " << r.pressure.sum << " / " << r.pressure.abs_sum
+            << ", dye " << r.dye.sum << " / " << r.dye.abs_sum << "\n";
+    }
+
+    std::cout << std::defaultfloat;
+}
+
+bool Benchmark::CheckBaselines() const
+{
+    const std::vector<Baseline> baselines = LoadBaselines();
+    bool passed = true;
+
+    for (size_t i = 0; i < m_results.size(); i++)
+    {
+        const BenchmarkResult& r = m_results[i];
+
+        bool found = false;
+        for (size_t j = 0; j < baselines.size(); j++)
+        {
+            if (baselines[j].device != m_device_name || baselines[j].resolution != r.resolution)
+                continue;
+
+            found = true;
+            const double min_allowed = baselines[j].steps_per_sec * (1.0 - m_threshold);
+            if (r.steps_per_sec < min_allowed)
+            {
+                std::cout << "REGRESSION at " << r.resolution << "x" << r.resolution << ": " << r.steps_per_sec
+                    << " steps/s, baseline " << baselines[j].steps_per_sec << " steps/s" << std::endl;
+                passed = false;
+            }
+            else
+            {
+                std::cout << "OK at " << r.resolution << "x" << r.resolution << ": " << r.steps_per_sec
+                    << " steps/s, baseline " << baselines[j].steps_per_sec << " steps/s" << std::endl;
+            }
+        }
+
+        if (!found)
+            std::cout << "No baseline for " << r.resolution << "x" << r.resolution << " on this device" << std::endl;
+    }
+
+    return passed;
+}
+
+bool Benchmark::SaveBaselines() const
+{
+    // Keep the entries of all other devices
+    std::vector<Baseline> baselines = LoadBaselines();
+    std::vector<Baseline> kept;
+    for (size_t i = 0; i < baselines.size(); i++)
+        if (baselines[i].device != m_device_name)
+            kept.push_back(baselines[i]);
+
+    std::ofstream file(m_baseline_path.c_str());
+    if (!file.is_open())
+    {
+        std::cout << "ERROR::BENCHMARK::COULD_NOT_WRITE_BASELINES: " << m_baseline_path << std::endl;
+        return false;
+    }
+
+    file << "# Full step benchmark baselines\n";
+    file << "# <resolution> <steps per second> <device name>\n";
+    for (size_t i = 0; i < kept.size(); i++)
+        file << kept[i].resolution << " " << kept[i].steps_per_sec << " " << kept[i].device << "\n";
+    for (size_t i = 0; i < m_results.size(); i++)
+        file << m_results[i].resolution << " " << m_results[i].steps_per_sec << " " << m_device_name << "\n";
+
+    return true;
+}
+
+std::vector<Benchmark::Baseline> Benchmark::LoadBaselines() const
+{
+    std::vector<Baseline> baselines;
+
+    std::ifstream file(m_baseline_path.c_str());
+    std::string line;
+    while (std::getline(file, line))
+    {
+        if (line.empty() || line[0] == '#')
+            continue;
+
+        std::istringstream line_stream(line);
+        Baseline baseline;
+        if (!(line_stream >> baseline.resolution >> baseline.steps_per_sec))
+            continue;
+
+        // The device name is the rest of the line and may contain spaces
+        std::getline(line_stream >> std::ws, baseline.device);
+        baselines.push_back(baseline);
+    }
+
+    return baselines;
+}
@@ -0,0 +1,222 @@
+#include "Checkpoint.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stb_image_write.h>
+#include <stb_image.h>
+
+// Group the n-th byte of every 4 byte value together, which lets zlib find the repetition in float data
+static void ShuffleBytes(const unsigned char* src, unsigned char* dst, size_t size)
+{
+    const size_t count = size / 4;
+    for (size_t i = 0; i < count; i++)
+        for (size_t b = 0; b < 4; b++)
+            dst[b * count + i] = src[i * 4 + b];
+}
+
+static void UnshuffleBytes(const unsigned char* src, unsigned char* dst, size_t size)
+{
+    const size_t count = size / 4;
+    for (size_t i = 0; i < count; i++)
+        for (size_t b = 0; b < 4; b++)
+            dst[i * 4 + b] = src[b * count + i];
+}
+
+CheckpointWriter::CheckpointWriter(const cl::Context& context, const cl::CommandQueue& queue, const std::vector<size_t>& field_sizes, bool compress)
+    :
+    m_queue(queue),
+    m_field_sizes(field_sizes),
+    m_compress(compress),
+    m_busy(false)
+{
+    // Host allocated buffers stay mapped for the lifetime of the writer and serve as pinned staging memory
+    for (size_t i = 0; i < m_field_sizes.size(); i++)
+    {
+        m_staging.push_back(cl::Buffer(context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, m_field_sizes[i]));
+        m_mapped.push_back(m_queue.enqueueMapBuffer(m_staging.back(), CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, m_field_sizes[i]));
+    }
+}
+
+CheckpointWriter::~CheckpointWriter()
+{
+    Wait();
+
+    for (size_t i = 0; i < m_staging.size(); i++)
+        m_queue.enqueueUnmapMemObject(m_staging[i], m_mapped[i]);
+    m_queue.finish();
+}
+
+bool CheckpointWriter::Write(const std::string& path, const CheckpointHeader& header, const std::vector<cl::Image2D>& images,
+    const std::vector<cl::Buffer>& buffers)
+{
+    if (m_busy || images.size() + buffers.size() > m_staging.size())
+        return false;
+
+    // The previous writer has finished, release its thread
+    if (m_thread.joinable())
+        m_thread.join();
+
+    cl::size_t<3> origin;
+    cl::size_t<3> region;
+    region[0] = header.width;
+    region[1] = header.height;
+    region[2] = 1;
+
+    std::vector<cl::Event> events(images.size() + buffers.size());
+    for (size_t i = 0; i < images.size(); i++)
+        m_queue.enqueueReadImage(images[i], CL_FALSE, origin, region, 0, 0, m_mapped[i], NULL, &events[i]);
+    for (size_t i = 0; i < buffers.size(); i++)
+    {
+        const size_t field = images.size() + i;
+        m_queue.enqueueReadBuffer(buffers[i], CL_FALSE, 0, m_field_sizes[field], m_mapped[field], NULL, &events[field]);
+    }
+    m_queue.flush();
+
+    CheckpointHeader file_header = header;
+    file_header.field_count = static_cast<uint32_t>(events.size());
+
+    m_busy = true;
+    m_thread = std::thread(&CheckpointWriter::WriteFile, this, path, file_header, events);
+
+    return true;
+}
+
+void CheckpointWriter::Wait()
+{
+    if (m_thread.joinable())
+        m_thread.join();
+}
+
+void CheckpointWriter::WriteFile(std::string path, CheckpointHeader header, std::vector<cl::Event> events)
+{
+    const std::string tmp_path = path + ".tmp";
+    std::ofstream file(tmp_path.c_str(), std::ios::binary);
+    if (!file.is_open())
+    {
+        std::cout << "ERROR::CHECKPOINT::COULD_NOT_WRITE: " << tmp_path << std::endl;
+        cl::WaitForEvents(events);
+        m_busy = false;
+        return;
+    }
+
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    std::vector<unsigned char> shuffled(m_compress ? *std::max_element(m_field_sizes.begin(), m_field_sizes.end()) : 0);
+    for (size_t i = 0; i < events.size(); i++)
+    {
+        events[i].wait();
+
+        const unsigned char* raw = static_cast<const unsigned char*>(m_mapped[i]);
+        const size_t field_size = m_field_sizes[i];
+
+        CheckpointField field;
+        field.id = static_cast<uint32_t>(i);
+        field.raw_size = field_size;
+
+        unsigned char* compressed = NULL;
+        int compressed_size = 0;
+        if (m_compress)
+        {
+            ShuffleBytes(raw, &shuffled[0], field_size);
+            compressed = stbi_zlib_compress(&shuffled[0], static_cast<int>(field_size), &compressed_size, 5);
+        }
+
+        if (compressed)
+        {
+            field.compressed = 1;
+            field.payload_size = compressed_size;
+            file.write(reinterpret_cast<const char*>(&field), sizeof(field));
+            file.write(reinterpret_cast<const char*>(compressed), compressed_size);
+            free(compressed);
+        }
+        else
+        {
+            field.payload_size = field_size;
+            file.write(reinterpret_cast<const char*>(&field), sizeof(field));
+            file.write(reinterpret_cast<const char*>(raw), field_size);
+        }
+    }
+
+    const bool ok = file.good();
+    file.close();
+
+    // Only replace the previous checkpoint once the new one is complete
+    if (ok)
+    {
+        std::remove(path.c_str());
+        if (std::rename(tmp_path.c_str(), path.c_str()) == 0)
+            std::cout << "Checkpoint written at step " << header.step << ": " << path << std::endl;
+        else
+            std::cout << "ERROR::CHECKPOINT::COULD_NOT_RENAME: " << tmp_path << std::endl;
+    }
+    else
+        std::cout << "ERROR::CHECKPOINT::WRITE_FAILED: " << tmp_path << std::endl;
+
+    m_busy = false;
+}
+
+bool LoadCheckpoint(const std::string& path, CheckpointHeader& header, std::vector<std::vector<unsigned char>>& fields)
+{
+    std::ifstream file(path.c_str(), std::ios::binary);
+    if (!file.is_open())
+    {
+        std::cout << "ERROR::CHECKPOINT::COULD_NOT_OPEN: " << path << std::endl;
+        return false;
+    }
+
+    const CheckpointHeader expected;
+    file.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!file || std::memcmp(header.magic, expected.magic, sizeof(header.magic)) != 0 || header.version != expected.version)
+    {
+        std::cout << "ERROR::CHECKPOINT::INVALID_HEADER: " << path << std::endl;
+        return false;
+    }
+
+    fields.assign(header.field_count, std::vector<unsigned char>());
+    for (uint32_t i = 0; i < header.field_count; i++)
+    {
+        CheckpointField field;
+        file.read(reinterpret_cast<char*>(&field), sizeof(field));
+        if (!file || field.id >= header.field_count || (field.compressed && field.payload_size == 0))
+        {
+            std::cout << "ERROR::CHECKPOINT::INVALID_FIELD: " << path << std::endl;
+            return false;
+        }
+
+        std::vector<unsigned char> payload(static_cast<size_t>(field.payload_size));
+        if (!payload.empty())
+            file.read(reinterpret_cast<char*>(&payload[0]), payload.size());
+        if (!file)
+        {
+            std::cout << "ERROR::CHECKPOINT::TRUNCATED: " << path << std::endl;
+            return false;
+        }
+
+        std::vector<unsigned char>& raw = fields[field.id];
+        raw.resize(static_cast<size_t>(field.raw_size));
+
+        if (field.compressed)
+        {
+            int decoded_size = 0;
+            char* decoded = stbi_zlib_decode_malloc(reinterpret_cast<const char*>(&payload[0]), static_cast<int>(payload.size()), &decoded_size);
+            if (!decoded || static_cast<uint64_t>(decoded_size) != field.raw_size)
+            {
+                std::cout << "ERROR::CHECKPOINT::DECOMPRESSION_FAILED: " << path << std::endl;
+                free(decoded);
+                return false;
+            }
+
+            UnshuffleBytes(reinterpret_cast<const unsigned char*>(decoded), &raw[0], raw.size());
+            free(decoded);
+        }
+        else
+            raw.swap(payload);
+    }
+
+    return true;
+}
@@ -0,0 +1,63 @@
+#include "ComputeDevices.hpp"
+#include <iostream>
+
+std::vector<ComputeDevice> ListComputeDevices(int cpu_partitions)
+{
+    std::vector<ComputeDevice> result;
+
+    std::vector<cl::Platform> platforms;
+    cl::Platform::get(&platforms);
+
+    for (size_t p = 0; p < platforms.size(); p++)
+    {
+        std::vector<cl::Device> devices;
+        platforms[p].getDevices(CL_DEVICE_TYPE_ALL, &devices);
+
+        for (size_t d = 0; d < devices.size(); d++)
+        {
+            const std::string name = devices[d].getInfo<CL_DEVICE_NAME>();
+            const cl_uint units = devices[d].getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>();
+
+            // Equal CPU partitions run side by side instead of sharing all cores
+            std::vector<cl::Device> parts;
+            if (cpu_partitions > 1 && devices[d].getInfo<CL_DEVICE_TYPE>() == CL_DEVICE_TYPE_CPU && units >= static_cast<cl_uint>(cpu_partitions))
+            {
+                const cl_device_partition_property properties[] = { CL_DEVICE_PARTITION_EQUALLY, static_cast<cl_device_partition_property>(units / cpu_partitions), 0 };
+                if (devices[d].createSubDevices(properties, &parts) != CL_SUCCESS)
+                    parts.clear();
+            }
+
+            if (parts.empty())
+            {
+                ComputeDevice device = { platforms[p], devices[d], name };
+                result.push_back(device);
+            }
+            else
+            {
+                for (size_t s = 0; s < parts.size(); s++)
+                {
+                    ComputeDevice device = { platforms[p], parts[s], name + " #" + std::to_string(s) };
+                    result.push_back(device);
+                }
+            }
+        }
+    }
+
+    return result;
+}
+
+bool BuildForDevice(const ComputeDevice& device, const std::string& kernel_source, const std::string& build_options, cl::Context& context, cl::Program& program)
+{
+    cl_context_properties properties[] = { CL_CONTEXT_PLATFORM, (cl_context_properties)device.platform(), 0 };
+    context = cl::Context(std::vector<cl::Device>(1, device.device), properties);
+
+    cl::Program::Sources sources(1, std::make_pair(kernel_source.c_str(), kernel_source.length()));
+    program = cl::Program(context, sources);
+    if (program.build({ device.device }, build_options.c_str()) != CL_SUCCESS)
+    {
+        std::cout << "ERROR::DEVICES::BUILD_FAILED: " << device.name << "\n" << program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device.device) << std::endl;
+        return false;
+    }
+
+    return true;
+}
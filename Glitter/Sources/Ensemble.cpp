@@ -0,0 +1,131 @@
+#include "Ensemble.hpp"
+#include <algorithm>
+#include <cmath>
+
+Ensemble::Ensemble()
+    :
+    m_size(0),
+    m_jacobi_reps(0)
+{
+}
+
+void Ensemble::Init(const cl::Context& context, const cl::Program& program, int jacobi_reps)
+{
+    m_context = context;
+    m_jacobi_reps = jacobi_reps;
+    m_advect_kernel = cl::Kernel(program, "EnsembleAdvect");
+    m_divergence_kernel = cl::Kernel(program, "EnsembleDivergence");
+    m_jacobi_kernel = cl::Kernel(program, "EnsembleJacobi");
+    m_gradient_kernel = cl::Kernel(program, "EnsembleGradient");
+}
+
+void Ensemble::Create(cl::CommandQueue& queue, int size, const std::vector<EnsembleMember>& members)
+{
+    m_size = size;
+    m_members = members;
+
+    const size_t count = members.size();
+    m_velocity = cl::Image2DArray(m_context, CL_MEM_READ_WRITE, cl::ImageFormat(CL_RGBA, CL_FLOAT), count, size, size, 0, 0);
+    m_velocity_new = cl::Image2DArray(m_context, CL_MEM_READ_WRITE, cl::ImageFormat(CL_RGBA, CL_FLOAT), count, size, size, 0, 0);
+    m_divergence = cl::Image2DArray(m_context, CL_MEM_READ_WRITE, cl::ImageFormat(CL_RGBA, CL_FLOAT), count, size, size, 0, 0);
+    m_pressure = cl::Image2DArray(m_context, CL_MEM_READ_WRITE, cl::ImageFormat(CL_RGBA, CL_FLOAT), count, size, size, 0, 0);
+    m_pressure_new = cl::Image2DArray(m_context, CL_MEM_READ_WRITE, cl::ImageFormat(CL_RGBA, CL_FLOAT), count, size, size, 0, 0);
+    m_member_buffer = cl::Buffer(m_context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, count * sizeof(EnsembleMember), &m_members[0]);
+
+    cl::size_t<3> origin;
+    cl::size_t<3> region;
+    region[0] = size;
+    region[1] = size;
+    region[2] = count;
+
+    const cl_float4 zero = { { 0.0f, 0.0f, 0.0f, 0.0f } };
+    queue.enqueueFillImage(m_velocity, zero, origin, region);
+    queue.enqueueFillImage(m_velocity_new, zero, origin, region);
+    queue.enqueueFillImage(m_pressure, zero, origin, region);
+    queue.enqueueFillImage(m_pressure_new, zero, origin, region);
+    queue.finish();
+}
+
+void Ensemble::Step(cl::CommandQueue& queue, float time_step, uint32_t step)
+{
+    const size_t region[3] = { static_cast<size_t>(m_size), static_cast<size_t>(m_size), m_members.size() };
+    static const size_t origin[3] = { 0, 0, 0 };
+    const cl::NDRange global(region[0], region[1], region[2]);
+
+    // Advect
+    m_advect_kernel.setArg(0, time_step);
+    m_advect_kernel.setArg(1, static_cast<cl_uint>(step));
+    m_advect_kernel.setArg(2, m_member_buffer);
+    m_advect_kernel.setArg(3, m_velocity);
+    m_advect_kernel.setArg(4, m_velocity_new);
+    queue.enqueueNDRangeKernel(m_advect_kernel, cl::NullRange, global);
+    clEnqueueCopyImage(queue(), m_velocity_new(), m_velocity(), origin, origin, region, 0, NULL, NULL);
+
+    // Project
+    m_divergence_kernel.setArg(0, m_member_buffer);
+    m_divergence_kernel.setArg(1, m_velocity);
+    m_divergence_kernel.setArg(2, m_divergence);
+    queue.enqueueNDRangeKernel(m_divergence_kernel, cl::NullRange, global);
+
+    m_jacobi_kernel.setArg(0, static_cast<cl_int>(0));
+    m_jacobi_kernel.setArg(1, time_step);
+    m_jacobi_kernel.setArg(2, m_member_buffer);
+    m_jacobi_kernel.setArg(3, m_pressure);
+    m_jacobi_kernel.setArg(4, m_divergence);
+    m_jacobi_kernel.setArg(5, m_pressure_new);
+    for (int i = 0; i < m_jacobi_reps; i++)
+    {
+        queue.enqueueNDRangeKernel(m_jacobi_kernel, cl::NullRange, global);
+        clEnqueueCopyImage(queue(), m_pressure_new(), m_pressure(), origin, origin, region, 0, NULL, NULL);
+    }
+
+    m_gradient_kernel.setArg(0, m_member_buffer);
+    m_gradient_kernel.setArg(1, m_pressure);
+    m_gradient_kernel.setArg(2, m_velocity);
+    m_gradient_kernel.setArg(3, m_velocity_new);
+    queue.enqueueNDRangeKernel(m_gradient_kernel, cl::NullRange, global);
+    clEnqueueCopyImage(queue(), m_velocity_new(), m_velocity(), origin, origin, region, 0, NULL, NULL);
+
+    // Diffuse, every member with its own viscosity
+    m_jacobi_kernel.setArg(0, static_cast<cl_int>(1));
+    m_jacobi_kernel.setArg(3, m_velocity);
+    m_jacobi_kernel.setArg(4, m_velocity);
+    m_jacobi_kernel.setArg(5, m_velocity_new);
+    for (int i = 0; i < m_jacobi_reps; i++)
+    {
+        queue.enqueueNDRangeKernel(m_jacobi_kernel, cl::NullRange, global);
+        clEnqueueCopyImage(queue(), m_velocity_new(), m_velocity(), origin, origin, region, 0, NULL, NULL);
+    }
+}
+
+std::vector<EnsembleStats> Ensemble::Measure(cl::CommandQueue& queue) const
+{
+    const size_t cells = static_cast<size_t>(m_size) * m_size;
+    std::vector<float> texels(cells * 4 * m_members.size());
+
+    cl::size_t<3> origin;
+    cl::size_t<3> region;
+    region[0] = m_size;
+    region[1] = m_size;
+    region[2] = m_members.size();
+    queue.enqueueReadImage(m_velocity, CL_TRUE, origin, region, 0, 0, &texels[0]);
+
+    std::vector<EnsembleStats> stats(m_members.size());
+    for (size_t m = 0; m < m_members.size(); m++)
+    {
+        double energy = 0.0;
+        double max_speed = 0.0;
+        const float* layer = &texels[m * cells * 4];
+        for (size_t i = 0; i < cells; i++)
+        {
+            const double speed_squared = static_cast<double>(layer[i * 4]) * layer[i * 4] + static_cast<double>(layer[i * 4 + 1]) * layer[i * 4 + 1];
+            energy += 0.5 * speed_squared;
+            max_speed = std::max(max_speed, speed_squared);
+        }
+
+        stats[m].kinetic_energy = energy / cells;
+        stats[m].max_speed = std::sqrt(max_speed);
+    }
+
+    return stats;
+}
@@ -0,0 +1,213 @@
+#include "FlipSolver.hpp"
+
+// Keys each work-item of the radix sort counts and scatters in order
+static const int radix_chunk = 64;
+static const int radix_bits = 4;
+
+FlipSolver::FlipSolver()
+    :
+    m_scan_tile(256),
+    m_ppc(4),
+    m_width(0),
+    m_height(0),
+    m_count(0),
+    m_threads(0),
+    m_passes(0),
+    m_sorted(0),
+    m_valid(false)
+{
+}
+
+void FlipSolver::Init(const cl::Context& context, const cl::Program& program, int scan_tile, int particles_per_cell)
+{
+    m_context = context;
+    m_scan_tile = scan_tile;
+    m_ppc = particles_per_cell;
+    m_seed_kernel = cl::Kernel(program, "FlipSeed");
+    m_update_kernel = cl::Kernel(program, "FlipUpdate");
+    m_keys_kernel = cl::Kernel(program, "FlipCellKeys");
+    m_count_kernel = cl::Kernel(program, "RadixCount");
+    m_scan_kernel = cl::Kernel(program, "ScanBlocks");
+    m_add_kernel = cl::Kernel(program, "AddBlockSums");
+    m_scatter_kernel = cl::Kernel(program, "RadixScatter");
+    m_reorder_kernel = cl::Kernel(program, "FlipReorder");
+    m_clear_kernel = cl::Kernel(program, "FlipClearCells");
+    m_ranges_kernel = cl::Kernel(program, "FlipCellRanges");
+    m_grid_kernel = cl::Kernel(program, "FlipToGrid");
+}
+
+void FlipSolver::Advance(cl::CommandQueue& queue, const cl::Image2D& velocity, const cl::Image2D& out, float time_step, float rdx, float flip_ratio,
+    uint64_t step, const cl::Buffer& mask, int mask_pitch)
+{
+    static const size_t origin[3] = { 0, 0, 0 };
+
+    const int width = static_cast<int>(velocity.getImageInfo<CL_IMAGE_WIDTH>());
+    const int height = static_cast<int>(velocity.getImageInfo<CL_IMAGE_HEIGHT>());
+    if (width != m_width || height != m_height)
+        Allocate(width, height);
+
+    const size_t region[3] = { static_cast<size_t>(m_width), static_cast<size_t>(m_height), 1 };
+    const cl::NDRange particles(m_count);
+
+    if (!m_valid)
+    {
+        m_seed_kernel.setArg(0, static_cast<cl_int>(m_count));
+        m_seed_kernel.setArg(1, static_cast<cl_int>(m_ppc));
+        m_seed_kernel.setArg(2, static_cast<cl_uint>(step));
+        m_seed_kernel.setArg(3, velocity);
+        m_seed_kernel.setArg(4, m_pos[m_sorted]);
+        m_seed_kernel.setArg(5, m_vel[m_sorted]);
+        queue.enqueueNDRangeKernel(m_seed_kernel, cl::NullRange, particles);
+
+        // The particles start on the grid velocity, so the first update adds no change
+        clEnqueueCopyImage(queue(), velocity(), m_grid_prev(), origin, origin, region, 0, NULL, NULL);
+        m_valid = true;
+    }
+
+    // Grid to particles, then advection
+    m_update_kernel.setArg(0, static_cast<cl_int>(m_count));
+    m_update_kernel.setArg(1, time_step);
+    m_update_kernel.setArg(2, rdx);
+    m_update_kernel.setArg(3, flip_ratio);
+    m_update_kernel.setArg(4, velocity);
+    m_update_kernel.setArg(5, m_grid_prev);
+    m_update_kernel.setArg(6, m_pos[m_sorted]);
+    m_update_kernel.setArg(7, m_vel[m_sorted]);
+    m_update_kernel.setArg(8, mask);
+    m_update_kernel.setArg(9, static_cast<cl_int>(mask_pitch));
+    queue.enqueueNDRangeKernel(m_update_kernel, cl::NullRange, particles);
+
+    // Sort by cell and reorder the particles
+    m_keys_kernel.setArg(0, static_cast<cl_int>(m_count));
+    m_keys_kernel.setArg(1, static_cast<cl_int>(m_width));
+    m_keys_kernel.setArg(2, m_pos[m_sorted]);
+    m_keys_kernel.setArg(3, m_keys[0]);
+    m_keys_kernel.setArg(4, m_values[0]);
+    queue.enqueueNDRangeKernel(m_keys_kernel, cl::NullRange, particles);
+
+    Sort(queue);
+    const int result = m_passes % 2;
+
+    m_reorder_kernel.setArg(0, static_cast<cl_int>(m_count));
+    m_reorder_kernel.setArg(1, m_values[result]);
+    m_reorder_kernel.setArg(2, m_pos[m_sorted]);
+    m_reorder_kernel.setArg(3, m_vel[m_sorted]);
+    m_reorder_kernel.setArg(4, m_pos[1 - m_sorted]);
+    m_reorder_kernel.setArg(5, m_vel[1 - m_sorted]);
+    queue.enqueueNDRangeKernel(m_reorder_kernel, cl::NullRange, particles);
+    m_sorted = 1 - m_sorted;
+
+    // Particles to grid
+    m_clear_kernel.setArg(0, static_cast<cl_int>(m_width * m_height));
+    m_clear_kernel.setArg(1, m_starts);
+    m_clear_kernel.setArg(2, m_ends);
+    queue.enqueueNDRangeKernel(m_clear_kernel, cl::NullRange, cl::NDRange(m_width * m_height));
+
+    m_ranges_kernel.setArg(0, static_cast<cl_int>(m_count));
+    m_ranges_kernel.setArg(1, m_keys[result]);
+    m_ranges_kernel.setArg(2, m_starts);
+    m_ranges_kernel.setArg(3, m_ends);
+    queue.enqueueNDRangeKernel(m_ranges_kernel, cl::NullRange, particles);
+
+    m_grid_kernel.setArg(0, velocity);
+    m_grid_kernel.setArg(1, m_pos[m_sorted]);
+    m_grid_kernel.setArg(2, m_vel[m_sorted]);
+    m_grid_kernel.setArg(3, m_starts);
+    m_grid_kernel.setArg(4, m_ends);
+    m_grid_kernel.setArg(5, out);
+    m_grid_kernel.setArg(6, m_grid_prev);
+    m_grid_kernel.setArg(7, mask);
+    m_grid_kernel.setArg(8, static_cast<cl_int>(mask_pitch));
+    queue.enqueueNDRangeKernel(m_grid_kernel, cl::NullRange, cl::NDRange(m_width, m_height));
+    queue.finish();
+}
+
+void FlipSolver::Allocate(int width, int height)
+{
+    m_width = width;
+    m_height = height;
+    m_count = m_ppc * width * height;
+    m_threads = (m_count + radix_chunk - 1) / radix_chunk;
+    m_sorted = 0;
+    m_valid = false;
+
+    // Enough digits for the largest cell index
+    int bits = 1;
+    while (bits < 32 && (static_cast<unsigned int>(width * height - 1) >> bits) != 0)
+        bits++;
+    m_passes = (bits + radix_bits - 1) / radix_bits;
+
+    for (int i = 0; i < 2; i++)
+    {
+        m_pos[i] = cl::Buffer(m_context, CL_MEM_READ_WRITE, m_count * sizeof(cl_float2));
+        m_vel[i] = cl::Buffer(m_context, CL_MEM_READ_WRITE, m_count * sizeof(cl_float2));
+        m_keys[i] = cl::Buffer(m_context, CL_MEM_READ_WRITE, m_count * sizeof(cl_uint));
+        m_values[i] = cl::Buffer(m_context, CL_MEM_READ_WRITE, m_count * sizeof(cl_uint));
+    }
+    m_starts = cl::Buffer(m_context, CL_MEM_READ_WRITE, width * height * sizeof(cl_uint));
+    m_ends = cl::Buffer(m_context, CL_MEM_READ_WRITE, width * height * sizeof(cl_uint));
+    m_grid_prev = cl::Image2D(m_context, CL_MEM_READ_WRITE, cl::ImageFormat(CL_RGBA, CL_FLOAT), width, height);
+
+    // The digit counts of all work-items, and the block totals of each level of their scan
+    size_t n = static_cast<size_t>(m_threads) * (1 << radix_bits);
+    m_counts = cl::Buffer(m_context, CL_MEM_READ_WRITE, n * sizeof(cl_uint));
+    m_scan_sums.clear();
+    do
+    {
+        n = (n + m_scan_tile - 1) / m_scan_tile;
+        m_scan_sums.push_back(cl::Buffer(m_context, CL_MEM_READ_WRITE, n * sizeof(cl_uint)));
+    } while (n > 1);
+}
+
+void FlipSolver::Sort(cl::CommandQueue& queue)
+{
+    const cl::NDRange threads(m_threads);
+
+    for (int pass = 0; pass < m_passes; pass++)
+    {
+        const int src = pass % 2;
+        const cl_int shift = pass * radix_bits;
+
+        m_count_kernel.setArg(0, static_cast<cl_int>(m_count));
+        m_count_kernel.setArg(1, shift);
+        m_count_kernel.setArg(2, static_cast<cl_int>(radix_chunk));
+        m_count_kernel.setArg(3, m_keys[src]);
+        m_count_kernel.setArg(4, m_counts);
+        queue.enqueueNDRangeKernel(m_count_kernel, cl::NullRange, threads);
+
+        Scan(queue, m_counts, static_cast<size_t>(m_threads) * (1 << radix_bits), 0);
+
+        m_scatter_kernel.setArg(0, static_cast<cl_int>(m_count));
+        m_scatter_kernel.setArg(1, shift);
+        m_scatter_kernel.setArg(2, static_cast<cl_int>(radix_chunk));
+        m_scatter_kernel.setArg(3, m_keys[src]);
+        m_scatter_kernel.setArg(4, m_values[src]);
+        m_scatter_kernel.setArg(5, m_counts);
+        m_scatter_kernel.setArg(6, m_keys[1 - src]);
+        m_scatter_kernel.setArg(7, m_values[1 - src]);
+        queue.enqueueNDRangeKernel(m_scatter_kernel, cl::NullRange, threads);
+    }
+}
+
+void FlipSolver::Scan(cl::CommandQueue& queue, const cl::Buffer& data, size_t n, size_t level)
+{
+    const size_t groups = (n + m_scan_tile - 1) / m_scan_tile;
+    const cl::NDRange global(groups * m_scan_tile);
+    const cl::NDRange local(m_scan_tile);
+
+    m_scan_kernel.setArg(0, static_cast<cl_int>(n));
+    m_scan_kernel.setArg(1, data);
+    m_scan_kernel.setArg(2, m_scan_sums[level]);
+    queue.enqueueNDRangeKernel(m_scan_kernel, cl::NullRange, global, local);
+
+    if (groups == 1)
+        return;
+
+    // Offsets of the blocks, then added to their elements
+    Scan(queue, m_scan_sums[level], groups, level + 1);
+
+    m_add_kernel.setArg(0, static_cast<cl_int>(n));
+    m_add_kernel.setArg(1, data);
+    m_add_kernel.setArg(2, m_scan_sums[level]);
+    queue.enqueueNDRangeKernel(m_add_kernel, cl::NullRange, global, local);
+}
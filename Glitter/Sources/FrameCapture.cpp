@@ -0,0 +1,145 @@
+#include "FrameCapture.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <stb_image_write.h>
+
+FrameCapture::FrameCapture(const cl::Context& context, const cl::CommandQueue& queue, int width, int height,
+    const std::string& directory, CaptureFormat format, int slots)
+    :
+    m_queue(queue),
+    m_width(width),
+    m_height(height),
+    m_directory(directory),
+    m_format(format),
+    m_stop(false),
+    m_dropped(0)
+{
+    const size_t size = static_cast<size_t>(width) * height * 4 * sizeof(float);
+
+    // Host allocated buffers stay mapped and serve as pinned staging memory
+    m_slots.resize(slots);
+    for (size_t i = 0; i < m_slots.size(); i++)
+    {
+        m_slots[i].buffer = cl::Buffer(context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, size);
+        m_slots[i].data = static_cast<float*>(m_queue.enqueueMapBuffer(m_slots[i].buffer, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, size));
+        m_slots[i].step = 0;
+        m_slots[i].in_use = false;
+    }
+
+    m_writer = std::thread(&FrameCapture::WriterLoop, this);
+}
+
+FrameCapture::~FrameCapture()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_condition.notify_one();
+    m_writer.join();
+
+    for (size_t i = 0; i < m_slots.size(); i++)
+        m_queue.enqueueUnmapMemObject(m_slots[i].buffer, m_slots[i].data);
+    m_queue.finish();
+
+    if (m_dropped > 0)
+        std::cout << "Frame capture dropped " << m_dropped << " frames" << std::endl;
+}
+
+bool FrameCapture::Capture(const cl::Image2D& image, uint64_t step)
+{
+    size_t index = m_slots.size();
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (size_t i = 0; i < m_slots.size(); i++)
+        {
+            if (!m_slots[i].in_use)
+            {
+                index = i;
+                m_slots[i].in_use = true;
+                break;
+            }
+        }
+    }
+
+    if (index == m_slots.size())
+    {
+        m_dropped++;
+        return false;
+    }
+
+    cl::size_t<3> origin;
+    cl::size_t<3> region;
+    region[0] = m_width;
+    region[1] = m_height;
+    region[2] = 1;
+
+    Slot& slot = m_slots[index];
+    slot.step = step;
+    m_queue.enqueueReadImage(image, CL_FALSE, origin, region, 0, 0, slot.data, NULL, &slot.read_event);
+    m_queue.flush();
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_pending.push_back(index);
+    }
+    m_condition.notify_one();
+
+    return true;
+}
+
+void FrameCapture::WriterLoop()
+{
+    while (true)
+    {
+        size_t index;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_condition.wait(lock, [this] { return m_stop || !m_pending.empty(); });
+            if (m_pending.empty())
+                return;
+
+            index = m_pending.front();
+            m_pending.pop_front();
+        }
+
+        Slot& slot = m_slots[index];
+        slot.read_event.wait();
+        Encode(slot);
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        slot.in_use = false;
+    }
+}
+
+void FrameCapture::Encode(const Slot& slot)
+{
+    char name[64];
+    std::snprintf(name, sizeof(name), "/frame_%08llu.%s", static_cast<unsigned long long>(slot.step), (m_format == CAPTURE_PNG) ? "png" : "raw");
+    const std::string path = m_directory + name;
+
+    if (m_format == CAPTURE_RAW)
+    {
+        std::ofstream file(path.c_str(), std::ios::binary);
+        file.write(reinterpret_cast<const char*>(slot.data), static_cast<std::streamsize>(m_width) * m_height * 4 * sizeof(float));
+        if (!file.good())
+            std::cout << "ERROR::CAPTURE::COULD_NOT_WRITE: " << path << std::endl;
+        return;
+    }
+
+    // Clamp like the framebuffer blit does and flip, since the first image row is the bottom of the screen
+    std::vector<unsigned char> pixels(static_cast<size_t>(m_width) * m_height * 3);
+    for (int y = 0; y < m_height; y++)
+    {
+        const float* src = slot.data + static_cast<size_t>(m_height - 1 - y) * m_width * 4;
+        unsigned char* dst = &pixels[static_cast<size_t>(y) * m_width * 3];
+        for (int x = 0; x < m_width; x++)
+            for (int c = 0; c < 3; c++)
+                dst[x * 3 + c] = static_cast<unsigned char>(255.0f * std::min(std::max(src[x * 4 + c], 0.0f), 1.0f) + 0.5f);
+    }
+
+    if (!stbi_write_png(path.c_str(), m_width, m_height, 3, &pixels[0], m_width * 3))
+        std::cout << "ERROR::CAPTURE::COULD_NOT_WRITE: " << path << std::endl;
+}
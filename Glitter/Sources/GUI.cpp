@@ -15,10 +15,29 @@ GUI::GUI(GLFWwindow* pWindow, Timer& timer)
     apply_gravity = false;
     clicked = false;
     reset_pressed = false;
+    checkpoint_pressed = false;
+    capture_enabled = false;
     click_mode = VELOCITY_MODE;
     dye_extreme_mode = false;
     normalize_vel_dir = true;
     std_timestep = true;
+    maccormack_advection = false;
+    backtrace_order = 1;
+    adaptive_timestep = false;
+    staggered_grid = false;
+    paint_obstacles = false;
+    sparse_tiles = false;
+    smoke_buoyancy = false;
+    fused_advection = false;
+    show_tracers = false;
+    flip_mode = false;
+    lbm_solver = false;
+    clear_obstacles_pressed = false;
+    cfl_number = 1.0f;
+    smoke_lift = 1.0f;
+    smoke_weight = 0.05f;
+    tracer_life = 5.0f;
+    flip_ratio = 0.95f;
     gui_enabled = true;
     rendered_texture = DYE;
     selected_index = 2;
@@ -61,11 +80,29 @@ void GUI::Render()
     ImGui::Checkbox("Enable/Disable clicking with \'G\'", &clicking_enabled);
     ImGui::TextColored(ImVec4(0.4f, 0.0f, 1.0f, 1.0f), click_mode_string);
     ImGui::Checkbox("Apply gravity", &apply_gravity);
+    ImGui::Checkbox("Buoyant Smoke", &smoke_buoyancy);
+    if (smoke_buoyancy)
+    {
+        ImGui::SliderFloat("Smoke Lift", &smoke_lift, 0.0f, 5.0f, "%.2f");
+        ImGui::SliderFloat("Smoke Weight", &smoke_weight, 0.0f, 1.0f, "%.2f");
+    }
     ImGui::Checkbox("Add Random Force", &rand_force);
     ImGui::Checkbox("Randomize Force Direction", &rand_force_dir);
     ImGui::Checkbox("Dye/Vel extreme mode", &dye_extreme_mode);
     ImGui::Checkbox("Normalize Velocity Direction", &normalize_vel_dir);
     ImGui::Checkbox("Standard Timestep", &std_timestep);
+    ImGui::Checkbox("MacCormack Advection", &maccormack_advection);
+    ImGui::SliderInt("Backtrace Order (Euler/RK2/RK3)", &backtrace_order, 1, 3);
+    ImGui::Checkbox("Fused Velocity/Dye Advection", &fused_advection);
+    ImGui::Checkbox("Staggered (MAC) Grid", &staggered_grid);
+    ImGui::Checkbox("FLIP/PIC Particles", &flip_mode);
+    if (flip_mode)
+        ImGui::SliderFloat("FLIP Ratio", &flip_ratio, 0.0f, 1.0f, "%.2f");
+    ImGui::Checkbox("Lattice Boltzmann (D2Q9)", &lbm_solver);
+    ImGui::Checkbox("Skip Quiet Tiles", &sparse_tiles);
+    ImGui::Checkbox("CFL Adaptive Timestep", &adaptive_timestep);
+    if (adaptive_timestep)
+        ImGui::SliderFloat("CFL Number", &cfl_number, 0.1f, 5.0f);
     ImGui::SliderFloat("Random Force Scale", &force_scale, 0.1f, 50.0f, "%.1f");
     ImGui::SliderFloat("Fluid Viscosity", &viscosity, 0.0f, 10.0f, "%.1f");
     ImGui::SliderFloat("dx", &dx, 0.1f, 2.0f, "%.1f");
@@ -86,6 +123,16 @@ void GUI::Render()
         ImGui::EndCombo();
     }
     ImGui::SliderFloat("Mix Bias", &mix_bias, 0.0f, 1.0f, "%.2f");
+    ImGui::Checkbox("Show Tracers", &show_tracers);
+    if (show_tracers)
+        ImGui::SliderFloat("Tracer Lifetime", &tracer_life, 0.5f, 30.0f, "%.1f");
+    ImGui::Checkbox("Paint Obstacles", &paint_obstacles);
+    if (ImGui::Button("Clear Obstacles"))
+        clear_obstacles_pressed = true;
+    ImGui::Separator();
+    if (ImGui::Button("Save Checkpoint"))
+        checkpoint_pressed = true;
+    ImGui::Checkbox("Capture Frames", &capture_enabled);
     ImGui::Text("Mouse cursor stuff:");
     ImGui::Text("Cursor_x: %f", mouse_xpos);
     ImGui::Text("Cursor_y: %f", mouse_ypos);
@@ -112,6 +159,11 @@ void GUI::ResetForceEnabled()
     rand_force = false;
 }
 
+void GUI::SetForceEnabled(bool flag)
+{
+    rand_force = flag;
+}
+
 float GUI::GetForceScale()
 {
     return force_scale;
@@ -127,6 +179,38 @@ float GUI::GetMixBias()
     return mix_bias;
 }
 
+void GUI::SetForceScale(float scale)
+{
+    force_scale = scale;
+}
+
+void GUI::SetForceDirFlag(bool flag)
+{
+    rand_force_dir = flag;
+}
+
+void GUI::SetMixBias(float bias)
+{
+    mix_bias = bias;
+}
+
+bool GUI::ApplySimulationKey(int key)
+{
+    // Enable/Disable Viewport clicking
+    if (key == GLFW_KEY_G)
+        clicking_enabled = !clicking_enabled;
+    // Reset simulation
+    else if (key == GLFW_KEY_R)
+        reset_pressed = true;
+    // Switch click mode
+    else if (key == GLFW_KEY_M)
+        click_mode = (click_mode == VELOCITY_MODE) ? DYE_MODE : VELOCITY_MODE;
+    else
+        return false;
+
+    return true;
+}
+
 void GUI::ResetInputFlags()
 {
     // TODO: Add all!
@@ -0,0 +1,237 @@
+#include "InputLog.hpp"
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+static const char input_log_magic[4] = { '2', 'D', 'I', 'L' };
+static const uint32_t input_log_version = 1;
+
+// ****************************************************************************************
+// InputRecorder
+// ****************************************************************************************
+
+InputRecorder::InputRecorder()
+    :
+    m_step(0),
+    m_start_time(glfwGetTime()),
+    m_has_snapshot(false)
+{
+}
+
+void InputRecorder::RecordMouseMove(double xpos, double ypos)
+{
+    Record(INPUT_MOUSE_MOVE, 0, xpos, ypos);
+}
+
+void InputRecorder::RecordMouseButton(bool pressed)
+{
+    Record(INPUT_MOUSE_BUTTON, 0, pressed ? 1.0 : 0.0, 0.0);
+}
+
+void InputRecorder::RecordKey(int key)
+{
+    Record(INPUT_KEY, static_cast<uint32_t>(key), 0.0, 0.0);
+}
+
+void InputRecorder::RecordParameters(GUI& gui)
+{
+    double params[PARAM_COUNT];
+    ReadParameters(gui, params);
+
+    // The first snapshot records every parameter, so replays start from the same state
+    for (uint32_t i = 0; i < PARAM_COUNT; i++)
+        if (!m_has_snapshot || params[i] != m_params[i])
+            Record(INPUT_PARAM, i, params[i], 0.0);
+
+    std::memcpy(m_params, params, sizeof(params));
+    m_has_snapshot = true;
+}
+
+void InputRecorder::Snapshot(GUI& gui)
+{
+    ReadParameters(gui, m_params);
+    m_has_snapshot = true;
+}
+
+void InputRecorder::EndStep(float time_step)
+{
+    Record(INPUT_STEP, 0, time_step, 0.0);
+    m_step++;
+}
+
+bool InputRecorder::Save(const std::string& path) const
+{
+    std::ofstream file(path.c_str(), std::ios::binary);
+    if (!file.is_open())
+    {
+        std::cout << "ERROR::INPUT_LOG::COULD_NOT_WRITE: " << path << std::endl;
+        return false;
+    }
+
+    const uint64_t count = m_events.size();
+    file.write(input_log_magic, sizeof(input_log_magic));
+    file.write(reinterpret_cast<const char*>(&input_log_version), sizeof(input_log_version));
+    file.write(reinterpret_cast<const char*>(&count), sizeof(count));
+    if (count > 0)
+        file.write(reinterpret_cast<const char*>(&m_events[0]), count * sizeof(InputEvent));
+
+    std::cout << "Recorded " << m_step << " steps of input to: " << path << std::endl;
+
+    return file.good();
+}
+
+void InputRecorder::Record(InputEventType type, uint32_t id, double a, double b)
+{
+    InputEvent event;
+    event.step = m_step;
+    event.timestamp = glfwGetTime() - m_start_time;
+    event.type = type;
+    event.id = id;
+    event.a = a;
+    event.b = b;
+    m_events.push_back(event);
+}
+
+void InputRecorder::ReadParameters(GUI& gui, double* params)
+{
+    params[PARAM_VISCOSITY] = gui.viscosity;
+    params[PARAM_DX] = gui.dx;
+    params[PARAM_FORCE_SCALE] = gui.GetForceScale();
+    params[PARAM_FORCE_DIR] = gui.GetForceDirFlag();
+    params[PARAM_RAND_FORCE] = gui.IsForceEnabled();
+    params[PARAM_GRAVITY] = gui.apply_gravity;
+    params[PARAM_DYE_EXTREME] = gui.dye_extreme_mode;
+    params[PARAM_NORMALIZE_VEL] = gui.normalize_vel_dir;
+    params[PARAM_STD_TIMESTEP] = gui.std_timestep;
+    params[PARAM_CLICKING] = gui.clicking_enabled;
+    params[PARAM_SELECTED] = gui.selected_index;
+    params[PARAM_MIX_BIAS] = gui.GetMixBias();
+    params[PARAM_CLICK_MODE] = gui.click_mode;
+    params[PARAM_MACCORMACK] = gui.maccormack_advection;
+    params[PARAM_BACKTRACE_ORDER] = gui.backtrace_order;
+    params[PARAM_ADAPTIVE_TIMESTEP] = gui.adaptive_timestep;
+    params[PARAM_CFL_NUMBER] = gui.cfl_number;
+    params[PARAM_STAGGERED_GRID] = gui.staggered_grid;
+    params[PARAM_PAINT_OBSTACLES] = gui.paint_obstacles;
+    params[PARAM_CLEAR_OBSTACLES] = gui.clear_obstacles_pressed;
+    params[PARAM_SPARSE_TILES] = gui.sparse_tiles;
+    params[PARAM_SMOKE_BUOYANCY] = gui.smoke_buoyancy;
+    params[PARAM_SMOKE_LIFT] = gui.smoke_lift;
+    params[PARAM_SMOKE_WEIGHT] = gui.smoke_weight;
+    params[PARAM_FUSED_ADVECTION] = gui.fused_advection;
+    params[PARAM_FLIP_MODE] = gui.flip_mode;
+    params[PARAM_FLIP_RATIO] = gui.flip_ratio;
+    params[PARAM_LBM_SOLVER] = gui.lbm_solver;
+}
+
+// ****************************************************************************************
+// InputReplayer
+// ****************************************************************************************
+
+InputReplayer::InputReplayer()
+    :
+    m_next(0),
+    m_step_count(0)
+{
+}
+
+bool InputReplayer::Load(const std::string& path)
+{
+    std::ifstream file(path.c_str(), std::ios::binary);
+    if (!file.is_open())
+    {
+        std::cout << "ERROR::INPUT_LOG::COULD_NOT_OPEN: " << path << std::endl;
+        return false;
+    }
+
+    char magic[4];
+    uint32_t version = 0;
+    uint64_t count = 0;
+    file.read(magic, sizeof(magic));
+    file.read(reinterpret_cast<char*>(&version), sizeof(version));
+    file.read(reinterpret_cast<char*>(&count), sizeof(count));
+    if (!file || std::memcmp(magic, input_log_magic, sizeof(magic)) != 0 || version != input_log_version)
+    {
+        std::cout << "ERROR::INPUT_LOG::INVALID_HEADER: " << path << std::endl;
+        return false;
+    }
+
+    m_events.resize(static_cast<size_t>(count));
+    if (count > 0)
+        file.read(reinterpret_cast<char*>(&m_events[0]), count * sizeof(InputEvent));
+    if (!file)
+    {
+        std::cout << "ERROR::INPUT_LOG::TRUNCATED: " << path << std::endl;
+        m_events.clear();
+        return false;
+    }
+
+    m_next = 0;
+    m_step_count = 0;
+    for (size_t i = 0; i < m_events.size(); i++)
+        if (m_events[i].type == INPUT_STEP)
+            m_step_count++;
+
+    return true;
+}
+
+float InputReplayer::ApplyStep(GUI& gui)
+{
+    while (m_next < m_events.size())
+    {
+        const InputEvent& event = m_events[m_next++];
+
+        switch (event.type)
+        {
+        case INPUT_MOUSE_MOVE:
+            gui.MousePositionUpdate(event.a, event.b);
+            break;
+        case INPUT_MOUSE_BUTTON:
+            gui.clicked = event.a != 0.0;
+            break;
+        case INPUT_KEY:
+            gui.ApplySimulationKey(static_cast<int>(event.id));
+            break;
+        case INPUT_PARAM:
+            switch (event.id)
+            {
+            case PARAM_VISCOSITY: gui.viscosity = static_cast<float>(event.a); break;
+            case PARAM_DX: gui.dx = static_cast<float>(event.a); break;
+            case PARAM_FORCE_SCALE: gui.SetForceScale(static_cast<float>(event.a)); break;
+            case PARAM_FORCE_DIR: gui.SetForceDirFlag(event.a != 0.0); break;
+            case PARAM_RAND_FORCE: gui.SetForceEnabled(event.a != 0.0); break;
+            case PARAM_GRAVITY: gui.apply_gravity = event.a != 0.0; break;
+            case PARAM_DYE_EXTREME: gui.dye_extreme_mode = event.a != 0.0; break;
+            case PARAM_NORMALIZE_VEL: gui.normalize_vel_dir = event.a != 0.0; break;
+            case PARAM_STD_TIMESTEP: gui.std_timestep = event.a != 0.0; break;
+            case PARAM_CLICKING: gui.clicking_enabled = event.a != 0.0; break;
+            case PARAM_SELECTED: gui.selected_index = static_cast<int>(event.a); break;
+            case PARAM_MIX_BIAS: gui.SetMixBias(static_cast<float>(event.a)); break;
+            case PARAM_CLICK_MODE: gui.click_mode = static_cast<ClickMode>(static_cast<int>(event.a)); break;
+            case PARAM_MACCORMACK: gui.maccormack_advection = event.a != 0.0; break;
+            case PARAM_BACKTRACE_ORDER: gui.backtrace_order = static_cast<int>(event.a); break;
+            case PARAM_ADAPTIVE_TIMESTEP: gui.adaptive_timestep = event.a != 0.0; break;
+            case PARAM_CFL_NUMBER: gui.cfl_number = static_cast<float>(event.a); break;
+            case PARAM_STAGGERED_GRID: gui.staggered_grid = event.a != 0.0; break;
+            case PARAM_PAINT_OBSTACLES: gui.paint_obstacles = event.a != 0.0; break;
+            case PARAM_CLEAR_OBSTACLES: gui.clear_obstacles_pressed = event.a != 0.0; break;
+            case PARAM_SPARSE_TILES: gui.sparse_tiles = event.a != 0.0; break;
+            case PARAM_SMOKE_BUOYANCY: gui.smoke_buoyancy = event.a != 0.0; break;
+            case PARAM_SMOKE_LIFT: gui.smoke_lift = static_cast<float>(event.a); break;
+            case PARAM_SMOKE_WEIGHT: gui.smoke_weight = static_cast<float>(event.a); break;
+            case PARAM_FUSED_ADVECTION: gui.fused_advection = event.a != 0.0; break;
+            case PARAM_FLIP_MODE: gui.flip_mode = event.a != 0.0; break;
+            case PARAM_FLIP_RATIO: gui.flip_ratio = static_cast<float>(event.a); break;
+            case PARAM_LBM_SOLVER: gui.lbm_solver = event.a != 0.0; break;
+            default: break;
+            }
+            break;
+        case INPUT_STEP:
+            return static_cast<float>(event.a);
+        default:
+            break;
+        }
+    }
+
+    return 1.0f;
+}
@@ -0,0 +1,72 @@
+#include "LatticeBoltzmann.hpp"
+#include <algorithm>
+
+LatticeBoltzmann::LatticeBoltzmann()
+    :
+    m_width(0),
+    m_height(0),
+    m_odd(0),
+    m_valid(false)
+{
+}
+
+void LatticeBoltzmann::Init(const cl::Context& context, const cl::Program& program)
+{
+    m_context = context;
+    m_init_kernel = cl::Kernel(program, "LbmInit");
+    m_step_kernel = cl::Kernel(program, "LbmStreamCollide");
+}
+
+void LatticeBoltzmann::Advance(cl::CommandQueue& queue, const cl::Image2D& velocity, const cl::Image2D& out, float time_step, float rdx, float viscosity,
+    const cl::Buffer& mask, int mask_pitch)
+{
+    static const size_t origin[3] = { 0, 0, 0 };
+
+    const int width = static_cast<int>(velocity.getImageInfo<CL_IMAGE_WIDTH>());
+    const int height = static_cast<int>(velocity.getImageInfo<CL_IMAGE_HEIGHT>());
+    if (width != m_width || height != m_height)
+    {
+        m_width = width;
+        m_height = height;
+        m_lattice = cl::Buffer(m_context, CL_MEM_READ_WRITE, 9 * static_cast<size_t>(width) * height * sizeof(cl_float));
+        m_velocity_prev = cl::Image2D(m_context, CL_MEM_READ_WRITE, cl::ImageFormat(CL_RGBA, CL_FLOAT), width, height);
+        m_valid = false;
+    }
+
+    const size_t region[3] = { static_cast<size_t>(m_width), static_cast<size_t>(m_height), 1 };
+    const cl::NDRange global(m_width, m_height);
+
+    // One lattice step per time step: a texel per step in lattice units is 1 / (time_step * rdx) in grid units
+    const float to_lattice = time_step * rdx;
+
+    if (!m_valid)
+    {
+        m_init_kernel.setArg(0, to_lattice);
+        m_init_kernel.setArg(1, velocity);
+        m_init_kernel.setArg(2, m_lattice);
+        queue.enqueueNDRangeKernel(m_init_kernel, cl::NullRange, global);
+        clEnqueueCopyImage(queue(), velocity(), m_velocity_prev(), origin, origin, region, 0, NULL, NULL);
+        m_odd = 0;
+        m_valid = true;
+    }
+
+    // nu = (tau - 1/2) / 3, kept away from the unstable tau = 1/2
+    const float tau = std::max(0.5f + 3.0f * viscosity * to_lattice * rdx, 0.51f);
+
+    m_step_kernel.setArg(0, static_cast<cl_int>(m_odd));
+    m_step_kernel.setArg(1, 1.0f / tau);
+    m_step_kernel.setArg(2, to_lattice);
+    m_step_kernel.setArg(3, velocity);
+    m_step_kernel.setArg(4, m_velocity_prev);
+    m_step_kernel.setArg(5, m_lattice);
+    m_step_kernel.setArg(6, out);
+    m_step_kernel.setArg(7, mask);
+    m_step_kernel.setArg(8, static_cast<cl_int>(mask_pitch));
+    queue.enqueueNDRangeKernel(m_step_kernel, cl::NullRange, global);
+
+    // Keep the velocity the lattice now holds, the next step feeds back only what changes after this
+    clEnqueueCopyImage(queue(), out(), m_velocity_prev(), origin, origin, region, 0, NULL, NULL);
+    queue.finish();
+
+    m_odd = 1 - m_odd;
+}
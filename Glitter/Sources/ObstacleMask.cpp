@@ -0,0 +1,139 @@
+#include "ObstacleMask.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <stb_image.h>
+
+ObstacleMask::ObstacleMask()
+    :
+    m_width(0),
+    m_height(0),
+    m_pitch(0),
+    m_solid_count(0),
+    m_dirty(false)
+{
+}
+
+void ObstacleMask::Init(const cl::Context& context, int width, int height)
+{
+    m_width = width;
+    m_height = height;
+    m_pitch = (width + 31) / 32;
+    m_bits.assign(static_cast<size_t>(m_pitch) * height, 0);
+    m_solid_count = 0;
+    m_buffer = cl::Buffer(context, CL_MEM_READ_ONLY, m_bits.size() * sizeof(uint32_t));
+    m_dirty = true;
+}
+
+bool ObstacleMask::Load(const std::string& path)
+{
+    int image_width, image_height, channels;
+    unsigned char* data = stbi_load(path.c_str(), &image_width, &image_height, &channels, 1);
+    if (!data)
+    {
+        std::cout << "ERROR::OBSTACLES::COULD_NOT_LOAD: " << path << std::endl;
+        return false;
+    }
+
+    // Nearest neighbor resampling, cells darker than half intensity are solid
+    for (int y = 0; y < m_height; y++)
+    {
+        const int src_y = std::min(y * image_height / m_height, image_height - 1);
+        for (int x = 0; x < m_width; x++)
+        {
+            const int src_x = std::min(x * image_width / m_width, image_width - 1);
+            Set(x, y, data[src_y * image_width + src_x] < 128);
+        }
+    }
+
+    stbi_image_free(data);
+
+    std::cout << "Loaded " << m_solid_count << " solid cells from: " << path << std::endl;
+
+    return true;
+}
+
+void ObstacleMask::Paint(double x0, double y0, double x1, double y1, float radius, bool solid)
+{
+    // Flip to grid coordinates, the first row is the bottom of the window
+    const float ax = static_cast<float>(x0);
+    const float ay = static_cast<float>(m_height - 1 - y0);
+    const float bx = static_cast<float>(x1);
+    const float by = static_cast<float>(m_height - 1 - y1);
+
+    const int min_x = std::max(0, static_cast<int>(std::floor(std::min(ax, bx) - radius)));
+    const int min_y = std::max(0, static_cast<int>(std::floor(std::min(ay, by) - radius)));
+    const int max_x = std::min(m_width - 1, static_cast<int>(std::ceil(std::max(ax, bx) + radius)));
+    const int max_y = std::min(m_height - 1, static_cast<int>(std::ceil(std::max(ay, by) + radius)));
+
+    const float dx = bx - ax;
+    const float dy = by - ay;
+    const float length_sqr = dx * dx + dy * dy;
+
+    for (int y = min_y; y <= max_y; y++)
+    {
+        for (int x = min_x; x <= max_x; x++)
+        {
+            // Distance to the segment
+            float t = (length_sqr > 0.0f) ? ((x - ax) * dx + (y - ay) * dy) / length_sqr : 0.0f;
+            t = std::min(std::max(t, 0.0f), 1.0f);
+            const float px = ax + t * dx - x;
+            const float py = ay + t * dy - y;
+
+            if (px * px + py * py <= radius * radius)
+                Set(x, y, solid);
+        }
+    }
+}
+
+void ObstacleMask::Clear()
+{
+    std::fill(m_bits.begin(), m_bits.end(), 0);
+    m_solid_count = 0;
+    m_dirty = true;
+}
+
+bool ObstacleMask::Restore(const std::vector<unsigned char>& data)
+{
+    if (data.size() != GetSize())
+        return false;
+
+    if (!m_bits.empty())
+        std::memcpy(&m_bits[0], &data[0], data.size());
+
+    m_solid_count = 0;
+    for (size_t i = 0; i < m_bits.size(); i++)
+    {
+        for (uint32_t word = m_bits[i]; word != 0; word &= word - 1)
+            m_solid_count++;
+    }
+    m_dirty = true;
+
+    return true;
+}
+
+void ObstacleMask::Upload(cl::CommandQueue& queue)
+{
+    if (!m_dirty || m_bits.empty())
+        return;
+
+    // Blocking, since painting may change the host copy right after
+    queue.enqueueWriteBuffer(m_buffer, CL_TRUE, 0, m_bits.size() * sizeof(uint32_t), static_cast<const void*>(&m_bits[0]));
+    m_dirty = false;
+}
+
+void ObstacleMask::Set(int x, int y, bool solid)
+{
+    uint32_t& word = m_bits[static_cast<size_t>(y) * m_pitch + (x >> 5)];
+    const uint32_t bit = 1u << (x & 31);
+    if (((word & bit) != 0) == solid)
+        return;
+
+    word ^= bit;
+    if (solid)
+        m_solid_count++;
+    else
+        m_solid_count--;
+    m_dirty = true;
+}
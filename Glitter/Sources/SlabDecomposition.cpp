@@ -0,0 +1,380 @@
+#include "SlabDecomposition.hpp"
+#include <iostream>
+#include <utility>
+
+SlabDecomposition::SlabDecomposition()
+    :
+    m_width(0)
+{
+}
+
+SlabDecomposition::~SlabDecomposition()
+{
+    Finish();
+}
+
+SlabDecomposition::Slab::~Slab()
+{
+    UnmapStaging(*this);
+}
+
+bool SlabDecomposition::Init(const std::string& kernel_source, const std::string& build_options, int max_devices, int cpu_partitions)
+{
+    const std::vector<ComputeDevice> devices = ListComputeDevices(cpu_partitions);
+    for (size_t i = 0; i < devices.size(); i++)
+    {
+        if (max_devices > 0 && m_slabs.size() >= static_cast<size_t>(max_devices))
+            break;
+
+        std::unique_ptr<Slab> slab(new Slab);
+        slab->name = devices[i].name;
+        if (!BuildForDevice(devices[i], kernel_source, build_options, slab->context, slab->program))
+            continue;
+
+        // Halo transfers get their own queue, so they run beside the interior rows
+        slab->compute = cl::CommandQueue(slab->context, devices[i].device);
+        slab->transfer = cl::CommandQueue(slab->context, devices[i].device);
+        slab->force_kernel = cl::Kernel(slab->program, "SlabRandomForce");
+        slab->advect_kernel = cl::Kernel(slab->program, "AdvectFluid");
+        slab->divergence_kernel = cl::Kernel(slab->program, "Divergence");
+        slab->jacobi_kernel = cl::Kernel(slab->program, "Jacobi");
+        slab->gradient_kernel = cl::Kernel(slab->program, "Gradient");
+        slab->no_obstacles = cl::Buffer(slab->context, CL_MEM_READ_ONLY, sizeof(cl_uint));
+
+        m_slabs.push_back(std::move(slab));
+    }
+
+    if (m_slabs.empty())
+    {
+        std::cout << "ERROR::SLABS::NO_DEVICES" << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+void SlabDecomposition::Create(int width, int height)
+{
+    const cl_float4 zero = { { 0.0f, 0.0f, 0.0f, 0.0f } };
+
+    // The staging of the previous grid may still be in use
+    Finish();
+
+    // Every slab needs at least one row
+    if (height < static_cast<int>(m_slabs.size()))
+    {
+        std::cout << "Using " << height << " of " << m_slabs.size() << " slabs for " << height << " rows" << std::endl;
+        m_slabs.resize(height);
+    }
+    const int count = static_cast<int>(m_slabs.size());
+
+    m_width = width;
+
+    int first_row = 0;
+    for (int i = 0; i < count; i++)
+    {
+        Slab& slab = *m_slabs[i];
+        slab.first_row = first_row;
+        slab.rows = height / count + ((i < height % count) ? 1 : 0);
+        first_row += slab.rows;
+
+        const int image_height = slab.rows + 2;
+        slab.velocity = cl::Image2D(slab.context, CL_MEM_READ_WRITE, cl::ImageFormat(CL_RGBA, CL_FLOAT), width, image_height);
+        slab.velocity_new = cl::Image2D(slab.context, CL_MEM_READ_WRITE, cl::ImageFormat(CL_RGBA, CL_FLOAT), width, image_height);
+        slab.divergence = cl::Image2D(slab.context, CL_MEM_READ_WRITE, cl::ImageFormat(CL_R, CL_FLOAT), width, image_height);
+        slab.pressure = cl::Image2D(slab.context, CL_MEM_READ_WRITE, cl::ImageFormat(CL_R, CL_FLOAT), width, image_height);
+        slab.pressure_new = cl::Image2D(slab.context, CL_MEM_READ_WRITE, cl::ImageFormat(CL_R, CL_FLOAT), width, image_height);
+        MapStaging(slab, static_cast<size_t>(width) * 4 * sizeof(cl_float));
+        slab.halo_writes.clear();
+        slab.outgoing.clear();
+
+        cl::size_t<3> origin;
+        cl::size_t<3> region;
+        region[0] = width;
+        region[1] = image_height;
+        region[2] = 1;
+
+        // The halos at the grid edges are never written again
+        slab.compute.enqueueFillImage(slab.velocity, zero, origin, region);
+        slab.compute.enqueueFillImage(slab.velocity_new, zero, origin, region);
+        slab.compute.enqueueFillImage(slab.divergence, zero, origin, region);
+        slab.compute.enqueueFillImage(slab.pressure, zero, origin, region);
+        slab.compute.enqueueFillImage(slab.pressure_new, zero, origin, region);
+    }
+
+    Finish();
+}
+
+void SlabDecomposition::Step(float time_step, float viscosity, float dx, float force_scale, uint32_t step, int jacobi_reps)
+{
+    const float rdx = 1.0f / dx;
+
+    // Force
+    Pass(&Slab::force_kernel, [&](Slab& slab)
+    {
+        slab.force_kernel.setArg(0, force_scale);
+        slab.force_kernel.setArg(1, static_cast<cl_uint>(step));
+        slab.force_kernel.setArg(2, static_cast<cl_int>(slab.first_row - 1));
+        slab.force_kernel.setArg(3, slab.velocity);
+        slab.force_kernel.setArg(4, slab.velocity_new);
+    }, &Slab::velocity_new, true);
+    Swap(&Slab::velocity, &Slab::velocity_new);
+
+    // Advect
+    Pass(&Slab::advect_kernel, [&](Slab& slab)
+    {
+        slab.advect_kernel.setArg(0, time_step);
+        slab.advect_kernel.setArg(1, rdx);
+        slab.advect_kernel.setArg(2, 1.0f);
+        slab.advect_kernel.setArg(3, static_cast<cl_int>(1));
+        slab.advect_kernel.setArg(4, slab.velocity);
+        slab.advect_kernel.setArg(5, slab.velocity);
+        slab.advect_kernel.setArg(6, slab.velocity_new);
+        slab.advect_kernel.setArg(7, slab.no_obstacles);
+        slab.advect_kernel.setArg(8, static_cast<cl_int>(0));
+    }, &Slab::velocity_new, true);
+    Swap(&Slab::velocity, &Slab::velocity_new);
+
+    // Divergence, only read at the center by the pressure sweeps
+    Pass(&Slab::divergence_kernel, [&](Slab& slab)
+    {
+        slab.divergence_kernel.setArg(0, 0.5f * rdx);
+        slab.divergence_kernel.setArg(1, slab.velocity);
+        slab.divergence_kernel.setArg(2, slab.divergence);
+        slab.divergence_kernel.setArg(3, slab.no_obstacles);
+        slab.divergence_kernel.setArg(4, static_cast<cl_int>(0));
+    }, &Slab::divergence, false);
+
+    // Pressure, from zero each step. The grid edge halos stay zero as well.
+    const cl_float4 zero = { { 0.0f, 0.0f, 0.0f, 0.0f } };
+    for (size_t i = 0; i < m_slabs.size(); i++)
+    {
+        Slab& slab = *m_slabs[i];
+        cl::size_t<3> origin;
+        cl::size_t<3> region;
+        region[0] = m_width;
+        region[1] = slab.rows + 2;
+        region[2] = 1;
+        slab.compute.enqueueFillImage(slab.pressure, zero, origin, region, &slab.halo_writes);
+        slab.halo_writes.clear();
+    }
+
+    for (int i = 0; i < jacobi_reps; i++)
+    {
+        Pass(&Slab::jacobi_kernel, [&](Slab& slab)
+        {
+            slab.jacobi_kernel.setArg(0, -1.0f);
+            slab.jacobi_kernel.setArg(1, 0.25f);
+            slab.jacobi_kernel.setArg(2, slab.pressure);
+            slab.jacobi_kernel.setArg(3, slab.divergence);
+            slab.jacobi_kernel.setArg(4, slab.pressure_new);
+            slab.jacobi_kernel.setArg(5, slab.no_obstacles);
+            slab.jacobi_kernel.setArg(6, static_cast<cl_int>(0));
+        }, &Slab::pressure_new, true);
+        Swap(&Slab::pressure, &Slab::pressure_new);
+    }
+
+    // Gradient subtraction
+    Pass(&Slab::gradient_kernel, [&](Slab& slab)
+    {
+        slab.gradient_kernel.setArg(0, 0.5f * rdx);
+        slab.gradient_kernel.setArg(1, slab.pressure);
+        slab.gradient_kernel.setArg(2, slab.velocity);
+        slab.gradient_kernel.setArg(3, slab.velocity_new);
+        slab.gradient_kernel.setArg(4, slab.no_obstacles);
+        slab.gradient_kernel.setArg(5, static_cast<cl_int>(0));
+    }, &Slab::velocity_new, true);
+    Swap(&Slab::velocity, &Slab::velocity_new);
+
+    // Diffusion
+    if (viscosity <= 0.0f)
+        return;
+
+    const float center_factor = 1.0f / (viscosity * time_step);
+    const float stencil_factor = 1.0f / (4.0f + center_factor);
+    for (int i = 0; i < jacobi_reps; i++)
+    {
+        Pass(&Slab::jacobi_kernel, [&](Slab& slab)
+        {
+            slab.jacobi_kernel.setArg(0, center_factor);
+            slab.jacobi_kernel.setArg(1, stencil_factor);
+            slab.jacobi_kernel.setArg(2, slab.velocity);
+            slab.jacobi_kernel.setArg(3, slab.velocity);
+            slab.jacobi_kernel.setArg(4, slab.velocity_new);
+            slab.jacobi_kernel.setArg(5, slab.no_obstacles);
+            slab.jacobi_kernel.setArg(6, static_cast<cl_int>(0));
+        }, &Slab::velocity_new, true);
+        Swap(&Slab::velocity, &Slab::velocity_new);
+    }
+}
+
+void SlabDecomposition::Finish()
+{
+    for (size_t i = 0; i < m_slabs.size(); i++)
+    {
+        m_slabs[i]->compute.finish();
+        m_slabs[i]->transfer.finish();
+    }
+}
+
+double SlabDecomposition::KineticEnergy()
+{
+    Finish();
+
+    double energy = 0.0;
+    size_t cells = 0;
+    for (size_t i = 0; i < m_slabs.size(); i++)
+    {
+        Slab& slab = *m_slabs[i];
+        std::vector<float> texels(static_cast<size_t>(m_width) * slab.rows * 4);
+
+        cl::size_t<3> origin;
+        cl::size_t<3> region;
+        origin[1] = 1;
+        region[0] = m_width;
+        region[1] = slab.rows;
+        region[2] = 1;
+        slab.compute.enqueueReadImage(slab.velocity, CL_TRUE, origin, region, 0, 0, &texels[0]);
+
+        for (size_t t = 0; t < texels.size(); t += 4)
+            energy += 0.5 * (static_cast<double>(texels[t]) * texels[t] + static_cast<double>(texels[t + 1]) * texels[t + 1]);
+        cells += static_cast<size_t>(m_width) * slab.rows;
+    }
+
+    return (cells > 0) ? energy / cells : 0.0;
+}
+
+void SlabDecomposition::Pass(cl::Kernel Slab::* kernel, const std::function<void(Slab&)>& set_args, cl::Image2D Slab::* written, bool exchange)
+{
+    const size_t count = m_slabs.size();
+    exchange = exchange && count > 1;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        Slab& slab = *m_slabs[i];
+        set_args(slab);
+
+        // Halos written into the images of this slab since its last pass
+        std::vector<cl::Event> wait;
+        wait.swap(slab.halo_writes);
+
+        cl::Kernel& k = slab.*kernel;
+        if (exchange && slab.rows > 2)
+        {
+            // In order, so the second edge row completes both
+            slab.compute.enqueueNDRangeKernel(k, cl::NDRange(0, 1), cl::NDRange(m_width, 1), cl::NullRange, &wait);
+            slab.compute.enqueueNDRangeKernel(k, cl::NDRange(0, slab.rows), cl::NDRange(m_width, 1), cl::NullRange, NULL, &slab.edge_done);
+            slab.compute.enqueueNDRangeKernel(k, cl::NDRange(0, 2), cl::NDRange(m_width, slab.rows - 2), cl::NullRange, NULL, &slab.pass_done);
+        }
+        else
+        {
+            slab.compute.enqueueNDRangeKernel(k, cl::NDRange(0, 1), cl::NDRange(m_width, slab.rows), cl::NullRange, &wait, &slab.pass_done);
+            slab.edge_done = slab.pass_done;
+        }
+        slab.compute.flush();
+    }
+
+    if (!exchange)
+        return;
+
+    // Read the edge rows as soon as they are done, while the interior rows run
+    for (size_t i = 0; i < count; i++)
+    {
+        Slab& slab = *m_slabs[i];
+
+        // The staging may still be the source of the previous writes. They belong to the contexts of both neighbors,
+        // and one wait may only span a single context.
+        for (size_t e = 0; e < slab.outgoing.size(); e++)
+            slab.outgoing[e].wait();
+        slab.outgoing.clear();
+
+        const std::vector<cl::Event> after_edges(1, slab.edge_done);
+        cl::size_t<3> origin;
+        cl::size_t<3> region;
+        region[0] = m_width;
+        region[1] = 1;
+        region[2] = 1;
+
+        if (i > 0)
+        {
+            origin[1] = 1;
+            slab.transfer.enqueueReadImage(slab.*written, CL_FALSE, origin, region, 0, 0, slab.send_low, &after_edges, &slab.read_low);
+        }
+        if (i + 1 < count)
+        {
+            origin[1] = slab.rows;
+            slab.transfer.enqueueReadImage(slab.*written, CL_FALSE, origin, region, 0, 0, slab.send_high, &after_edges, &slab.read_high);
+        }
+        slab.transfer.flush();
+    }
+
+    // Devices of different platforms share no events, so the host hands each row over when its read is done
+    for (size_t i = 0; i < count; i++)
+    {
+        Slab& slab = *m_slabs[i];
+        cl::size_t<3> origin;
+        cl::size_t<3> region;
+        region[0] = m_width;
+        region[1] = 1;
+        region[2] = 1;
+
+        if (i > 0)
+        {
+            Slab& below = *m_slabs[i - 1];
+            const std::vector<cl::Event> after_pass(1, below.pass_done);
+            cl::Event event;
+            slab.read_low.wait();
+            origin[1] = below.rows + 1;
+            below.transfer.enqueueWriteImage(below.*written, CL_FALSE, origin, region, 0, 0, slab.send_low, &after_pass, &event);
+            below.halo_writes.push_back(event);
+            slab.outgoing.push_back(event);
+        }
+        if (i + 1 < count)
+        {
+            Slab& above = *m_slabs[i + 1];
+            const std::vector<cl::Event> after_pass(1, above.pass_done);
+            cl::Event event;
+            slab.read_high.wait();
+            origin[1] = 0;
+            above.transfer.enqueueWriteImage(above.*written, CL_FALSE, origin, region, 0, 0, slab.send_high, &after_pass, &event);
+            above.halo_writes.push_back(event);
+            slab.outgoing.push_back(event);
+        }
+    }
+
+    for (size_t i = 0; i < count; i++)
+        m_slabs[i]->transfer.flush();
+}
+
+void SlabDecomposition::Swap(cl::Image2D Slab::* a, cl::Image2D Slab::* b)
+{
+    for (size_t i = 0; i < m_slabs.size(); i++)
+    {
+        Slab& slab = *m_slabs[i];
+        std::swap(slab.*a, slab.*b);
+    }
+}
+
+void SlabDecomposition::MapStaging(Slab& slab, size_t size)
+{
+    UnmapStaging(slab);
+
+    // Host allocated buffers stay mapped and serve as pinned staging for the edge rows
+    slab.staging_low = cl::Buffer(slab.context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, size);
+    slab.staging_high = cl::Buffer(slab.context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, size);
+    slab.send_low = static_cast<float*>(slab.transfer.enqueueMapBuffer(slab.staging_low, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, size));
+    slab.send_high = static_cast<float*>(slab.transfer.enqueueMapBuffer(slab.staging_high, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, size));
+}
+
+void SlabDecomposition::UnmapStaging(Slab& slab)
+{
+    if (slab.send_low)
+        slab.transfer.enqueueUnmapMemObject(slab.staging_low, slab.send_low);
+    if (slab.send_high)
+        slab.transfer.enqueueUnmapMemObject(slab.staging_high, slab.send_high);
+    if (slab.send_low || slab.send_high)
+        slab.transfer.finish();
+
+    slab.send_low = NULL;
+    slab.send_high = NULL;
+}
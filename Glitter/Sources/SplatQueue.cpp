@@ -0,0 +1,92 @@
+#include "SplatQueue.hpp"
+#include <algorithm>
+#include <cmath>
+
+SplatQueue::SplatQueue()
+    :
+    m_capacity(0)
+{
+}
+
+void SplatQueue::Init(const cl::Context& context, const cl::Program& program, size_t capacity)
+{
+    m_context = context;
+    m_kernel = cl::Kernel(program, "SplatBatch");
+    m_capacity = capacity;
+    m_buffer = cl::Buffer(m_context, CL_MEM_READ_ONLY, m_capacity * sizeof(Splat));
+}
+
+void SplatQueue::Add(double x0, double y0, double x1, double y1, float radius, const cl_float4& value, bool blend)
+{
+    Splat splat;
+    splat.segment.s[0] = static_cast<float>(x0);
+    splat.segment.s[1] = static_cast<float>(y0);
+    splat.segment.s[2] = static_cast<float>(x1);
+    splat.segment.s[3] = static_cast<float>(y1);
+    splat.value = value;
+    splat.radius = radius;
+    splat.blend = blend ? 1 : 0;
+    splat.padding[0] = splat.padding[1] = 0;
+    m_splats.push_back(splat);
+}
+
+void SplatQueue::Apply(cl::CommandQueue& queue, cl::Image2D& field, cl::Image2D& scratch)
+{
+    if (m_splats.empty())
+        return;
+
+    const int width = static_cast<int>(field.getImageInfo<CL_IMAGE_WIDTH>());
+    const int height = static_cast<int>(field.getImageInfo<CL_IMAGE_HEIGHT>());
+
+    // Flip to image coordinates, the first image row is the bottom of the window, and grow the bounding box
+    int x0 = width;
+    int y0 = height;
+    int x1 = -1;
+    int y1 = -1;
+    for (size_t i = 0; i < m_splats.size(); i++)
+    {
+        Splat& splat = m_splats[i];
+        splat.segment.s[1] = height - 1 - splat.segment.s[1];
+        splat.segment.s[3] = height - 1 - splat.segment.s[3];
+
+        const float extent = std::ceil(splat.radius);
+        x0 = std::min(x0, static_cast<int>(std::floor(std::min(splat.segment.s[0], splat.segment.s[2]) - extent)));
+        y0 = std::min(y0, static_cast<int>(std::floor(std::min(splat.segment.s[1], splat.segment.s[3]) - extent)));
+        x1 = std::max(x1, static_cast<int>(std::ceil(std::max(splat.segment.s[0], splat.segment.s[2]) + extent)));
+        y1 = std::max(y1, static_cast<int>(std::ceil(std::max(splat.segment.s[1], splat.segment.s[3]) + extent)));
+    }
+
+    x0 = std::max(x0, 0);
+    y0 = std::max(y0, 0);
+    x1 = std::min(x1, width - 1);
+    y1 = std::min(y1, height - 1);
+
+    // Nothing to do when the whole stroke lies outside the field
+    if (x0 > x1 || y0 > y1)
+    {
+        m_splats.clear();
+        return;
+    }
+
+    if (m_splats.size() > m_capacity)
+    {
+        m_capacity = std::max(m_splats.size(), 2 * m_capacity);
+        m_buffer = cl::Buffer(m_context, CL_MEM_READ_ONLY, m_capacity * sizeof(Splat));
+    }
+
+    queue.enqueueWriteBuffer(m_buffer, CL_FALSE, 0, m_splats.size() * sizeof(Splat), &m_splats[0]);
+
+    const size_t boxOrigin[3] = { static_cast<size_t>(x0), static_cast<size_t>(y0), 0 };
+    const size_t boxSize[3] = { static_cast<size_t>(x1 - x0 + 1), static_cast<size_t>(y1 - y0 + 1), 1 };
+
+    m_kernel.setArg(0, static_cast<cl_int>(m_splats.size()));
+    m_kernel.setArg(1, m_buffer);
+    m_kernel.setArg(2, field);
+    m_kernel.setArg(3, scratch);
+    queue.enqueueNDRangeKernel(m_kernel, cl::NDRange(boxOrigin[0], boxOrigin[1]), cl::NDRange(boxSize[0], boxSize[1]));
+    clEnqueueCopyImage(queue(), scratch(), field(), boxOrigin, boxOrigin, boxSize, 0, NULL, NULL);
+
+    // The host copy has to stay alive until the non-blocking upload is done
+    queue.finish();
+    m_splats.clear();
+}
@@ -0,0 +1,259 @@
+#include "SweepScheduler.hpp"
+#include "Benchmark.hpp"
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+// ****************************************************************************************
+// SweepSpec
+// ****************************************************************************************
+
+bool SweepSpec::Load(const std::string& path)
+{
+    std::ifstream file(path.c_str());
+    if (!file.is_open())
+    {
+        std::cout << "ERROR::SWEEP::COULD_NOT_OPEN: " << path << std::endl;
+        return false;
+    }
+
+    std::string line;
+    while (std::getline(file, line))
+    {
+        line = line.substr(0, line.find('#'));
+
+        std::istringstream stream(line);
+        std::string key;
+        if (!(stream >> key))
+            continue;
+
+        SweepRange* range = NULL;
+        if (key == "viscosity")
+            range = &viscosity;
+        else if (key == "dx")
+            range = &dx;
+        else if (key == "jacobi")
+            range = &jacobi;
+        else if (key == "resolution")
+            range = &resolution;
+
+        bool valid;
+        if (range)
+            valid = static_cast<bool>(stream >> range->min >> range->max >> range->count) && range->count > 0;
+        else if (key == "steps")
+            valid = static_cast<bool>(stream >> steps) && steps > 0;
+        else if (key == "batch")
+            valid = static_cast<bool>(stream >> batch) && batch > 0;
+        else if (key == "force")
+            valid = static_cast<bool>(stream >> force_scale);
+        else
+            valid = false;
+
+        if (!valid)
+        {
+            std::cout << "ERROR::SWEEP::INVALID_LINE: " << line << std::endl;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// ****************************************************************************************
+// SweepScheduler
+// ****************************************************************************************
+
+SweepScheduler::SweepScheduler(const std::string& kernel_source, const std::string& build_options, int cpu_partitions)
+    :
+    m_steps(0),
+    m_elapsed(0.0)
+{
+    const std::vector<ComputeDevice> devices = ListComputeDevices(cpu_partitions);
+    for (size_t i = 0; i < devices.size(); i++)
+    {
+        std::unique_ptr<Worker> worker(new Worker);
+        worker->name = devices[i].name;
+        if (!BuildForDevice(devices[i], kernel_source, build_options, worker->context, worker->program))
+            continue;
+        worker->queue = cl::CommandQueue(worker->context, devices[i].device);
+
+        std::cout << "Sweep worker: " << worker->name << std::endl;
+        m_workers.push_back(std::move(worker));
+    }
+}
+
+void SweepScheduler::Run(const SweepSpec& spec)
+{
+    m_steps = spec.steps;
+    m_jobs.clear();
+    m_results.clear();
+
+    // Members of equal resolution and Jacobi count share an ensemble, in batches so the load can be balanced.
+    // Seeds follow the member order of the sweep, so results do not depend on the device that ran them.
+    cl_uint seed = 0;
+    for (int r = 0; r < spec.resolution.count; r++)
+    {
+        for (int j = 0; j < spec.jacobi.count; j++)
+        {
+            SweepJob job;
+            job.resolution = static_cast<int>(spec.resolution.Value(r) + 0.5);
+            job.jacobi_reps = static_cast<int>(spec.jacobi.Value(j) + 0.5);
+
+            for (int v = 0; v < spec.viscosity.count; v++)
+            {
+                for (int x = 0; x < spec.dx.count; x++)
+                {
+                    EnsembleMember member;
+                    member.viscosity = static_cast<cl_float>(spec.viscosity.Value(v));
+                    member.dx = static_cast<cl_float>(spec.dx.Value(x));
+                    member.force_scale = spec.force_scale;
+                    member.seed = seed++;
+                    job.members.push_back(member);
+
+                    if (static_cast<int>(job.members.size()) == spec.batch)
+                    {
+                        m_jobs.push_back(job);
+                        job.members.clear();
+                    }
+                }
+            }
+
+            if (!job.members.empty())
+                m_jobs.push_back(job);
+        }
+    }
+
+    if (m_workers.empty())
+    {
+        std::cout << "ERROR::SWEEP::NO_DEVICES" << std::endl;
+        return;
+    }
+
+    // Largest first, dealt round robin, so the small jobs are left at the back for stealing
+    std::vector<size_t> order(m_jobs.size());
+    for (size_t i = 0; i < order.size(); i++)
+        order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [this](size_t a, size_t b)
+    {
+        const SweepJob& ja = m_jobs[a];
+        const SweepJob& jb = m_jobs[b];
+        return static_cast<double>(ja.resolution) * ja.resolution * ja.jacobi_reps * ja.members.size() >
+            static_cast<double>(jb.resolution) * jb.resolution * jb.jacobi_reps * jb.members.size();
+    });
+    for (size_t i = 0; i < order.size(); i++)
+        m_workers[i % m_workers.size()]->jobs.push_back(order[i]);
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < m_workers.size(); i++)
+        threads.push_back(std::thread(&SweepScheduler::WorkerLoop, this, i));
+    for (size_t i = 0; i < threads.size(); i++)
+        threads[i].join();
+
+    m_elapsed = SecondsSince(start);
+
+    std::sort(m_results.begin(), m_results.end(), [](const SweepResult& a, const SweepResult& b) { return a.member.seed < b.member.seed; });
+}
+
+bool SweepScheduler::NextJob(size_t worker, size_t& job)
+{
+    {
+        Worker& own = *m_workers[worker];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.jobs.empty())
+        {
+            job = own.jobs.front();
+            own.jobs.pop_front();
+            return true;
+        }
+    }
+
+    for (size_t i = 1; i < m_workers.size(); i++)
+    {
+        Worker& victim = *m_workers[(worker + i) % m_workers.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.jobs.empty())
+        {
+            job = victim.jobs.back();
+            victim.jobs.pop_back();
+            m_workers[worker]->stolen++;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void SweepScheduler::WorkerLoop(size_t worker)
+{
+    Worker& self = *m_workers[worker];
+    Ensemble ensemble;
+
+    size_t index;
+    while (NextJob(worker, index))
+    {
+        const SweepJob& job = m_jobs[index];
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        ensemble.Init(self.context, self.program, job.jacobi_reps);
+        ensemble.Create(self.queue, job.resolution, job.members);
+        for (int i = 0; i < m_steps; i++)
+            ensemble.Step(self.queue, 1.0f, static_cast<uint32_t>(i));
+        const std::vector<EnsembleStats> stats = ensemble.Measure(self.queue);
+
+        const double seconds = SecondsSince(start);
+        self.busy += seconds;
+        self.completed++;
+
+        std::lock_guard<std::mutex> lock(m_results_mutex);
+        for (size_t i = 0; i < job.members.size(); i++)
+        {
+            SweepResult result;
+            result.job = index;
+            result.device = self.name;
+            result.resolution = job.resolution;
+            result.jacobi_reps = job.jacobi_reps;
+            result.member = job.members[i];
+            result.stats = stats[i];
+            result.job_seconds = seconds;
+            m_results.push_back(result);
+        }
+    }
+}
+
+void SweepScheduler::Report() const
+{
+    double cell_steps = 0.0;
+    for (size_t i = 0; i < m_results.size(); i++)
+        cell_steps += static_cast<double>(m_results[i].resolution) * m_results[i].resolution * m_steps;
+
+    std::cout << "Sweep of " << m_results.size() << " members in " << m_jobs.size() << " jobs took " << m_elapsed << "s ("
+        << cell_steps / m_elapsed / 1.0e6 << " Mcell steps/s)\n";
+    for (size_t i = 0; i < m_workers.size(); i++)
+        std::cout << "  " << m_workers[i]->name << ": " << m_workers[i]->completed << " jobs, " << m_workers[i]->stolen << " stolen, busy "
+            << m_workers[i]->busy << "s\n";
+}
+
+bool SweepScheduler::WriteSummary(const std::string& path) const
+{
+    std::ofstream file(path.c_str());
+    if (!file.is_open())
+    {
+        std::cout << "ERROR::SWEEP::COULD_NOT_WRITE: " << path << std::endl;
+        return false;
+    }
+
+    file << "seed,job,device,resolution,jacobi_reps,viscosity,dx,force_scale,steps,kinetic_energy,max_speed,job_seconds\n";
+    for (size_t i = 0; i < m_results.size(); i++)
+    {
+        const SweepResult& r = m_results[i];
+        file << r.member.seed << "," << r.job << ",\"" << r.device << "\"," << r.resolution << "," << r.jacobi_reps << "," << r.member.viscosity << ","
+            << r.member.dx << "," << r.member.force_scale << "," << m_steps << "," << r.stats.kinetic_energy << "," << r.stats.max_speed << ","
+            << r.job_seconds << "\n";
+    }
+
+    return file.good();
+}
@@ -0,0 +1,335 @@
+#include "TimeSeries.hpp"
+#include <cstring>
+#include <iostream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const size_t page_size = 4096;
+
+static size_t AlignToPage(size_t size)
+{
+    return (size + page_size - 1) / page_size * page_size;
+}
+
+// ****************************************************************************************
+// MappedFile
+// ****************************************************************************************
+
+MappedFile::MappedFile()
+    :
+    m_file(NULL),
+    m_mapping(NULL),
+    m_fd(-1),
+    m_data(NULL),
+    m_size(0),
+    m_writable(false)
+{
+}
+
+MappedFile::~MappedFile()
+{
+    Close();
+}
+
+bool MappedFile::Open(const std::string& path, size_t size, bool writable)
+{
+    Close();
+    m_writable = writable;
+
+#ifdef _WIN32
+    m_file = CreateFileA(path.c_str(), writable ? (GENERIC_READ | GENERIC_WRITE) : GENERIC_READ, FILE_SHARE_READ, NULL,
+        writable ? CREATE_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (m_file == INVALID_HANDLE_VALUE)
+    {
+        m_file = NULL;
+        return false;
+    }
+
+    if (!writable)
+    {
+        LARGE_INTEGER file_size;
+        GetFileSizeEx(m_file, &file_size);
+        size = static_cast<size_t>(file_size.QuadPart);
+    }
+#else
+    m_fd = open(path.c_str(), writable ? (O_RDWR | O_CREAT | O_TRUNC) : O_RDONLY, 0644);
+    if (m_fd < 0)
+        return false;
+
+    if (writable)
+    {
+        if (ftruncate(m_fd, static_cast<off_t>(size)) != 0)
+        {
+            Close();
+            return false;
+        }
+    }
+    else
+    {
+        struct stat file_stat;
+        fstat(m_fd, &file_stat);
+        size = static_cast<size_t>(file_stat.st_size);
+    }
+#endif
+
+    m_size = size;
+    if (!Map())
+    {
+        Close();
+        return false;
+    }
+
+    return true;
+}
+
+bool MappedFile::Resize(size_t size)
+{
+    if (!m_writable || m_data == NULL)
+        return false;
+
+    Unmap();
+
+#ifndef _WIN32
+    // The Windows mapping grows the file itself
+    if (ftruncate(m_fd, static_cast<off_t>(size)) != 0)
+        return false;
+#endif
+
+    m_size = size;
+    return Map();
+}
+
+void MappedFile::Flush()
+{
+    if (m_data == NULL || !m_writable)
+        return;
+
+#ifdef _WIN32
+    FlushViewOfFile(m_data, 0);
+#else
+    msync(m_data, m_size, MS_ASYNC);
+#endif
+}
+
+void MappedFile::Close()
+{
+    Unmap();
+
+#ifdef _WIN32
+    if (m_file)
+        CloseHandle(m_file);
+    m_file = NULL;
+#else
+    if (m_fd >= 0)
+        close(m_fd);
+    m_fd = -1;
+#endif
+
+    m_size = 0;
+}
+
+bool MappedFile::Map()
+{
+#ifdef _WIN32
+    const unsigned long long size = m_size;
+    m_mapping = CreateFileMappingA(m_file, NULL, m_writable ? PAGE_READWRITE : PAGE_READONLY,
+        static_cast<DWORD>(size >> 32), static_cast<DWORD>(size & 0xffffffffULL), NULL);
+    if (m_mapping == NULL)
+        return false;
+
+    m_data = static_cast<unsigned char*>(MapViewOfFile(m_mapping, m_writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, m_size));
+#else
+    void* data = mmap(NULL, m_size, m_writable ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, m_fd, 0);
+    m_data = (data == MAP_FAILED) ? NULL : static_cast<unsigned char*>(data);
+#endif
+
+    return m_data != NULL;
+}
+
+void MappedFile::Unmap()
+{
+#ifdef _WIN32
+    if (m_data)
+        UnmapViewOfFile(m_data);
+    if (m_mapping)
+        CloseHandle(m_mapping);
+    m_mapping = NULL;
+#else
+    if (m_data)
+        munmap(m_data, m_size);
+#endif
+
+    m_data = NULL;
+}
+
+// ****************************************************************************************
+// TimeSeriesWriter
+// ****************************************************************************************
+
+TimeSeriesWriter::TimeSeriesWriter(const cl::Context& context, const cl::CommandQueue& queue, const cl::Program& program,
+    const std::string& path, int width, int height, uint32_t capacity, bool half)
+    :
+    m_queue(queue),
+    m_width(width),
+    m_height(height),
+    m_capacity(capacity),
+    m_half(half),
+    m_appended(0)
+{
+    if (half)
+    {
+        m_pack_kernel = cl::Kernel(program, "PackHalf");
+        m_half_buffer = cl::Buffer(context, CL_MEM_WRITE_ONLY, FrameSize());
+    }
+
+    // Room for the index and a first batch of frames, grown on demand
+    m_end = AlignToPage(sizeof(TimeSeriesHeader) + capacity * sizeof(TimeSeriesEntry));
+    if (!m_file.Open(path, m_end + 16 * FrameSize(), true))
+    {
+        std::cout << "ERROR::TIME_SERIES::COULD_NOT_MAP: " << path << std::endl;
+        return;
+    }
+
+    TimeSeriesHeader header;
+    header.width = width;
+    header.height = height;
+    header.capacity = capacity;
+    std::memcpy(m_file.Data(), &header, sizeof(header));
+}
+
+TimeSeriesWriter::~TimeSeriesWriter()
+{
+    if (!IsOpen())
+        return;
+
+    Commit();
+    m_file.Flush();
+}
+
+bool TimeSeriesWriter::Append(const cl::Image2D& image, TimeSeriesField field, uint64_t step, double time)
+{
+    if (!IsOpen() || m_appended >= m_capacity)
+        return false;
+
+    const size_t frame_size = FrameSize();
+
+    // Growing remaps the file, so no transfer may still target the old mapping
+    if (m_end + frame_size > m_file.Size())
+    {
+        Commit();
+        if (!m_file.Resize(m_file.Size() * 2 + frame_size))
+        {
+            std::cout << "ERROR::TIME_SERIES::COULD_NOT_GROW" << std::endl;
+            return false;
+        }
+    }
+
+    TimeSeriesEntry entry;
+    entry.step = step;
+    entry.time = time;
+    entry.offset = m_end;
+    entry.field = field;
+    entry.format = m_half ? SERIES_FLOAT16 : SERIES_FLOAT32;
+    std::memcpy(m_file.Data() + sizeof(TimeSeriesHeader) + m_appended * sizeof(TimeSeriesEntry), &entry, sizeof(entry));
+
+    cl::size_t<3> origin;
+    cl::size_t<3> region;
+    region[0] = m_width;
+    region[1] = m_height;
+    region[2] = 1;
+
+    cl::Event event;
+    if (m_half)
+    {
+        m_pack_kernel.setArg(0, image);
+        m_pack_kernel.setArg(1, m_half_buffer);
+        m_queue.enqueueNDRangeKernel(m_pack_kernel, cl::NullRange, cl::NDRange(m_width, m_height));
+        m_queue.enqueueReadBuffer(m_half_buffer, CL_FALSE, 0, frame_size, m_file.Data() + m_end, NULL, &event);
+    }
+    else
+        m_queue.enqueueReadImage(image, CL_FALSE, origin, region, 0, 0, m_file.Data() + m_end, NULL, &event);
+
+    m_pending.push_back(event);
+    m_end = AlignToPage(m_end + frame_size);
+    m_appended++;
+
+    return true;
+}
+
+void TimeSeriesWriter::Commit()
+{
+    if (!IsOpen())
+        return;
+
+    if (!m_pending.empty())
+        cl::WaitForEvents(m_pending);
+    m_pending.clear();
+
+    reinterpret_cast<TimeSeriesHeader*>(m_file.Data())->frame_count = m_appended;
+}
+
+size_t TimeSeriesWriter::FrameSize() const
+{
+    return static_cast<size_t>(m_width) * m_height * 4 * (m_half ? sizeof(uint16_t) : sizeof(float));
+}
+
+// ****************************************************************************************
+// TimeSeriesReader
+// ****************************************************************************************
+
+bool TimeSeriesReader::Open(const std::string& path)
+{
+    if (!m_file.Open(path, 0, false))
+        return false;
+
+    const TimeSeriesHeader expected;
+    if (m_file.Size() < sizeof(TimeSeriesHeader) || std::memcmp(Header().magic, expected.magic, sizeof(expected.magic)) != 0)
+    {
+        m_file.Close();
+        return false;
+    }
+
+    return true;
+}
+
+float TimeSeriesReader::HalfToFloat(uint16_t value)
+{
+    const uint32_t sign = (value & 0x8000u) << 16;
+    uint32_t exponent = (value >> 10) & 0x1f;
+    uint32_t mantissa = value & 0x3ff;
+
+    uint32_t bits;
+    if (exponent == 0x1f)
+        bits = sign | 0x7f800000u | (mantissa << 13);
+    else if (exponent == 0)
+    {
+        if (mantissa == 0)
+            bits = sign;
+        else
+        {
+            // Normalize the denormal
+            exponent = 127 - 15 + 1;
+            while ((mantissa & 0x400) == 0)
+            {
+                mantissa <<= 1;
+                exponent--;
+            }
+            bits = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+        }
+    }
+    else
+        bits = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+
+    float result;
+    std::memcpy(&result, &bits, sizeof(result));
+    return result;
+}
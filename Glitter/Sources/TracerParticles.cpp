@@ -0,0 +1,116 @@
+#include "TracerParticles.hpp"
+#include <algorithm>
+#include <cfloat>
+#include <vector>
+
+TracerParticles::TracerParticles()
+    :
+    m_capacity(0),
+    m_width(0),
+    m_height(0),
+    m_current(0)
+{
+    m_vbo[0] = m_vbo[1] = 0;
+    m_vao[0] = m_vao[1] = 0;
+}
+
+void TracerParticles::Init(const cl::Context& context, const cl::Program& program, int capacity, int width, int height)
+{
+    m_capacity = capacity;
+    m_width = width;
+    m_height = height;
+    if (m_capacity <= 0)
+        return;
+
+    m_advect_kernel = cl::Kernel(program, "AdvectTracers");
+    m_respawn_kernel = cl::Kernel(program, "RespawnTracers");
+    m_alive = cl::Buffer(context, CL_MEM_READ_WRITE, sizeof(cl_uint));
+
+    // Positions first, then ages. An infinite age kills every particle on the first step, which respawns them all.
+    std::vector<float> initial(static_cast<size_t>(m_capacity) * 3, 0.0f);
+    std::fill(initial.begin() + static_cast<size_t>(m_capacity) * 2, initial.end(), FLT_MAX);
+
+    glGenBuffers(2, m_vbo);
+    glGenVertexArrays(2, m_vao);
+    for (int i = 0; i < 2; i++)
+    {
+        glBindVertexArray(m_vao[i]);
+        glBindBuffer(GL_ARRAY_BUFFER, m_vbo[i]);
+        glBufferData(GL_ARRAY_BUFFER, initial.size() * sizeof(float), &initial[0], GL_DYNAMIC_DRAW);
+
+        // position attribute
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)0);
+        glEnableVertexAttribArray(0);
+        // age attribute
+        glVertexAttribPointer(1, 1, GL_FLOAT, GL_FALSE, sizeof(float), (void*)(static_cast<size_t>(m_capacity) * 2 * sizeof(float)));
+        glEnableVertexAttribArray(1);
+    }
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    // CL may only take the buffers over once GL is done with them
+    glFinish();
+    for (int i = 0; i < 2; i++)
+        m_buffers[i] = cl::BufferGL(context, CL_MEM_READ_WRITE, m_vbo[i]);
+}
+
+void TracerParticles::Step(cl::CommandQueue& queue, const cl::Image2D& velocity, float time_step, float rdx, float max_age, uint64_t step,
+    const cl::Buffer& mask, int mask_pitch)
+{
+    if (m_capacity <= 0)
+        return;
+
+    static const cl_uint zero = 0;
+    const cl::Buffer& src = m_buffers[m_current];
+    const cl::Buffer& dst = m_buffers[1 - m_current];
+
+    std::vector<cl::Memory> objects{ m_buffers[0], m_buffers[1] };
+    queue.enqueueAcquireGLObjects(&objects);
+    queue.enqueueWriteBuffer(m_alive, CL_FALSE, 0, sizeof(cl_uint), &zero);
+
+    m_advect_kernel.setArg(0, time_step);
+    m_advect_kernel.setArg(1, rdx);
+    m_advect_kernel.setArg(2, max_age);
+    m_advect_kernel.setArg(3, static_cast<cl_int>(m_capacity));
+    m_advect_kernel.setArg(4, velocity);
+    m_advect_kernel.setArg(5, src);
+    m_advect_kernel.setArg(6, dst);
+    m_advect_kernel.setArg(7, m_alive);
+    m_advect_kernel.setArg(8, mask);
+    m_advect_kernel.setArg(9, static_cast<cl_int>(mask_pitch));
+    queue.enqueueNDRangeKernel(m_advect_kernel, cl::NullRange, cl::NDRange(m_capacity));
+
+    m_respawn_kernel.setArg(0, static_cast<cl_uint>(step));
+    m_respawn_kernel.setArg(1, max_age);
+    m_respawn_kernel.setArg(2, static_cast<cl_int>(m_capacity));
+    m_respawn_kernel.setArg(3, static_cast<cl_int>(m_width));
+    m_respawn_kernel.setArg(4, static_cast<cl_int>(m_height));
+    m_respawn_kernel.setArg(5, m_alive);
+    m_respawn_kernel.setArg(6, dst);
+    queue.enqueueNDRangeKernel(m_respawn_kernel, cl::NullRange, cl::NDRange(m_capacity));
+
+    queue.enqueueReleaseGLObjects(&objects);
+    m_current = 1 - m_current;
+}
+
+void TracerParticles::Draw() const
+{
+    if (m_capacity <= 0)
+        return;
+
+    // The compaction keeps every slot alive, so the whole buffer is drawn
+    glBindVertexArray(m_vao[m_current]);
+    glDrawArrays(GL_POINTS, 0, m_capacity);
+    glBindVertexArray(0);
+}
+
+void TracerParticles::Cleanup()
+{
+    if (m_capacity <= 0)
+        return;
+
+    m_buffers[0] = cl::BufferGL();
+    m_buffers[1] = cl::BufferGL();
+    glDeleteVertexArrays(2, m_vao);
+    glDeleteBuffers(2, m_vbo);
+}
@@ -1,5 +1,3 @@
-__global uint sd = 0x13567528;
-
 const float PI = 3.14159265358979;
 
 uint WangHash(uint seed)
@@ -13,17 +11,6 @@ uint WangHash(uint seed)
 	return seed;
 }
 
-uint WangHash2()
-{
-	sd *= 17;
-	sd = (sd ^ 61) ^ (sd >> 16);
-	sd *= 9;
-	sd = sd ^ (sd >> 4);
-	sd *= 0x27d4eb2d;
-	sd = sd ^ (sd >> 15);
-	return sd;
-}
-
 // local seed
 uint RandomUInt(uint seed)
 {
@@ -33,14 +20,6 @@ uint RandomUInt(uint seed)
 	return seed;
 }
 
-uint RandomUInt2()
-{
-	sd ^= sd << 13;
-	sd ^= sd >> 17;
-	sd ^= sd << 5;
-	return sd;
-}
-
 uint WangHashAd(uint s) { s = (s ^ 61) ^ (s >> 16), s *= 9, s = s ^ (s >> 4), s *= 0x27d4eb2d, s = s ^ (s >> 15); return s; }
 uint RandomIntAd(uint s) { s ^= s << 13, s ^= s >> 17, s ^= s << 5; return s; }
 float RandomFloatAd(uint s) { return RandomIntAd(s) * 2.3283064365387e-10f; /* = 1 / (2^32-1) */ }
@@ -49,13 +28,40 @@ float RandomFloat(uint seed)
 {
 	//return RandomUInt(seed) * 2.3283064365387e-10f;
 	return RandomUInt(WangHash(seed + 1)) * 2.3283064365387e-10f;
-	//return RandomUInt(WangHash2() * seed) * 2.3283064365387e-10f;
-	//return RandomUInt2() * 2.3283064365387e-10f;
 }
 
-float AdvancedRandomFloat(uint seed)
+// Streams keep the generators of different uses independent
+#define RNG_STREAM_FORCE 0
+#define RNG_STREAM_TEXTURE 1
+#define RNG_STREAM_TRACERS 2
+#define RNG_STREAM_FLIP 3
+#define RNG_STREAM_ENSEMBLE 4
+#define RNG_KEY (uint2)(0x13567528u, 0x2545F491u)
+
+// Philox4x32-10 counter-based generator: the output only depends on the counter and key, so every
+// work-item draws its own numbers without shared state
+uint4 Philox4x32(uint4 ctr, uint2 key)
+{
+	for (int i = 0; i < 10; i++)
+	{
+		uint hi0 = mul_hi(0xD2511F53u, ctr.x);
+		uint lo0 = 0xD2511F53u * ctr.x;
+		uint hi1 = mul_hi(0xCD9E8D57u, ctr.z);
+		uint lo1 = 0xCD9E8D57u * ctr.z;
+
+		ctr = (uint4)(hi1 ^ ctr.y ^ key.x, lo1, hi0 ^ ctr.w ^ key.y, lo0);
+		key += (uint2)(0x9E3779B9u, 0xBB67AE85u);
+	}
+
+	return ctr;
+}
+
+// Four independent uniform floats in [0, 1), keyed by texel, step and stream
+float4 CounterRandomFloat4(int2 texel, uint step, uint stream)
 {
-	return RandomUInt(WangHash(RandomUInt(WangHash2()) + seed) + 1) * 2.3283064365387e-10f;
+	uint4 bits = Philox4x32((uint4)((uint)texel.x, (uint)texel.y, step, stream), RNG_KEY);
+
+	return convert_float4(bits >> 8) * (1.0f / 16777216.0f);
 }
 
 float4 lerp(float4 a, float4 b, float t)
@@ -85,6 +91,41 @@ kernel void tex_test(write_only image2d_t tgt_tex)
 __constant sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_CLAMP | CLK_FILTER_NEAREST;
 //__constant sampler_t sampler = CLK_FILTER_NEAREST;
 
+// Obstacles are a mask with one bit per cell, 32 cells of a row per word. A pitch of 0 means there are none,
+// and the lookups are skipped.
+int IsSolid(__global const uint* mask, int mask_pitch, int2 size, int2 c)
+{
+	if (mask_pitch == 0 || c.x < 0 || c.y < 0 || c.x >= size.x || c.y >= size.y)
+		return 0;
+
+	return (mask[c.y * mask_pitch + (c.x >> 5)] >> (c.x & 31)) & 1u;
+}
+
+// Replaces the neighbors inside obstacles by the center value, the Neumann condition on the obstacle faces
+void ObstacleNeighbors(__global const uint* mask, int mask_pitch, int2 size, int2 coords, float4 center,
+	float4* left, float4* right, float4* bottom, float4* top)
+{
+	if (IsSolid(mask, mask_pitch, size, coords - (int2)(1, 0)))
+		*left = center;
+	if (IsSolid(mask, mask_pitch, size, coords + (int2)(1, 0)))
+		*right = center;
+	if (IsSolid(mask, mask_pitch, size, coords + (int2)(0, 1)))
+		*bottom = center;
+	if (IsSolid(mask, mask_pitch, size, coords - (int2)(0, 1)))
+		*top = center;
+}
+
+#ifndef ACTIVE_TILE
+#define ACTIVE_TILE 16
+#endif
+
+// Sparse launches run one work-group per active tile, listed as packed tile coordinates
+int2 ActiveTileCoords(__global const uint* tiles)
+{
+	uint tile = tiles[get_group_id(0)];
+	return (int2)((tile & 0xffffu) * ACTIVE_TILE + get_local_id(0), (tile >> 16) * ACTIVE_TILE + get_local_id(1));
+}
+
 kernel void tex_read_test(read_only image2d_t tgt_tex, __global float* debug_buf)
 {
 	int x = get_global_id(0);
@@ -94,17 +135,66 @@ kernel void tex_read_test(read_only image2d_t tgt_tex, __global float* debug_buf
 	debug_buf[x + y * get_image_width(tgt_tex)] = pixel.x;
 }
 
-kernel void AdvectFluid(float timestep, float rdx,
+// Bilinear sample at a texel position, also returning the range of the four texels for limiting
+float4 BilinearRange(read_only image2d_t img, float2 pos, float4* lo, float4* hi)
+{
+	int2 size = get_image_dim(img);
+	pos = clamp(pos, (float2)(0.0f), convert_float2(size - (int2)(1)));
+
+	float2 st = floor(pos);
+	float2 t = pos - st;
+	int2 c = convert_int2(st);
+
+	float4 tex11 = read_imagef(img, sampler, c);
+	float4 tex21 = read_imagef(img, sampler, c + (int2)(1, 0));
+	float4 tex12 = read_imagef(img, sampler, c + (int2)(0, 1));
+	float4 tex22 = read_imagef(img, sampler, c + (int2)(1, 1));
+
+	*lo = fmin(fmin(tex11, tex21), fmin(tex12, tex22));
+	*hi = fmax(fmax(tex11, tex21), fmax(tex12, tex22));
+
+	return lerp(lerp(tex11, tex21, t.x), lerp(tex12, tex22, t.x), t.y);
+}
+
+// Departure point of a texel, integrating the velocity backwards with Euler, midpoint RK2 or Ralston's RK3.
+// A negative scale traces forwards in time.
+float2 Backtrace(read_only image2d_t u, int2 coords, float scale, int order)
+{
+	float4 lo, hi;
+	float2 pos = convert_float2(coords);
+
+	float2 k1 = read_imagef(u, sampler, coords).xy;
+	if (order <= 1)
+		return pos - scale * k1;
+
+	float2 k2 = BilinearRange(u, pos - 0.5f * scale * k1, &lo, &hi).xy;
+	if (order == 2)
+		return pos - scale * k2;
+
+	float2 k3 = BilinearRange(u, pos - 0.75f * scale * k2, &lo, &hi).xy;
+	return pos - scale * (2.0f * k1 + 3.0f * k2 + 4.0f * k3) / 9.0f;
+}
+
+void AdvectAt(int2 coords, float timestep, float rdx,
 	// 1 / grid scale,
 	float dissipation,
+	int order,					// backtrace integration order
 	read_only image2d_t u,		// input velocity
 	read_only image2d_t xOld,	// qty to advect
-	write_only image2d_t xNew	// advected qty
+	write_only image2d_t xNew,	// advected qty
+	__global const uint* mask,	// obstacles
+	int mask_pitch
 )
 {
-	int x = get_global_id(0);
-	int y = get_global_id(1);
-	int2 coords = (int2)(x, y);
+	int x = coords.x;
+	int y = coords.y;
+
+	// Obstacles hold nothing
+	if (IsSolid(mask, mask_pitch, get_image_dim(u), coords))
+	{
+		write_imagef(xNew, coords, (float4)(0.0f));
+		return;
+	}
 
 	//if (read_imagef(u, sampler, coords).x == 0.0f && read_imagef(u, sampler, coords).y == 0.0f)
 	//{
@@ -113,9 +203,9 @@ kernel void AdvectFluid(float timestep, float rdx,
 	//}
 
 	// follow the velocity field "back in time"
-	float2 pos = (float2)(coords.x, coords.y) - timestep * rdx * read_imagef(u, sampler, coords).xy;
+	float2 pos = Backtrace(u, coords, timestep * rdx, order);
 
-	pos = (float2)(clamp(pos.x, 0.0f, (float)get_image_width(u) - 1.0f), clamp(pos.y, 0.0f, (float)get_image_width(u) - 1.0f));
+	pos = (float2)(clamp(pos.x, 0.0f, (float)get_image_width(u) - 1.0f), clamp(pos.y, 0.0f, (float)get_image_height(u) - 1.0f));
 
 	// find 4 closest texel positions
 	float4 st;
@@ -149,23 +239,105 @@ kernel void AdvectFluid(float timestep, float rdx,
 	write_imagef(xNew, coords, dissipation * interpolated);
 }
 
-kernel void CopyTexture(read_only image2d_t a, write_only image2d_t b)
+kernel void AdvectFluid(float timestep, float rdx, float dissipation, int order, read_only image2d_t u, read_only image2d_t xOld, write_only image2d_t xNew,
+	__global const uint* mask, int mask_pitch)
+{
+	AdvectAt((int2)(get_global_id(0), get_global_id(1)), timestep, rdx, dissipation, order, u, xOld, xNew, mask, mask_pitch);
+}
+
+// AdvectFluid over the active tiles only
+kernel void AdvectFluidTiles(float timestep, float rdx, float dissipation, int order, read_only image2d_t u, read_only image2d_t xOld, write_only image2d_t xNew,
+	__global const uint* mask, int mask_pitch, __global const uint* tiles)
+{
+	int2 coords = ActiveTileCoords(tiles);
+	if (coords.x < get_image_width(u) && coords.y < get_image_height(u))
+		AdvectAt(coords, timestep, rdx, dissipation, order, u, xOld, xNew, mask, mask_pitch);
+}
+
+// Advects up to four fields along one backtrace per texel, so the velocity reads and the index math are shared
+// by all of them. Field 0 may be the velocity itself; the slots from count on are not accessed.
+kernel void AdvectFields(float timestep, float rdx, float dissipation, int order, int count, read_only image2d_t u,
+	read_only image2d_t x0Old, write_only image2d_t x0New,
+	read_only image2d_t x1Old, write_only image2d_t x1New,
+	read_only image2d_t x2Old, write_only image2d_t x2New,
+	read_only image2d_t x3Old, write_only image2d_t x3New,
+	__global const uint* mask, int mask_pitch)
+{
+	int2 coords = (int2)(get_global_id(0), get_global_id(1));
+
+	// Obstacles hold nothing
+	if (IsSolid(mask, mask_pitch, get_image_dim(u), coords))
+	{
+		write_imagef(x0New, coords, (float4)(0.0f));
+		if (count > 1)
+			write_imagef(x1New, coords, (float4)(0.0f));
+		if (count > 2)
+			write_imagef(x2New, coords, (float4)(0.0f));
+		if (count > 3)
+			write_imagef(x3New, coords, (float4)(0.0f));
+		return;
+	}
+
+	float4 lo, hi;
+	float2 pos = Backtrace(u, coords, timestep * rdx, order);
+
+	write_imagef(x0New, coords, dissipation * BilinearRange(x0Old, pos, &lo, &hi));
+	if (count > 1)
+		write_imagef(x1New, coords, dissipation * BilinearRange(x1Old, pos, &lo, &hi));
+	if (count > 2)
+		write_imagef(x2New, coords, dissipation * BilinearRange(x2Old, pos, &lo, &hi));
+	if (count > 3)
+		write_imagef(x3New, coords, dissipation * BilinearRange(x3Old, pos, &lo, &hi));
+}
+
+// Second pass of MacCormack advection, after AdvectFluid wrote the forward result to xHat: advects xHat
+// backwards, corrects the forward result by half the round trip error and limits it to the range of the
+// texels the forward pass interpolated
+kernel void AdvectMacCormack(float timestep, float rdx, float dissipation,
+	int order,					// backtrace integration order
+	read_only image2d_t u,		// input velocity
+	read_only image2d_t xOld,	// qty to advect
+	read_only image2d_t xHat,	// forward advected qty
+	write_only image2d_t xNew,	// advected qty
+	__global const uint* mask,	// obstacles
+	int mask_pitch
+)
 {
 	int x = get_global_id(0);
 	int y = get_global_id(1);
 	int2 coords = (int2)(x, y);
 
-	float4 pixel = read_imagef(a, sampler, coords);
+	if (IsSolid(mask, mask_pitch, get_image_dim(u), coords))
+	{
+		write_imagef(xNew, coords, (float4)(0.0f));
+		return;
+	}
 
-	write_imagef(b, coords, pixel);
+	float4 lo, hi, unused_lo, unused_hi;
+	BilinearRange(xOld, Backtrace(u, coords, timestep * rdx, order), &lo, &hi);
+	float4 x_bar = BilinearRange(xHat, Backtrace(u, coords, -timestep * rdx, order), &unused_lo, &unused_hi);
+
+	float4 x_hat = read_imagef(xHat, sampler, coords);
+	float4 x_old = read_imagef(xOld, sampler, coords);
+
+	float4 corrected = clamp(x_hat + 0.5f * (x_old - x_bar), lo, hi);
+
+	write_imagef(xNew, coords, dissipation * corrected);
 }
 
-kernel void Divergence(float half_rdx, read_only image2d_t vector_field, write_only image2d_t out)
+kernel void CopyTexture(read_only image2d_t a, write_only image2d_t b)
 {
 	int x = get_global_id(0);
 	int y = get_global_id(1);
 	int2 coords = (int2)(x, y);
 
+	float4 pixel = read_imagef(a, sampler, coords);
+
+	write_imagef(b, coords, pixel);
+}
+
+float4 DivergenceAt(float half_rdx, read_only image2d_t vector_field, int2 coords, __global const uint* mask, int mask_pitch)
+{
 	// Neighbors stuff
 	float4 left = read_imagef(vector_field, sampler, coords - (int2)(1, 0));
 	float4 right = read_imagef(vector_field, sampler, coords + (int2)(1, 0));
@@ -174,18 +346,35 @@ kernel void Divergence(float half_rdx, read_only image2d_t vector_field, write_o
 	float4 bottom = read_imagef(vector_field, sampler, coords + (int2)(0, 1));
 	float4 top = read_imagef(vector_field, sampler, coords - (int2)(0, 1));
 
+	// Obstacles don't move
+	if (mask_pitch != 0)
+		ObstacleNeighbors(mask, mask_pitch, get_image_dim(vector_field), coords, (float4)(0.0f), &left, &right, &bottom, &top);
+
 	float4 div = (float4)(half_rdx * (right.x - left.x + top.y - bottom.y));
 	//float4 div = (float4)((right.x - left.x + top.y - bottom.y));
 
-	write_imagef(out, coords, div);
+	return div;
 }
 
-kernel void Jacobi(float alpha, float rBeta, read_only image2d_t x_vector, read_only image2d_t b_vector, write_only image2d_t x_new)
+kernel void Divergence(float half_rdx, read_only image2d_t vector_field, write_only image2d_t out, __global const uint* mask, int mask_pitch)
 {
 	int x = get_global_id(0);
 	int y = get_global_id(1);
 	int2 coords = (int2)(x, y);
 
+	write_imagef(out, coords, DivergenceAt(half_rdx, vector_field, coords, mask, mask_pitch));
+}
+
+void JacobiAt(int2 coords, float alpha, float rBeta, read_only image2d_t x_vector, read_only image2d_t b_vector, write_only image2d_t x_new, __global const uint* mask, int mask_pitch)
+{
+	int2 size = get_image_dim(x_vector);
+
+	if (IsSolid(mask, mask_pitch, size, coords))
+	{
+		write_imagef(x_new, coords, (float4)(0.0f));
+		return;
+	}
+
 	// Neighbors stuff
 	float4 left = read_imagef(x_vector, sampler, coords - (int2)(1, 0));
 	float4 right = read_imagef(x_vector, sampler, coords + (int2)(1, 0));
@@ -194,17 +383,66 @@ kernel void Jacobi(float alpha, float rBeta, read_only image2d_t x_vector, read_
 	float4 bottom = read_imagef(x_vector, sampler, coords + (int2)(0, 1));
 	float4 top = read_imagef(x_vector, sampler, coords - (int2)(0, 1));
 
+	if (mask_pitch != 0)
+		ObstacleNeighbors(mask, mask_pitch, size, coords, read_imagef(x_vector, sampler, coords), &left, &right, &bottom, &top);
+
 	float4 bC = read_imagef(b_vector, sampler, coords);
 
 	float4 pixel = (float4)((left + right + bottom + top + (alpha * bC)) * rBeta);
 	write_imagef(x_new, coords, pixel);
 }
 
-kernel void Gradient(float half_rdx, read_only image2d_t pressure, read_only image2d_t w, write_only image2d_t u_new)
+kernel void Jacobi(float alpha, float rBeta, read_only image2d_t x_vector, read_only image2d_t b_vector, write_only image2d_t x_new, __global const uint* mask, int mask_pitch)
+{
+	JacobiAt((int2)(get_global_id(0), get_global_id(1)), alpha, rBeta, x_vector, b_vector, x_new, mask, mask_pitch);
+}
+
+// Jacobi over the active tiles only
+kernel void JacobiTiles(float alpha, float rBeta, read_only image2d_t x_vector, read_only image2d_t b_vector, write_only image2d_t x_new, __global const uint* mask, int mask_pitch,
+	__global const uint* tiles)
+{
+	int2 coords = ActiveTileCoords(tiles);
+	if (coords.x < get_image_width(x_vector) && coords.y < get_image_height(x_vector))
+		JacobiAt(coords, alpha, rBeta, x_vector, b_vector, x_new, mask, mask_pitch);
+}
+
+// First pressure sweep, computing the divergence on the fly and keeping it for the following sweeps
+kernel void JacobiDivergence(float half_rdx, float alpha, float rBeta, read_only image2d_t x_vector, read_only image2d_t u, write_only image2d_t x_new, write_only image2d_t div_out,
+	__global const uint* mask, int mask_pitch)
 {
 	int x = get_global_id(0);
 	int y = get_global_id(1);
 	int2 coords = (int2)(x, y);
+	int2 size = get_image_dim(x_vector);
+
+	if (IsSolid(mask, mask_pitch, size, coords))
+	{
+		write_imagef(div_out, coords, (float4)(0.0f));
+		write_imagef(x_new, coords, (float4)(0.0f));
+		return;
+	}
+
+	float4 bC = DivergenceAt(half_rdx, u, coords, mask, mask_pitch);
+	write_imagef(div_out, coords, bC);
+
+	// Neighbors stuff
+	float4 left = read_imagef(x_vector, sampler, coords - (int2)(1, 0));
+	float4 right = read_imagef(x_vector, sampler, coords + (int2)(1, 0));
+	float4 bottom = read_imagef(x_vector, sampler, coords + (int2)(0, 1));
+	float4 top = read_imagef(x_vector, sampler, coords - (int2)(0, 1));
+
+	if (mask_pitch != 0)
+		ObstacleNeighbors(mask, mask_pitch, size, coords, read_imagef(x_vector, sampler, coords), &left, &right, &bottom, &top);
+
+	float4 pixel = (float4)((left + right + bottom + top + (alpha * bC)) * rBeta);
+	write_imagef(x_new, coords, pixel);
+}
+
+float4 SubtractGradient(float half_rdx, read_only image2d_t pressure, read_only image2d_t w, int2 coords, __global const uint* mask, int mask_pitch)
+{
+	int2 size = get_image_dim(w);
+	if (IsSolid(mask, mask_pitch, size, coords))
+		return (float4)(0.0f);
 
 	// Neighbors stuff
 	//h1texRECTneighbors(p, coords, pL, pR, pB, pT);
@@ -215,51 +453,300 @@ kernel void Gradient(float half_rdx, read_only image2d_t pressure, read_only ima
 	float4 pressure_bottom = read_imagef(pressure, sampler, coords + (int2)(0, 1));
 	float4 pressure_top = read_imagef(pressure, sampler, coords - (int2)(0, 1));
 
+	if (mask_pitch != 0)
+		ObstacleNeighbors(mask, mask_pitch, size, coords, read_imagef(pressure, sampler, coords), &pressure_left, &pressure_right, &pressure_bottom, &pressure_top);
+
 	// TODO: Give meaning to "x" value
 	float2 grad = (float2)(pressure_right.x - pressure_left.x, pressure_top.x - pressure_bottom.x) * half_rdx;
 
 	float4 u_new_val = read_imagef(w, sampler, coords);
 	u_new_val.xy -= grad;
+
+	// No flow into obstacles
+	if (mask_pitch != 0)
+	{
+		if (IsSolid(mask, mask_pitch, size, coords - (int2)(1, 0)) || IsSolid(mask, mask_pitch, size, coords + (int2)(1, 0)))
+			u_new_val.x = 0.0f;
+		if (IsSolid(mask, mask_pitch, size, coords + (int2)(0, 1)) || IsSolid(mask, mask_pitch, size, coords - (int2)(0, 1)))
+			u_new_val.y = 0.0f;
+	}
+
+	return u_new_val;
+}
+
+kernel void Gradient(float half_rdx, read_only image2d_t pressure, read_only image2d_t w, write_only image2d_t u_new, __global const uint* mask, int mask_pitch)
+{
+	int x = get_global_id(0);
+	int y = get_global_id(1);
+	int2 coords = (int2)(x, y);
+
+	write_imagef(u_new, coords, SubtractGradient(half_rdx, pressure, w, coords, mask, mask_pitch));
+}
+
+// Gradient subtraction with the Neumann boundary: edge texels take the scaled projected value of their inner neighbor
+kernel void GradientBoundary(float half_rdx, float scale, read_only image2d_t pressure, read_only image2d_t w, write_only image2d_t u_new, __global const uint* mask, int mask_pitch)
+{
+	int x = get_global_id(0);
+	int y = get_global_id(1);
+	int2 coords = (int2)(x, y);
+	int2 size = get_image_dim(w);
+
+	int2 offset = (int2)(0);
+	if (x == 0)
+		offset = (int2)(1, 0);
+	else if (x == size.x - 1)
+		offset = (int2)(-1, 0);
+	else if (y == size.y - 1)
+		offset = (int2)(0, -1);
+	else if (y == 0)
+		offset = (int2)(0, 1);
+
+	float4 u_new_val = SubtractGradient(half_rdx, pressure, w, coords + offset, mask, mask_pitch);
+	if (offset.x != 0 || offset.y != 0)
+		u_new_val *= scale;
+
 	write_imagef(u_new, coords, u_new_val);
 }
 
-kernel void Vorticity(float half_rdx, read_only image2d_t u, write_only image2d_t vort)
+// ****************************************************************************************
+// Staggered (MAC) grid
+// u faces: (width + 1) x height, u(i, j) sits on the face between cells (i - 1, j) and (i, j)
+// v faces: width x (height + 1), v(i, j) sits on the face between cells (i, j - 1) and (i, j)
+// Positive components point towards larger coordinates, like the advection backtrace.
+// ****************************************************************************************
+
+// Bilinear sample of a single channel face image in its own texel coordinates
+float SampleFace(read_only image2d_t f, float2 pos)
+{
+	int2 size = get_image_dim(f);
+	pos = clamp(pos, (float2)(0.0f), convert_float2(size - (int2)(1)));
+
+	float2 st = floor(pos);
+	float2 t = pos - st;
+	int2 c = convert_int2(st);
+
+	float f11 = read_imagef(f, sampler, c).x;
+	float f21 = read_imagef(f, sampler, c + (int2)(1, 0)).x;
+	float f12 = read_imagef(f, sampler, c + (int2)(0, 1)).x;
+	float f22 = read_imagef(f, sampler, c + (int2)(1, 1)).x;
+
+	return mix(mix(f11, f21, t.x), mix(f12, f22, t.x), t.y);
+}
+
+// Velocity at a position in cell coordinates, interpolated from the faces
+float2 FaceVelocity(read_only image2d_t u, read_only image2d_t v, float2 pos)
+{
+	return (float2)(SampleFace(u, pos + (float2)(0.5f, 0.0f)), SampleFace(v, pos + (float2)(0.0f, 0.5f)));
+}
+
+// Same integration as Backtrace, with the velocity taken from the faces
+float2 FaceBacktrace(read_only image2d_t u, read_only image2d_t v, float2 pos, float scale, int order)
+{
+	float2 k1 = FaceVelocity(u, v, pos);
+	if (order <= 1)
+		return pos - scale * k1;
+
+	float2 k2 = FaceVelocity(u, v, pos - 0.5f * scale * k1);
+	if (order == 2)
+		return pos - scale * k2;
+
+	float2 k3 = FaceVelocity(u, v, pos - 0.75f * scale * k2);
+	return pos - scale * (2.0f * k1 + 3.0f * k2 + 4.0f * k3) / 9.0f;
+}
+
+// Faces on the domain walls or next to an obstacle carry no flow through them
+int IsClosedFace(int axis, int2 coords, int2 size, __global const uint* mask, int mask_pitch)
+{
+	if ((axis == 0) ? (coords.x == 0 || coords.x == size.x - 1) : (coords.y == 0 || coords.y == size.y - 1))
+		return 1;
+
+	int2 normal = (axis == 0) ? (int2)(1, 0) : (int2)(0, 1);
+	int2 cells = size - normal;
+	return IsSolid(mask, mask_pitch, cells, coords) || IsSolid(mask, mask_pitch, cells, coords - normal);
+}
+
+// Advects one velocity component on its faces, axis 0 for u and 1 for v
+kernel void AdvectFace(float timestep, float rdx, int order, int axis,
+	read_only image2d_t u,		// u faces
+	read_only image2d_t v,		// v faces
+	read_only image2d_t fOld,	// faces of the advected component
+	write_only image2d_t fNew,
+	__global const uint* mask,	// obstacles
+	int mask_pitch
+)
 {
 	int x = get_global_id(0);
 	int y = get_global_id(1);
 	int2 coords = (int2)(x, y);
 
-	// Neighbors stuff
+	if (IsClosedFace(axis, coords, get_image_dim(fOld), mask, mask_pitch))
+	{
+		write_imagef(fNew, coords, (float4)(0.0f, 0.0f, 0.0f, 1.0f));
+		return;
+	}
+
+	// Position of face (0, 0) in cell coordinates
+	float2 face_offset = (axis == 0) ? (float2)(-0.5f, 0.0f) : (float2)(0.0f, -0.5f);
+
+	float2 pos = FaceBacktrace(u, v, convert_float2(coords) + face_offset, timestep * rdx, order);
+
+	write_imagef(fNew, coords, (float4)(SampleFace(fOld, pos - face_offset), 0.0f, 0.0f, 1.0f));
+}
+
+// Compact divergence of the faces around each cell
+kernel void DivergenceStaggered(float rdx, read_only image2d_t u, read_only image2d_t v, write_only image2d_t out)
+{
+	int x = get_global_id(0);
+	int y = get_global_id(1);
+	int2 coords = (int2)(x, y);
+
+	float du = read_imagef(u, sampler, coords + (int2)(1, 0)).x - read_imagef(u, sampler, coords).x;
+	float dv = read_imagef(v, sampler, coords + (int2)(0, 1)).x - read_imagef(v, sampler, coords).x;
+
+	write_imagef(out, coords, (float4)(rdx * (du + dv)));
+}
+
+// Pressure sweep for the staggered grid: neighbors outside the grid take the center value, which is the
+// Neumann condition on the walls
+kernel void JacobiStaggered(float alpha, float rBeta, read_only image2d_t x_vector, read_only image2d_t b_vector, write_only image2d_t x_new, __global const uint* mask, int mask_pitch)
+{
+	int x = get_global_id(0);
+	int y = get_global_id(1);
+	int2 coords = (int2)(x, y);
+	int2 size = get_image_dim(x_vector);
+
+	if (IsSolid(mask, mask_pitch, size, coords))
+	{
+		write_imagef(x_new, coords, (float4)(0.0f));
+		return;
+	}
+
+	float4 center = read_imagef(x_vector, sampler, coords);
+	float4 left = (x > 0) ? read_imagef(x_vector, sampler, coords - (int2)(1, 0)) : center;
+	float4 right = (x < size.x - 1) ? read_imagef(x_vector, sampler, coords + (int2)(1, 0)) : center;
+	float4 bottom = (y < size.y - 1) ? read_imagef(x_vector, sampler, coords + (int2)(0, 1)) : center;
+	float4 top = (y > 0) ? read_imagef(x_vector, sampler, coords - (int2)(0, 1)) : center;
+
+	if (mask_pitch != 0)
+		ObstacleNeighbors(mask, mask_pitch, size, coords, center, &left, &right, &bottom, &top);
+
+	float4 bC = read_imagef(b_vector, sampler, coords);
+
+	write_imagef(x_new, coords, (left + right + bottom + top + (alpha * bC)) * rBeta);
+}
+
+// Subtracts the pressure difference across each face, the wall faces are kept at zero
+kernel void GradientFace(float rdx, int axis, read_only image2d_t pressure, read_only image2d_t fOld, write_only image2d_t fNew, __global const uint* mask, int mask_pitch)
+{
+	int x = get_global_id(0);
+	int y = get_global_id(1);
+	int2 coords = (int2)(x, y);
+
+	if (IsClosedFace(axis, coords, get_image_dim(fOld), mask, mask_pitch))
+	{
+		write_imagef(fNew, coords, (float4)(0.0f, 0.0f, 0.0f, 1.0f));
+		return;
+	}
+
+	int2 behind = coords - ((axis == 0) ? (int2)(1, 0) : (int2)(0, 1));
+	float gradient = rdx * (read_imagef(pressure, sampler, coords).x - read_imagef(pressure, sampler, behind).x);
+
+	write_imagef(fNew, coords, (float4)(read_imagef(fOld, sampler, coords).x - gradient, 0.0f, 0.0f, 1.0f));
+}
+
+// Adds the change of the collocated velocity since the last FacesToCenters to the faces, so forces, clicks and
+// vorticity confinement applied to the collocated field reach the staggered one without resampling its state
+kernel void CentersToFaces(int axis, read_only image2d_t centers, read_only image2d_t centers_prev, read_only image2d_t fOld, write_only image2d_t fNew,
+	__global const uint* mask, int mask_pitch)
+{
+	int x = get_global_id(0);
+	int y = get_global_id(1);
+	int2 coords = (int2)(x, y);
+
+	if (IsClosedFace(axis, coords, get_image_dim(fOld), mask, mask_pitch))
+	{
+		write_imagef(fNew, coords, (float4)(0.0f, 0.0f, 0.0f, 1.0f));
+		return;
+	}
+
+	int2 behind = coords - ((axis == 0) ? (int2)(1, 0) : (int2)(0, 1));
+	float4 delta = 0.5f * (read_imagef(centers, sampler, coords) - read_imagef(centers_prev, sampler, coords) +
+		read_imagef(centers, sampler, behind) - read_imagef(centers_prev, sampler, behind));
+
+	float f = read_imagef(fOld, sampler, coords).x + ((axis == 0) ? delta.x : delta.y);
+
+	write_imagef(fNew, coords, (float4)(f, 0.0f, 0.0f, 1.0f));
+}
+
+// Collocated velocity from the faces, keeping the other channels of the collocated field
+kernel void FacesToCenters(read_only image2d_t u, read_only image2d_t v, read_only image2d_t src, write_only image2d_t tgt)
+{
+	int x = get_global_id(0);
+	int y = get_global_id(1);
+	int2 coords = (int2)(x, y);
+
+	float4 val = read_imagef(src, sampler, coords);
+	val.x = 0.5f * (read_imagef(u, sampler, coords).x + read_imagef(u, sampler, coords + (int2)(1, 0)).x);
+	val.y = 0.5f * (read_imagef(v, sampler, coords).x + read_imagef(v, sampler, coords + (int2)(0, 1)).x);
+
+	write_imagef(tgt, coords, val);
+}
+
+#ifndef VORTICITY_TILE
+#define VORTICITY_TILE 16
+#endif
+
+float Curl(float half_rdx, read_only image2d_t u, int2 coords)
+{
 	float4 uL = read_imagef(u, sampler, coords - (int2)(1, 0));
 	float4 uR = read_imagef(u, sampler, coords + (int2)(1, 0));
-	/*float4 uB = read_imagef(u, sampler, coords - (int2)(0, 1));
-	float4 uT = read_imagef(u, sampler, coords + (int2)(0, 1));*/
 	float4 uB = read_imagef(u, sampler, coords + (int2)(0, 1));
 	float4 uT = read_imagef(u, sampler, coords - (int2)(0, 1));
 
-	float4 vort_val = (float4)(half_rdx * ((uR.y - uL.y) - (uT.x - uB.x)));
-	write_imagef(vort, coords, vort_val);
+	return half_rdx * ((uR.y - uL.y) - (uT.x - uB.x));
 }
 
-kernel void VorticityConfinement(float half_rdx, float timestep, float dxscale_x, float dxscale_y, read_only image2d_t vort, read_only image2d_t u, write_only image2d_t uNew)
+// Vorticity and vorticity confinement in one pass: the curl of the tile and its one texel halo is kept in local memory
+__attribute__((reqd_work_group_size(VORTICITY_TILE, VORTICITY_TILE, 1)))
+kernel void VorticityConfinement(float half_rdx, float timestep, float dxscale_x, float dxscale_y, read_only image2d_t u, write_only image2d_t uNew)
 {
+	__local float curl[VORTICITY_TILE + 2][VORTICITY_TILE + 2];
+
 	int x = get_global_id(0);
 	int y = get_global_id(1);
 	int2 coords = (int2)(x, y);
+	int2 size = get_image_dim(u);
+
+	int2 local_coords = (int2)(get_local_id(0), get_local_id(1));
+	int2 tile_origin = (int2)(get_group_id(0), get_group_id(1)) * VORTICITY_TILE - (int2)(1, 1);
+
+	// Outside the image the curl is zero, like reading a vorticity image with the clamp sampler
+	for (int i = local_coords.x + local_coords.y * VORTICITY_TILE; i < (VORTICITY_TILE + 2) * (VORTICITY_TILE + 2); i += VORTICITY_TILE * VORTICITY_TILE)
+	{
+		int2 tile_coords = (int2)(i % (VORTICITY_TILE + 2), i / (VORTICITY_TILE + 2));
+		int2 c = tile_origin + tile_coords;
+
+		int inside = c.x >= 0 && c.y >= 0 && c.x < size.x && c.y < size.y;
+		curl[tile_coords.y][tile_coords.x] = inside ? Curl(half_rdx, u, c) : 0.0f;
+	}
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	// The global range is rounded up to whole tiles
+	if (x >= size.x || y >= size.y)
+		return;
 
 	float4 dxscale = (float4)(dxscale_x, dxscale_y, dxscale_x, dxscale_y);
 
 	// Neighbors stuff
-	float4 vL = read_imagef(vort, sampler, coords - (int2)(1, 0));
-	float4 vR = read_imagef(vort, sampler, coords + (int2)(1, 0));
-	/*float4 vB = read_imagef(vort, sampler, coords - (int2)(0, 1));
-	float4 vT = read_imagef(vort, sampler, coords + (int2)(0, 1));*/
-	float4 vB = read_imagef(vort, sampler, coords + (int2)(0, 1));
-	float4 vT = read_imagef(vort, sampler, coords - (int2)(0, 1));
-
-	float4 vC = read_imagef(vort, sampler, coords);
+	int2 t = local_coords + (int2)(1, 1);
+	float vL = curl[t.y][t.x - 1];
+	float vR = curl[t.y][t.x + 1];
+	float vB = curl[t.y + 1][t.x];
+	float vT = curl[t.y - 1][t.x];
+	float vC = curl[t.y][t.x];
 
-	float4 force = half_rdx * (float4)(fabs(vT.x) - fabs(vB.x), fabs(vR.x) - fabs(vL.x), fabs(vT.x) - fabs(vB.x), fabs(vR.x) - fabs(vL.x));
+	float4 force = half_rdx * (float4)(fabs(vT) - fabs(vB), fabs(vR) - fabs(vL), fabs(vT) - fabs(vB), fabs(vR) - fabs(vL));
 
 	// safe normalize
 	float EPSILON = 2.4414e-4; // 2^-12
@@ -272,9 +759,6 @@ kernel void VorticityConfinement(float half_rdx, float timestep, float dxscale_x
 
 	uNew_val += timestep * force;
 
-	uint seed = x + y * get_image_width(vort);
-	//uNew_val = -normalize(uNew_val) * (float4)(AdvancedRandomFloat(seed));
-
 	write_imagef(uNew, coords, uNew_val);
 }
 
@@ -364,29 +848,28 @@ kernel void Mix(float bias, read_only image2d_t t1, read_only image2d_t t2, writ
 	write_imagef(t3, coords, bias * t1_val - (1.0f - bias) * t2_val);
 }
 
-kernel void RandomizeTexture(write_only image2d_t tgt)
+kernel void RandomizeTexture(uint step, write_only image2d_t tgt)
 {
 	int x = get_global_id(0);
 	int y = get_global_id(1);
 	int2 coords = (int2)(x, y);
 
-	uint seed = x + y * get_image_width(tgt);
-	float4 tgt_val = (float4)(AdvancedRandomFloat(seed), AdvancedRandomFloat(seed), AdvancedRandomFloat(seed), 1.0f);
+	float4 tgt_val = CounterRandomFloat4(coords, step, RNG_STREAM_TEXTURE);
+	tgt_val.w = 1.0f;
 
 	write_imagef(tgt, coords, tgt_val);
 }
 
-kernel void RandomizeNegativeTexture(write_only image2d_t tgt)
+kernel void RandomizeNegativeTexture(uint step, write_only image2d_t tgt)
 {
 	int x = get_global_id(0);
 	int y = get_global_id(1);
 	int2 coords = (int2)(x, y);
 
-	uint seed = x + y * get_image_width(tgt);
-
-	float4 tgt_val = (float4)(AdvancedRandomFloat(seed), AdvancedRandomFloat(seed), AdvancedRandomFloat(seed), 1.0f);
+	float4 random_val = CounterRandomFloat4(coords, step, RNG_STREAM_TEXTURE);
+	float4 tgt_val = (float4)(random_val.xyz, 1.0f);
 
-	if (AdvancedRandomFloat(seed) < 0.5f)
+	if (random_val.w < 0.5f)
 		tgt_val = -tgt_val;
 
 	tgt_val.z = 1.0f;
@@ -406,24 +889,22 @@ kernel void CheckNegativeValues(read_only image2d_t src, write_only image2d_t tg
 	write_imagef(tgt, coords, tgt_val);
 }
 
-kernel void RandomForce(float scale, int dir_flag, read_only image2d_t src, write_only image2d_t tgt)
+kernel void RandomForce(float scale, int dir_flag, uint step, read_only image2d_t src, write_only image2d_t tgt)
 {
 	int x = get_global_id(0);
 	int y = get_global_id(1);
 	int2 coords = (int2)(x, y);
 
-	uint seed = x + y * get_image_width(tgt);
-
-	/*if (AdvancedRandomFloat(seed) < 0.2f)
-		return;*/
+	// One draw gives the three force channels and the direction choice
+	float4 random_val = CounterRandomFloat4(coords, step, RNG_STREAM_FORCE);
 
 	float4 src_val = read_imagef(src, sampler, coords);
-	float4 tgt_val = src_val + scale * (float4)(AdvancedRandomFloat(seed), AdvancedRandomFloat(seed), AdvancedRandomFloat(seed), 1.0f);
+	float4 tgt_val = src_val + scale * (float4)(random_val.xyz, 1.0f);
 
 	// Randomize Direction
 	if (dir_flag == 1)
 	{
-		float dir_val = AdvancedRandomFloat(seed);
+		float dir_val = random_val.w;
 
 		if (dir_val < 0.2f)
 			tgt_val.x = -tgt_val.x;
@@ -463,223 +944,724 @@ kernel void ClickEffectTest(int xpos, int ypos, write_only image2d_t tgt)
 	write_imagef(tgt, clamp(coords + (int2)(-1, 1), 0, get_image_width(tgt) - 1), (float4)(1.0f, 0.0f, 0.0f, 1.0f));
 }
 
-kernel void ClickAddPressure(int xpos, int ypos, float scale, int extreme_flag, read_only image2d_t src, write_only image2d_t tgt)
+// Splat along a segment, laid out like the Splat struct on the host
+typedef struct
 {
-	int2 coords = (int2)(clamp(xpos, 0, get_image_width(tgt) - 1), clamp(get_image_width(tgt) - 1 - ypos, 0, get_image_width(tgt) - 1));
+	float4 segment;
+	float4 value;
+	float radius;
+	int blend;
+	int padding[2];
+} Splat;
+
+// Applies a batch of Gaussian splats interpolated along their segments, launched over their common bounding box
+kernel void SplatBatch(int count, __global const Splat* splats, read_only image2d_t src, write_only image2d_t tgt)
+{
+	int2 coords = (int2)(get_global_id(0), get_global_id(1));
+	float2 p = convert_float2(coords);
+
+	float4 tgt_val = read_imagef(src, sampler, coords);
+
+	for (int i = 0; i < count; i++)
+	{
+		float2 a = splats[i].segment.xy;
+		float2 ab = splats[i].segment.zw - a;
+		float radius = splats[i].radius;
+
+		// Closest point on the segment
+		float len2 = dot(ab, ab);
+		float t = (len2 > 0.0f) ? clamp(dot(p - a, ab) / len2, 0.0f, 1.0f) : 0.0f;
+		float2 d = p - (a + t * ab);
+		float d2 = dot(d, d);
 
-	uint seed = coords.x + coords.y * get_image_width(tgt);
+		if (d2 > radius * radius)
+			continue;
+
+		float sigma = radius / 3.0f;
+		float w = exp(-d2 / (2.0f * sigma * sigma));
+
+		// Blending replaces the color, otherwise the value is added
+		tgt_val = (splats[i].blend == 1) ? mix(tgt_val, splats[i].value, w) : tgt_val + w * splats[i].value;
+	}
+
+	write_imagef(tgt, coords, tgt_val);
+}
+
+kernel void ApplyGravity(float time_step, read_only image2d_t src, write_only image2d_t tgt)
+{
+	int x = get_global_id(0);
+	int y = get_global_id(1);
+	int2 coords = (int2)(x, y);
 
 	float4 src_val = read_imagef(src, sampler, coords);
-	float random_val = AdvancedRandomFloat(seed);
-	float4 tgt_val = src_val + scale * (float4)(AdvancedRandomFloat(seed), AdvancedRandomFloat(seed), AdvancedRandomFloat(seed), 1.0f);
 
-	if (extreme_flag == 1)
+	write_imagef(tgt, coords, src_val - (float4)(0.0f, 9.764f, 0.0f, 1.0f) * time_step);
+}
+
+// Boussinesq smoke: dye, temperature and density share one backtrace, a plume source heats and fills a disc, and
+// the advected smoke lifts the velocity by lift * temperature - weight * density
+kernel void AdvectSmoke(float timestep, float rdx, int order, float lift, float weight, float cooling,
+	float4 source,				// plume center, radius and unused
+	read_only image2d_t u, read_only image2d_t dyeOld, write_only image2d_t dyeNew,
+	read_only image2d_t tOld, write_only image2d_t tNew,
+	read_only image2d_t dOld, write_only image2d_t dNew,
+	write_only image2d_t uNew,
+	__global const uint* mask, int mask_pitch)
+{
+	int2 coords = (int2)(get_global_id(0), get_global_id(1));
+	float4 vel = read_imagef(u, sampler, coords);
+
+	if (IsSolid(mask, mask_pitch, get_image_dim(u), coords))
 	{
-		write_imagef(tgt, coords, tgt_val);
+		write_imagef(dyeNew, coords, (float4)(0.0f));
+		write_imagef(tNew, coords, (float4)(0.0f));
+		write_imagef(dNew, coords, (float4)(0.0f));
+		write_imagef(uNew, coords, vel);
+		return;
+	}
 
-		for (int i = 1; i < 40; i++)
-		{
-			write_imagef(tgt, clamp(coords + i * (int2)(1, 0), 0, get_image_width(tgt) - 1), tgt_val);
-			write_imagef(tgt, clamp(coords + i * (int2)(0, 1), 0, get_image_width(tgt) - 1), tgt_val);
-			write_imagef(tgt, clamp(coords + i * (int2)(1, 1), 0, get_image_width(tgt) - 1), tgt_val);
-			write_imagef(tgt, clamp(coords + i * (int2)(-1, 0), 0, get_image_width(tgt) - 1), tgt_val);
-			write_imagef(tgt, clamp(coords + i * (int2)(0, -1), 0, get_image_width(tgt) - 1), tgt_val);
-			write_imagef(tgt, clamp(coords + i * (int2)(-1, -1), 0, get_image_width(tgt) - 1), tgt_val);
-			write_imagef(tgt, clamp(coords + i * (int2)(1, -1), 0, get_image_width(tgt) - 1), tgt_val);
-			write_imagef(tgt, clamp(coords + i * (int2)(-1, 1), 0, get_image_width(tgt) - 1), tgt_val);
-		}
+	float4 lo, hi;
+	float2 pos = Backtrace(u, coords, timestep * rdx, order);
+	float4 dye = BilinearRange(dyeOld, pos, &lo, &hi);
+	float temperature = cooling * BilinearRange(tOld, pos, &lo, &hi).x;
+	float density = BilinearRange(dOld, pos, &lo, &hi).x;
+
+	float2 d = convert_float2(coords) - source.xy;
+	float d2 = dot(d, d);
+	if (d2 < source.z * source.z)
+	{
+		float sigma = source.z / 3.0f;
+		float w = exp(-d2 / (2.0f * sigma * sigma));
+		dye = mix(dye, (float4)(0.8f, 0.8f, 0.8f, 1.0f), w);
+		temperature = mix(temperature, 1.0f, w);
+		density = mix(density, 1.0f, w);
+	}
+
+	write_imagef(dyeNew, coords, dye);
+	write_imagef(tNew, coords, (float4)(temperature));
+	write_imagef(dNew, coords, (float4)(density));
+
+	// Gravity points towards -y, as in ApplyGravity
+	vel.y += timestep * (lift * temperature - weight * density);
+	write_imagef(uNew, coords, vel);
+}
+
+// Tracer buffers hold capacity float2 positions followed by capacity float ages.
+// RK2 advection of the tracers in src; the survivors are compacted into dst, counted by alive.
+kernel void AdvectTracers(float timestep, float rdx, float max_age, int capacity, read_only image2d_t u,
+	__global const float2* src, __global float2* dst, volatile __global uint* alive,
+	__global const uint* mask, int mask_pitch)
+{
+	int i = get_global_id(0);
+	if (i >= capacity)
+		return;
+
+	__global const float* src_age = (__global const float*)(src + capacity);
+	__global float* dst_age = (__global float*)(dst + capacity);
+
+	float4 lo, hi;
+	float scale = timestep * rdx;
+	float2 p = src[i];
+	float2 k1 = BilinearRange(u, p, &lo, &hi).xy;
+	float2 k2 = BilinearRange(u, p + 0.5f * scale * k1, &lo, &hi).xy;
+	p += scale * k2;
+	float age = src_age[i] + timestep;
+
+	// Old tracers, and those leaving the grid or entering an obstacle, are recycled
+	int2 size = get_image_dim(u);
+	if (age >= max_age || p.x < 0.0f || p.y < 0.0f || p.x > size.x - 1 || p.y > size.y - 1 ||
+		IsSolid(mask, mask_pitch, size, convert_int2(p + 0.5f)))
+		return;
+
+	uint slot = atomic_inc(alive);
+	dst[slot] = p;
+	dst_age[slot] = age;
+}
 
+// Spawns tracers at random positions in the slots behind the survivors
+kernel void RespawnTracers(uint step, float max_age, int capacity, int width, int height, __global const uint* alive, __global float2* dst)
+{
+	int i = get_global_id(0);
+	if (i >= capacity || i < alive[0])
 		return;
+
+	float4 r = CounterRandomFloat4((int2)(i, 0), step, RNG_STREAM_TRACERS);
+	dst[i] = (float2)(r.x * (width - 1), r.y * (height - 1));
+
+	// Random initial ages spread the deaths over the lifetime
+	((__global float*)(dst + capacity))[i] = r.z * max_age;
+}
+
+kernel void VelocityInitializer(write_only image2d_t tgt)
+{
+	int x = get_global_id(0);
+	int y = get_global_id(1);
+	int2 coords = (int2)(x, y);
+
+	float4 val = (float4)(1000.0f * sin(2.0f * PI * y), 1000.0f * sin(2.0f * PI * x), 1.0f, 1.0f);
+	// float4 val = (float4)(1.0f, 1.0f, 0.0f, 1.0f);
+	write_imagef(tgt, coords, val);
+}
+
+__constant sampler_t linear_sampler = CLK_NORMALIZED_COORDS_TRUE | CLK_ADDRESS_CLAMP_TO_EDGE | CLK_FILTER_LINEAR;
+
+kernel void ResampleImage(read_only image2d_t src, write_only image2d_t tgt)
+{
+	int x = get_global_id(0);
+	int y = get_global_id(1);
+	int2 coords = (int2)(x, y);
+
+	float2 uv = ((float2)(x, y) + 0.5f) / (float2)(get_image_width(tgt), get_image_height(tgt));
+
+	write_imagef(tgt, coords, read_imagef(src, linear_sampler, uv));
+}
+
+kernel void PackHalf(read_only image2d_t src, __global half* dst)
+{
+	int x = get_global_id(0);
+	int y = get_global_id(1);
+	int2 coords = (int2)(x, y);
+
+	vstore_half4(read_imagef(src, sampler, coords), x + y * get_image_width(src), dst);
+}
+
+// Largest speed of each tile, reduced in local memory
+__attribute__((reqd_work_group_size(REDUCTION_TILE, REDUCTION_TILE, 1)))
+kernel void MaxSpeed(read_only image2d_t u, __global float* partial)
+{
+	__local float speeds[REDUCTION_TILE * REDUCTION_TILE];
+
+	int x = get_global_id(0);
+	int y = get_global_id(1);
+	int2 coords = (int2)(x, y);
+	int2 size = get_image_dim(u);
+	int lid = get_local_id(0) + get_local_id(1) * REDUCTION_TILE;
+
+	// The global range is rounded up to whole tiles
+	speeds[lid] = (x < size.x && y < size.y) ? length(read_imagef(u, sampler, coords).xy) : 0.0f;
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (int stride = REDUCTION_TILE * REDUCTION_TILE / 2; stride > 0; stride >>= 1)
+	{
+		if (lid < stride)
+			speeds[lid] = fmax(speeds[lid], speeds[lid + stride]);
+
+		barrier(CLK_LOCAL_MEM_FENCE);
 	}
 
-	write_imagef(tgt, coords, tgt_val);
-	write_imagef(tgt, clamp(coords + (int2)(1, 0), 0, get_image_width(tgt) - 1), tgt_val);
-	write_imagef(tgt, clamp(coords + (int2)(0, 1), 0, get_image_width(tgt) - 1), tgt_val);
-	write_imagef(tgt, clamp(coords + (int2)(1, 1), 0, get_image_width(tgt) - 1), tgt_val);
-	write_imagef(tgt, clamp(coords + (int2)(-1, 0), 0, get_image_width(tgt) - 1), tgt_val);
-	write_imagef(tgt, clamp(coords + (int2)(0, -1), 0, get_image_width(tgt) - 1), tgt_val);
-	write_imagef(tgt, clamp(coords + (int2)(-1, -1), 0, get_image_width(tgt) - 1), tgt_val);
-	write_imagef(tgt, clamp(coords + (int2)(1, -1), 0, get_image_width(tgt) - 1), tgt_val);
-	write_imagef(tgt, clamp(coords + (int2)(-1, 1), 0, get_image_width(tgt) - 1), tgt_val);
+	if (lid == 0)
+		partial[get_group_id(0) + get_group_id(1) * get_num_groups(0)] = speeds[0];
 }
 
-kernel void AddDye(int xpos, int ypos, float scale, int extreme_flag, write_only image2d_t tgt)
+// Second pass over the tile maxima, run as a single work-group
+__attribute__((reqd_work_group_size(REDUCTION_TILE * REDUCTION_TILE, 1, 1)))
+kernel void ReduceMax(int count, __global const float* partial, __global float* result)
 {
-	int2 coords = (int2)(clamp(xpos, 0, get_image_width(tgt) - 1), clamp(get_image_width(tgt) - 1 - ypos, 0, get_image_width(tgt) - 1));
+	__local float values[REDUCTION_TILE * REDUCTION_TILE];
 
-	uint seed = coords.x + coords.y * get_image_width(tgt);
+	int lid = get_local_id(0);
 
-	/*float random_val = AdvancedRandomFloat(seed);
-	float4 tgt_val = scale * (float4)(random_val, random_val, random_val, 1.0f);*/
-	//float4 tgt_val = scale * (float4)(AdvancedRandomFloat(seed), AdvancedRandomFloat(seed), AdvancedRandomFloat(seed), 1.0f);
-	float4 tgt_val = scale * (float4)(AdvancedRandomFloat(seed), AdvancedRandomFloat(seed), 0.0f, 1.0f);
+	float value = 0.0f;
+	for (int i = lid; i < count; i += REDUCTION_TILE * REDUCTION_TILE)
+		value = fmax(value, partial[i]);
+	values[lid] = value;
 
-	if (extreme_flag == 1)
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (int stride = REDUCTION_TILE * REDUCTION_TILE / 2; stride > 0; stride >>= 1)
 	{
-		write_imagef(tgt, coords, tgt_val);
+		if (lid < stride)
+			values[lid] = fmax(values[lid], values[lid + stride]);
 
-		/*for (int i = 1; i < 40; i++)
-		{
-			write_imagef(tgt, clamp(coords + i * (int2)(1, 0), 0, get_image_width(tgt) - 1), tgt_val);
-			write_imagef(tgt, clamp(coords + i * (int2)(0, 1), 0, get_image_width(tgt) - 1), tgt_val);
-			write_imagef(tgt, clamp(coords + i * (int2)(1, 1), 0, get_image_width(tgt) - 1), tgt_val);
-			write_imagef(tgt, clamp(coords + i * (int2)(-1, 0), 0, get_image_width(tgt) - 1), tgt_val);
-			write_imagef(tgt, clamp(coords + i * (int2)(0, -1), 0, get_image_width(tgt) - 1), tgt_val);
-			write_imagef(tgt, clamp(coords + i * (int2)(-1, -1), 0, get_image_width(tgt) - 1), tgt_val);
-			write_imagef(tgt, clamp(coords + i * (int2)(1, -1), 0, get_image_width(tgt) - 1), tgt_val);
-			write_imagef(tgt, clamp(coords + i * (int2)(-1, 1), 0, get_image_width(tgt) - 1), tgt_val);
-		}*/
-
-
-		for (int i = 1; i < 40; i++)
-		{
-			const int r = i;
-			const int r2 = r * r;
-			int x = r;
-			int y = 0;
-			while (x > y)
-			{
-				write_imagef(tgt, clamp(coords + (int2)(x, y), 0, get_image_width(tgt) - 1), tgt_val);
-				write_imagef(tgt, clamp(coords + (int2)(y, x), 0, get_image_width(tgt) - 1), tgt_val);
-				write_imagef(tgt, clamp(coords + (int2)(-x, y), 0, get_image_width(tgt) - 1), tgt_val);
-				write_imagef(tgt, clamp(coords + (int2)(-y, x), 0, get_image_width(tgt) - 1), tgt_val);
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
 
-				write_imagef(tgt, clamp(coords + (int2)(x, -y), 0, get_image_width(tgt) - 1), tgt_val);
-				write_imagef(tgt, clamp(coords + (int2)(y, -x), 0, get_image_width(tgt) - 1), tgt_val);
-				write_imagef(tgt, clamp(coords + (int2)(-x, -y), 0, get_image_width(tgt) - 1), tgt_val);
-				write_imagef(tgt, clamp(coords + (int2)(-y, -x), 0, get_image_width(tgt) - 1), tgt_val);
+	if (lid == 0)
+		result[0] = values[0];
+}
 
-				if (x * x + (y + 1) * (y + 1) > r2)
-					x -= 1;
+// Flags the tiles where any texel moves faster than the threshold
+__attribute__((reqd_work_group_size(ACTIVE_TILE, ACTIVE_TILE, 1)))
+kernel void FlagActiveTiles(float threshold, read_only image2d_t u, __global uint* flags)
+{
+	__local int active;
 
-				y += 1;
-			}
+	int x = get_global_id(0);
+	int y = get_global_id(1);
+	int2 coords = (int2)(x, y);
+	int2 size = get_image_dim(u);
+
+	if (get_local_id(0) == 0 && get_local_id(1) == 0)
+		active = 0;
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	// Every writer stores the same value
+	if (x < size.x && y < size.y && length(read_imagef(u, sampler, coords).xy) > threshold)
+		active = 1;
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	if (get_local_id(0) == 0 && get_local_id(1) == 0)
+		flags[get_group_id(0) + get_group_id(1) * get_num_groups(0)] = active;
+}
+
+// Lists the flagged tiles and their neighbors, so flow entering a quiet tile within the step is not missed
+kernel void CompactActiveTiles(int tiles_x, int tiles_y, __global const uint* flags, __global uint* tiles, volatile __global uint* count)
+{
+	int x = get_global_id(0);
+	int y = get_global_id(1);
+	if (x >= tiles_x || y >= tiles_y)
+		return;
+
+	uint active = 0;
+	for (int j = max(y - 1, 0); j <= min(y + 1, tiles_y - 1); j++)
+		for (int i = max(x - 1, 0); i <= min(x + 1, tiles_x - 1); i++)
+			active |= flags[i + j * tiles_x];
+
+	if (active)
+		tiles[atomic_inc(count)] = (uint)x | ((uint)y << 16);
+}
+
+#ifndef SCAN_TILE
+#define SCAN_TILE 256
+#endif
+
+// Exclusive scan of each SCAN_TILE block in place, the block totals go to sums
+__attribute__((reqd_work_group_size(SCAN_TILE, 1, 1)))
+kernel void ScanBlocks(int n, __global uint* data, __global uint* sums)
+{
+	__local uint tile[SCAN_TILE];
+
+	int i = get_global_id(0);
+	int l = get_local_id(0);
+	uint value = (i < n) ? data[i] : 0;
+	tile[l] = value;
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	// Hillis-Steele inclusive scan
+	for (int offset = 1; offset < SCAN_TILE; offset <<= 1)
+	{
+		uint add = (l >= offset) ? tile[l - offset] : 0;
+		barrier(CLK_LOCAL_MEM_FENCE);
+		tile[l] += add;
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	if (i < n)
+		data[i] = tile[l] - value;
+	if (l == SCAN_TILE - 1)
+		sums[get_group_id(0)] = tile[l];
+}
+
+// Adds the scanned block totals to their blocks, completing a scan over several blocks
+__attribute__((reqd_work_group_size(SCAN_TILE, 1, 1)))
+kernel void AddBlockSums(int n, __global uint* data, __global const uint* sums)
+{
+	int i = get_global_id(0);
+	if (i < n)
+		data[i] += sums[get_group_id(0)];
+}
+
+#define RADIX_BINS 16
+
+// Digit counts of the chunk of each work-item, stored digit-major: one exclusive scan over them gives every
+// work-item the stable scatter offset of each digit
+kernel void RadixCount(int n, int shift, int chunk, __global const uint* keys, __global uint* counts)
+{
+	int t = get_global_id(0);
+	int threads = get_global_size(0);
+
+	uint hist[RADIX_BINS];
+	for (int d = 0; d < RADIX_BINS; d++)
+		hist[d] = 0;
+
+	int end = min(n, (t + 1) * chunk);
+	for (int i = t * chunk; i < end; i++)
+		hist[(keys[i] >> shift) & (RADIX_BINS - 1)]++;
+
+	for (int d = 0; d < RADIX_BINS; d++)
+		counts[d * threads + t] = hist[d];
+}
+
+// Moves the keys and values of each chunk to their scanned offsets, in order, so the sort stays stable
+kernel void RadixScatter(int n, int shift, int chunk, __global const uint* keys, __global const uint* values, __global const uint* offsets,
+	__global uint* keys_out, __global uint* values_out)
+{
+	int t = get_global_id(0);
+	int threads = get_global_size(0);
+
+	uint offset[RADIX_BINS];
+	for (int d = 0; d < RADIX_BINS; d++)
+		offset[d] = offsets[d * threads + t];
+
+	int end = min(n, (t + 1) * chunk);
+	for (int i = t * chunk; i < end; i++)
+	{
+		uint key = keys[i];
+		uint dst = offset[(key >> shift) & (RADIX_BINS - 1)]++;
+		keys_out[dst] = key;
+		values_out[dst] = values[i];
+	}
+}
+
+// FLIP particles are seeded jittered around the cells, ppc per cell, with the grid velocity
+kernel void FlipSeed(int count, int ppc, uint step, read_only image2d_t u, __global float2* pos, __global float2* vel)
+{
+	int i = get_global_id(0);
+	if (i >= count)
+		return;
+
+	int2 size = get_image_dim(u);
+	int cell = i / ppc;
+	float4 r = CounterRandomFloat4((int2)(i, 0), step, RNG_STREAM_FLIP);
+	float2 p = clamp((float2)(cell % size.x, cell / size.x) + r.xy - 0.5f, (float2)(0.0f), convert_float2(size - (int2)(1)));
+
+	float4 lo, hi;
+	pos[i] = p;
+	vel[i] = BilinearRange(u, p, &lo, &hi).xy;
+}
+
+// Grid to particles: FLIP adds the change of the grid since the particles were transferred to it, PIC takes the
+// grid velocity, and flip_ratio blends the two. The particles then move through the grid with RK2.
+kernel void FlipUpdate(int count, float timestep, float rdx, float flip_ratio, read_only image2d_t u, read_only image2d_t u_prev,
+	__global float2* pos, __global float2* vel, __global const uint* mask, int mask_pitch)
+{
+	int i = get_global_id(0);
+	if (i >= count)
+		return;
+
+	int2 size = get_image_dim(u);
+	float4 lo, hi;
+	float2 p = pos[i];
+	float2 grid = BilinearRange(u, p, &lo, &hi).xy;
+	float2 prev = BilinearRange(u_prev, p, &lo, &hi).xy;
+	vel[i] = mix(grid, vel[i] + grid - prev, flip_ratio);
+
+	float scale = timestep * rdx;
+	float2 k2 = BilinearRange(u, p + 0.5f * scale * grid, &lo, &hi).xy;
+	float2 q = clamp(p + scale * k2, (float2)(0.0f), convert_float2(size - (int2)(1)));
+
+	// Particles stop in front of obstacles
+	if (!IsSolid(mask, mask_pitch, size, convert_int2(q + 0.5f)))
+		pos[i] = q;
+}
+
+// Sort keys: the cell nearest to each particle
+kernel void FlipCellKeys(int count, int width, __global const float2* pos, __global uint* keys, __global uint* values)
+{
+	int i = get_global_id(0);
+	if (i >= count)
+		return;
+
+	int2 c = convert_int2(pos[i] + 0.5f);
+	keys[i] = c.x + c.y * width;
+	values[i] = i;
+}
+
+// Permutes the particles into sorted order, so the gather below reads them contiguously
+kernel void FlipReorder(int count, __global const uint* order, __global const float2* pos, __global const float2* vel,
+	__global float2* pos_out, __global float2* vel_out)
+{
+	int i = get_global_id(0);
+	if (i >= count)
+		return;
+
+	uint j = order[i];
+	pos_out[i] = pos[j];
+	vel_out[i] = vel[j];
+}
+
+kernel void FlipClearCells(int cells, __global uint* starts, __global uint* ends)
+{
+	int i = get_global_id(0);
+	if (i >= cells)
+		return;
+
+	starts[i] = 0;
+	ends[i] = 0;
+}
+
+// Range of the sorted particles of each cell
+kernel void FlipCellRanges(int count, __global const uint* keys, __global uint* starts, __global uint* ends)
+{
+	int i = get_global_id(0);
+	if (i >= count)
+		return;
+
+	uint key = keys[i];
+	if (i == 0 || keys[i - 1] != key)
+		starts[key] = i;
+	if (i == count - 1 || keys[i + 1] != key)
+		ends[key] = i + 1;
+}
 
-			// This fills some empty pixels
-			if (x == y)
+// Particles to grid without atomics: each cell gathers the tent weighted velocities of the particles keyed to the
+// 3x3 cells around it. The result also goes to out_prev, for the FLIP update of the next step.
+kernel void FlipToGrid(read_only image2d_t u, __global const float2* pos, __global const float2* vel, __global const uint* starts,
+	__global const uint* ends, write_only image2d_t out, write_only image2d_t out_prev, __global const uint* mask, int mask_pitch)
+{
+	int2 coords = (int2)(get_global_id(0), get_global_id(1));
+	int2 size = get_image_dim(u);
+	float4 result = read_imagef(u, sampler, coords);
+
+	if (IsSolid(mask, mask_pitch, size, coords))
+	{
+		write_imagef(out, coords, (float4)(0.0f));
+		write_imagef(out_prev, coords, (float4)(0.0f));
+		return;
+	}
+
+	float2 sum = (float2)(0.0f);
+	float weight = 0.0f;
+	for (int dy = -1; dy <= 1; dy++)
+	{
+		for (int dx = -1; dx <= 1; dx++)
+		{
+			int2 c = coords + (int2)(dx, dy);
+			if (c.x < 0 || c.y < 0 || c.x >= size.x || c.y >= size.y)
+				continue;
+
+			int cell = c.x + c.y * size.x;
+			for (uint j = starts[cell]; j < ends[cell]; j++)
 			{
-				write_imagef(tgt, clamp(coords + (int2)(x, y), 0, get_image_width(tgt) - 1), tgt_val);
-				write_imagef(tgt, clamp(coords + (int2)(y, x), 0, get_image_width(tgt) - 1), tgt_val);
-				write_imagef(tgt, clamp(coords + (int2)(-x, y), 0, get_image_width(tgt) - 1), tgt_val);
-				write_imagef(tgt, clamp(coords + (int2)(-y, x), 0, get_image_width(tgt) - 1), tgt_val);
-
-				write_imagef(tgt, clamp(coords + (int2)(x, -y), 0, get_image_width(tgt) - 1), tgt_val);
-				write_imagef(tgt, clamp(coords + (int2)(y, -x), 0, get_image_width(tgt) - 1), tgt_val);
-				write_imagef(tgt, clamp(coords + (int2)(-x, -y), 0, get_image_width(tgt) - 1), tgt_val);
-				write_imagef(tgt, clamp(coords + (int2)(-y, -x), 0, get_image_width(tgt) - 1), tgt_val);
+				float2 d = fabs(pos[j] - convert_float2(coords));
+				float w = max(0.0f, 1.0f - d.x) * max(0.0f, 1.0f - d.y);
+				sum += w * vel[j];
+				weight += w;
 			}
 		}
-
-		return;
 	}
 
-	write_imagef(tgt, coords, tgt_val);
-	write_imagef(tgt, clamp(coords + (int2)(1, 0), 0, get_image_width(tgt) - 1), tgt_val);
-	write_imagef(tgt, clamp(coords + (int2)(0, 1), 0, get_image_width(tgt) - 1), tgt_val);
-	write_imagef(tgt, clamp(coords + (int2)(1, 1), 0, get_image_width(tgt) - 1), tgt_val);
-	write_imagef(tgt, clamp(coords + (int2)(-1, 0), 0, get_image_width(tgt) - 1), tgt_val);
-	write_imagef(tgt, clamp(coords + (int2)(0, -1), 0, get_image_width(tgt) - 1), tgt_val);
-	write_imagef(tgt, clamp(coords + (int2)(-1, -1), 0, get_image_width(tgt) - 1), tgt_val);
-	write_imagef(tgt, clamp(coords + (int2)(1, -1), 0, get_image_width(tgt) - 1), tgt_val);
-	write_imagef(tgt, clamp(coords + (int2)(-1, 1), 0, get_image_width(tgt) - 1), tgt_val);
+	// Cells no particle reaches keep their velocity
+	if (weight > 1e-4f)
+		result.xy = sum / weight;
+
+	write_imagef(out, coords, result);
+	write_imagef(out_prev, coords, result);
 }
 
-kernel void AddVelocity(int xpos, int ypos, int prev_xpos, int prev_ypos, float scale, int extreme_flag, int normalize_flag, read_only image2d_t src, write_only image2d_t tgt)
+// D2Q9 lattice: directions, their opposites and weights. +y points towards larger rows, like the velocity images.
+__constant int2 lbm_c[9] = { (int2)(0, 0), (int2)(1, 0), (int2)(0, 1), (int2)(-1, 0), (int2)(0, -1),
+	(int2)(1, 1), (int2)(-1, 1), (int2)(-1, -1), (int2)(1, -1) };
+__constant int lbm_opp[9] = { 0, 3, 4, 1, 2, 7, 8, 5, 6 };
+__constant float lbm_w[9] = { 4.0f / 9.0f, 1.0f / 9.0f, 1.0f / 9.0f, 1.0f / 9.0f, 1.0f / 9.0f,
+	1.0f / 36.0f, 1.0f / 36.0f, 1.0f / 36.0f, 1.0f / 36.0f };
+
+// Fastest lattice velocity, well below the lattice speed of sound
+#define LBM_MAX_SPEED 0.3f
+
+float LbmEquilibrium(int i, float rho, float2 u)
 {
-	int2 coords = (int2)(clamp(xpos, 0, get_image_width(tgt) - 1), clamp(get_image_width(tgt) - 1 - ypos, 0, get_image_width(tgt) - 1));
+	float cu = 3.0f * dot(convert_float2(lbm_c[i]), u);
+	return lbm_w[i] * rho * (1.0f + cu + 0.5f * cu * cu - 1.5f * dot(u, u));
+}
 
-	float4 src_val = read_imagef(src, sampler, coords);
+// Domain edges and obstacles bounce the populations back
+bool LbmWall(__global const uint* mask, int mask_pitch, int2 size, int2 c)
+{
+	return c.x < 0 || c.y < 0 || c.x >= size.x || c.y >= size.y || IsSolid(mask, mask_pitch, size, c);
+}
+
+float2 LbmClampSpeed(float2 u)
+{
+	float speed = length(u);
+	return (speed > LBM_MAX_SPEED) ? u * (LBM_MAX_SPEED / speed) : u;
+}
 
-	//float2 dir = (normalize_flag) ? normalize((float2)(xpos - prev_xpos, ypos - prev_ypos)) : (float2)(xpos - prev_xpos, ypos - prev_ypos);
-	float2 dir = (normalize_flag) ? normalize((float2)(xpos - prev_xpos, prev_ypos - ypos)) : (float2)(xpos - prev_xpos, prev_ypos - ypos);
-
-	float4 tgt_val = (float4)(scale * dir.x, scale * dir.y, 0.0f, 1.0f) + src_val;
-
-	if (extreme_flag == 1)
-	{
-		write_imagef(tgt, coords, tgt_val);
-
-		//for (int i = 1; i < 40; i++)
-		//{
-		//	//tgt_val.xy /= i;
-		//	write_imagef(tgt, clamp(coords + i * (int2)(1, 0), 0, get_image_width(tgt) - 1), tgt_val);
-		//	write_imagef(tgt, clamp(coords + i * (int2)(0, 1), 0, get_image_width(tgt) - 1), tgt_val);
-		//	write_imagef(tgt, clamp(coords + i * (int2)(1, 1), 0, get_image_width(tgt) - 1), tgt_val);
-		//	write_imagef(tgt, clamp(coords + i * (int2)(-1, 0), 0, get_image_width(tgt) - 1), tgt_val);
-		//	write_imagef(tgt, clamp(coords + i * (int2)(0, -1), 0, get_image_width(tgt) - 1), tgt_val);
-		//	write_imagef(tgt, clamp(coords + i * (int2)(-1, -1), 0, get_image_width(tgt) - 1), tgt_val);
-		//	write_imagef(tgt, clamp(coords + i * (int2)(1, -1), 0, get_image_width(tgt) - 1), tgt_val);
-		//	write_imagef(tgt, clamp(coords + i * (int2)(-1, 1), 0, get_image_width(tgt) - 1), tgt_val);
-		//}
-
-		const int r = 40;
-		const int r2 = r * r;
-		int x = r;
-		int y = 0;
-		while (x > y)
+// Equilibrium populations of unit density at the grid velocity, converted to lattice units by to_lattice
+kernel void LbmInit(float to_lattice, read_only image2d_t u, __global float* f)
+{
+	int2 coords = (int2)(get_global_id(0), get_global_id(1));
+	int2 size = get_image_dim(u);
+	int n = size.x * size.y;
+	int idx = coords.x + coords.y * size.x;
+
+	float2 vel = LbmClampSpeed(read_imagef(u, sampler, coords).xy * to_lattice);
+	for (int i = 0; i < 9; i++)
+		f[i * n + idx] = LbmEquilibrium(i, 1.0f, vel);
+}
+
+// Fused stream and BGK collision with the AA pattern, in place in one lattice buffer. Even steps read the
+// populations of the cell and store the collided ones reversed; odd steps pull from the neighbors and push to them
+// in natural order. Changes made to the grid velocity since the last step, u - u_prev, enter as a force through the
+// exact difference method. The host copies out into u_prev once the step is done.
+kernel void LbmStreamCollide(int odd, float omega, float to_lattice, read_only image2d_t u, read_only image2d_t u_prev,
+	__global float* f, write_only image2d_t out, __global const uint* mask, int mask_pitch)
+{
+	int2 coords = (int2)(get_global_id(0), get_global_id(1));
+	int2 size = get_image_dim(u);
+	int n = size.x * size.y;
+	int idx = coords.x + coords.y * size.x;
+	float4 grid = read_imagef(u, sampler, coords);
+
+	if (IsSolid(mask, mask_pitch, size, coords))
+	{
+		write_imagef(out, coords, (float4)(0.0f));
+		return;
+	}
+
+	float pop[9];
+	for (int i = 0; i < 9; i++)
+	{
+		if (odd == 0)
+			pop[i] = f[i * n + idx];
+		else
 		{
-			write_imagef(tgt, clamp(coords + (int2)(x, y), 0, get_image_width(tgt) - 1), tgt_val);
-			write_imagef(tgt, clamp(coords + (int2)(y, x), 0, get_image_width(tgt) - 1), tgt_val);
-			write_imagef(tgt, clamp(coords + (int2)(-x, y), 0, get_image_width(tgt) - 1), tgt_val);
-			write_imagef(tgt, clamp(coords + (int2)(-y, x), 0, get_image_width(tgt) - 1), tgt_val);
-
-			write_imagef(tgt, clamp(coords + (int2)(x, -y), 0, get_image_width(tgt) - 1), tgt_val);
-			write_imagef(tgt, clamp(coords + (int2)(y, -x), 0, get_image_width(tgt) - 1), tgt_val);
-			write_imagef(tgt, clamp(coords + (int2)(-x, -y), 0, get_image_width(tgt) - 1), tgt_val);
-			write_imagef(tgt, clamp(coords + (int2)(-y, -x), 0, get_image_width(tgt) - 1), tgt_val);
-
-			if (x * x + (y + 1) * (y + 1) > r2)
-				x -= 1;
-			
-			y += 1;
+			// A wall behind sends back what this cell sent towards it, stored here reversed by the even step
+			int2 src = coords - lbm_c[i];
+			pop[i] = LbmWall(mask, mask_pitch, size, src) ? f[i * n + idx] : f[lbm_opp[i] * n + src.x + src.y * size.x];
 		}
+	}
+
+	float rho = 0.0f;
+	float2 momentum = (float2)(0.0f);
+	for (int i = 0; i < 9; i++)
+	{
+		rho += pop[i];
+		momentum += pop[i] * convert_float2(lbm_c[i]);
+	}
+	float2 vel = momentum / rho;
+	float2 forced = LbmClampSpeed(vel + (grid.xy - read_imagef(u_prev, sampler, coords).xy) * to_lattice);
+
+	for (int i = 0; i < 9; i++)
+	{
+		float eq = LbmEquilibrium(i, rho, vel);
+		float post = pop[i] - omega * (pop[i] - eq) + LbmEquilibrium(i, rho, forced) - eq;
 
-		// This fills some empty pixels
-		if (x == y)
+		if (odd == 0)
+			f[lbm_opp[i] * n + idx] = post;
+		else
 		{
-			write_imagef(tgt, clamp(coords + (int2)(x, y), 0, get_image_width(tgt) - 1), tgt_val);
-			write_imagef(tgt, clamp(coords + (int2)(y, x), 0, get_image_width(tgt) - 1), tgt_val);
-			write_imagef(tgt, clamp(coords + (int2)(-x, y), 0, get_image_width(tgt) - 1), tgt_val);
-			write_imagef(tgt, clamp(coords + (int2)(-y, x), 0, get_image_width(tgt) - 1), tgt_val);
-
-			write_imagef(tgt, clamp(coords + (int2)(x, -y), 0, get_image_width(tgt) - 1), tgt_val);
-			write_imagef(tgt, clamp(coords + (int2)(y, -x), 0, get_image_width(tgt) - 1), tgt_val);
-			write_imagef(tgt, clamp(coords + (int2)(-x, -y), 0, get_image_width(tgt) - 1), tgt_val);
-			write_imagef(tgt, clamp(coords + (int2)(-y, -x), 0, get_image_width(tgt) - 1), tgt_val);
+			// Populations running into a wall are stored back into this cell, reversed
+			int2 dst = coords + lbm_c[i];
+			if (LbmWall(mask, mask_pitch, size, dst))
+				f[lbm_opp[i] * n + idx] = post;
+			else
+				f[i * n + dst.x + dst.y * size.x] = post;
 		}
+	}
+
+	grid.xy = forced / to_lattice;
+	write_imagef(out, coords, grid);
+}
+
+// Parameters of one ensemble member, laid out like the EnsembleMember struct on the host
+typedef struct
+{
+	float viscosity;
+	float dx;
+	float force_scale;
+	uint seed;
+} EnsembleMember;
+
+// The ensemble kernels run over (width, height, members), each member in its own layer of the image arrays. Their
+// stencils match the collocated solver without obstacles.
+float4 ReadLayer(read_only image2d_array_t image, int2 coords, int layer)
+{
+	return read_imagef(image, sampler, (int4)(coords.x, coords.y, layer, 0));
+}
+
+// Semi-Lagrangian velocity advection with the random force of the member, drawn from its own seed
+kernel void EnsembleAdvect(float timestep, uint step, __global const EnsembleMember* members, read_only image2d_array_t u, write_only image2d_array_t uNew)
+{
+	int2 coords = (int2)(get_global_id(0), get_global_id(1));
+	int layer = get_global_id(2);
+	EnsembleMember member = members[layer];
+	float2 last = (float2)(get_image_width(u) - 1, get_image_height(u) - 1);
+
+	float2 pos = convert_float2(coords) - (timestep / member.dx) * ReadLayer(u, coords, layer).xy;
+	pos = clamp(pos, (float2)(0.0f), last);
+
+	int2 base = convert_int2(floor(pos));
+	float2 t = pos - floor(pos);
+	float4 value = lerp(lerp(ReadLayer(u, base, layer), ReadLayer(u, base + (int2)(1, 0), layer), t.x),
+		lerp(ReadLayer(u, base + (int2)(0, 1), layer), ReadLayer(u, base + (int2)(1, 1), layer), t.x), t.y);
+
+	if (member.force_scale != 0.0f)
+	{
+		uint4 bits = Philox4x32((uint4)((uint)coords.x, (uint)coords.y, step, (member.seed << 8) | RNG_STREAM_ENSEMBLE), RNG_KEY);
+		float2 random_val = convert_float2(bits.xy >> 8) * (1.0f / 16777216.0f);
+		value.xy += member.force_scale * (2.0f * random_val - 1.0f);
+	}
+
+	write_imagef(uNew, (int4)(coords.x, coords.y, layer, 0), value);
+}
+
+kernel void EnsembleDivergence(__global const EnsembleMember* members, read_only image2d_array_t u, write_only image2d_array_t out)
+{
+	int2 coords = (int2)(get_global_id(0), get_global_id(1));
+	int layer = get_global_id(2);
+
+	float4 left = ReadLayer(u, coords - (int2)(1, 0), layer);
+	float4 right = ReadLayer(u, coords + (int2)(1, 0), layer);
+	float4 bottom = ReadLayer(u, coords + (int2)(0, 1), layer);
+	float4 top = ReadLayer(u, coords - (int2)(0, 1), layer);
+
+	float half_rdx = 0.5f / members[layer].dx;
+	write_imagef(out, (int4)(coords.x, coords.y, layer, 0), (float4)(half_rdx * (right.x - left.x + top.y - bottom.y)));
+}
+
+// Pressure sweep (viscous == 0) with the constants of the Jacobi pass, or a viscous diffusion sweep with the
+// viscosity of the member. Inviscid members pass x_vector through unchanged.
+kernel void EnsembleJacobi(int viscous, float timestep, __global const EnsembleMember* members, read_only image2d_array_t x_vector,
+	read_only image2d_array_t b_vector, write_only image2d_array_t x_new)
+{
+	int2 coords = (int2)(get_global_id(0), get_global_id(1));
+	int layer = get_global_id(2);
 
+	if (viscous != 0 && members[layer].viscosity <= 0.0f)
+	{
+		write_imagef(x_new, (int4)(coords.x, coords.y, layer, 0), ReadLayer(x_vector, coords, layer));
 		return;
 	}
 
-	write_imagef(tgt, coords, tgt_val);
-	write_imagef(tgt, clamp(coords + (int2)(1, 0), 0, get_image_width(tgt) - 1), tgt_val);
-	write_imagef(tgt, clamp(coords + (int2)(0, 1), 0, get_image_width(tgt) - 1), tgt_val);
-	write_imagef(tgt, clamp(coords + (int2)(1, 1), 0, get_image_width(tgt) - 1), tgt_val);
-	write_imagef(tgt, clamp(coords + (int2)(-1, 0), 0, get_image_width(tgt) - 1), tgt_val);
-	write_imagef(tgt, clamp(coords + (int2)(0, -1), 0, get_image_width(tgt) - 1), tgt_val);
-	write_imagef(tgt, clamp(coords + (int2)(-1, -1), 0, get_image_width(tgt) - 1), tgt_val);
-	write_imagef(tgt, clamp(coords + (int2)(1, -1), 0, get_image_width(tgt) - 1), tgt_val);
-	write_imagef(tgt, clamp(coords + (int2)(-1, 1), 0, get_image_width(tgt) - 1), tgt_val);
+	float alpha = -1.0f;
+	float rBeta = 0.25f;
+	if (viscous != 0)
+	{
+		alpha = 1.0f / (members[layer].viscosity * timestep);
+		rBeta = 1.0f / (4.0f + alpha);
+	}
+
+	float4 left = ReadLayer(x_vector, coords - (int2)(1, 0), layer);
+	float4 right = ReadLayer(x_vector, coords + (int2)(1, 0), layer);
+	float4 bottom = ReadLayer(x_vector, coords + (int2)(0, 1), layer);
+	float4 top = ReadLayer(x_vector, coords - (int2)(0, 1), layer);
+	float4 bC = ReadLayer(b_vector, coords, layer);
+
+	write_imagef(x_new, (int4)(coords.x, coords.y, layer, 0), (left + right + bottom + top + alpha * bC) * rBeta);
 }
 
-kernel void ApplyGravity(float time_step, read_only image2d_t src, write_only image2d_t tgt)
+kernel void EnsembleGradient(__global const EnsembleMember* members, read_only image2d_array_t pressure, read_only image2d_array_t w,
+	write_only image2d_array_t u_new)
 {
-	int x = get_global_id(0);
-	int y = get_global_id(1);
-	int2 coords = (int2)(x, y);
+	int2 coords = (int2)(get_global_id(0), get_global_id(1));
+	int layer = get_global_id(2);
 
-	float4 src_val = read_imagef(src, sampler, coords);
+	float pressure_left = ReadLayer(pressure, coords - (int2)(1, 0), layer).x;
+	float pressure_right = ReadLayer(pressure, coords + (int2)(1, 0), layer).x;
+	float pressure_bottom = ReadLayer(pressure, coords + (int2)(0, 1), layer).x;
+	float pressure_top = ReadLayer(pressure, coords - (int2)(0, 1), layer).x;
 
-	write_imagef(tgt, coords, src_val - (float4)(0.0f, 9.764f, 0.0f, 1.0f) * time_step);
+	float4 u_new_val = ReadLayer(w, coords, layer);
+	u_new_val.xy -= (float2)(pressure_right - pressure_left, pressure_top - pressure_bottom) * (0.5f / members[layer].dx);
+
+	write_imagef(u_new, (int4)(coords.x, coords.y, layer, 0), u_new_val);
 }
 
-kernel void VelocityInitializer(write_only image2d_t tgt)
+// Random force for a slab of a larger grid. The draws are keyed by the texel of the whole grid, so every
+// decomposition forces the same way.
+kernel void SlabRandomForce(float scale, uint step, int row_offset, read_only image2d_t src, write_only image2d_t tgt)
 {
-	int x = get_global_id(0);
-	int y = get_global_id(1);
-	int2 coords = (int2)(x, y);
+	int2 coords = (int2)(get_global_id(0), get_global_id(1));
 
-	float4 val = (float4)(1000.0f * sin(2.0f * PI * y), 1000.0f * sin(2.0f * PI * x), 1.0f, 1.0f);
-	// float4 val = (float4)(1.0f, 1.0f, 0.0f, 1.0f);
-	write_imagef(tgt, coords, val);
+	float4 random_val = CounterRandomFloat4(coords + (int2)(0, row_offset), step, RNG_STREAM_FORCE);
+
+	float4 tgt_val = read_imagef(src, sampler, coords);
+	tgt_val.xy += scale * (2.0f * random_val.xy - 1.0f);
+
+	write_imagef(tgt, coords, tgt_val);
 }
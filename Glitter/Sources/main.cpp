@@ -4,6 +4,22 @@
 #include <Shader.hpp>
 #include <physics.hpp>
 #include <GUI.hpp>
+#include <Benchmark.hpp>
+#include <Autotuner.hpp>
+#include <Checkpoint.hpp>
+#include <FrameCapture.hpp>
+#include <TimeSeries.hpp>
+#include <InputLog.hpp>
+#include <SplatQueue.hpp>
+#include <AdaptiveTimeStep.hpp>
+#include <ObstacleMask.hpp>
+#include <ActiveTiles.hpp>
+#include <TracerParticles.hpp>
+#include <FlipSolver.hpp>
+#include <LatticeBoltzmann.hpp>
+#include <Ensemble.hpp>
+#include <SweepScheduler.hpp>
+#include <SlabDecomposition.hpp>
 
 // System Headers
 #include <glad/glad.h>
@@ -16,10 +32,46 @@
 #include <direct.h>
 #include <wingdi.h>
 #include <chrono>
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <string>
 
 // Some Globals
 GUI* gui_pointer;
+InputRecorder* recorder_pointer = nullptr;
+bool replaying_input = false;
+SplatQueue splat_queue;
+AdaptiveTimeStep adaptive_time_step;
+ObstacleMask obstacle_mask;
+ActiveTiles active_tiles;
+TracerParticles tracers;
+FlipSolver flip_solver;
+LatticeBoltzmann lattice_boltzmann;
 const std::vector<RenderedTexture> selectables{ VELOCITY, PRESSURE, DYE };
+#ifdef NEUMANN_BOUND
+const char* const boundary_kernel_name = "NeumannBoundary";
+#else
+const char* const boundary_kernel_name = "Boundary";
+#endif // NEUMANN_BOUND
+
+// Simulation
+cl::EnqueueArgs TunedArgs(const char* kernel_name, const cl::NDRange& global);
+void TuneWorkGroups(const cl::NDRange& global_test, const cl::NDRange& global_1D, bool retune);
+void StepSimulation(GUI& gui, uint64_t step, float time_step, const cl::NDRange& global_test, const cl::NDRange& global_1D, const size_t* imageSize, StepTimings& timings);
+void AdvanceVelocityCollocated(GUI& gui, uint64_t step, float time_step, const cl::NDRange& global_test, const cl::NDRange& global_1D, const size_t* imageSize, StepTimings& timings);
+void AdvanceVelocityStaggered(GUI& gui, float time_step, const cl::NDRange& global_test, const size_t* imageSize, StepTimings& timings);
+void AdvanceVelocityLatticeBoltzmann(GUI& gui, float time_step, const size_t* imageSize, StepTimings& timings);
+void CreateStaggeredImages(int width, int height);
+void CreateSmokeImages(int width, int height);
+bool FusedDyeAdvection(const GUI& gui);
+int RunBenchmark(GUI& gui, int steps, float threshold, bool update_baselines);
+int RunEnsemble(GUI& gui, int members, int size, int steps, float viscosity_min, float viscosity_max, const std::string& out_path);
+int RunSlabs(GUI& gui, int size, int steps, int max_devices, int cpu_partitions, const std::string& build_options);
+CheckpointHeader MakeCheckpointHeader(GUI& gui, uint64_t step, int width, int height);
+bool RestoreCheckpoint(GUI& gui, const std::string& path, int width, int height, uint64_t& step);
 
 // Callbacks
 void CursorPositionCallback(GLFWwindow* window, double xpos, double ypos);
@@ -28,6 +80,122 @@ void KeyboardCallback(GLFWwindow* window, int key, int scancode, int action, int
 
 int main(int argc, char * argv[]) {
 
+    // Command line options
+    bool benchmark_mode = false;
+    bool update_baselines = false;
+    bool retune = false;
+    int benchmark_steps = 200;
+    float benchmark_threshold = 0.1f;
+    std::string checkpoint_path = "checkpoint.bin";
+    std::string restart_path;
+    int checkpoint_every = 0;
+    bool compress_checkpoints = false;
+    std::string capture_dir = ".";
+    CaptureFormat capture_format = CAPTURE_PNG;
+    int capture_every = 10;
+    bool capture_on_start = false;
+    std::string series_path;
+    int series_every = 10;
+    uint32_t series_capacity = 3000;
+    bool series_half = false;
+    std::string record_path;
+    std::string replay_path;
+    bool headless = false;
+    float cfl_number = 0.0f;
+    int max_substeps = 4;
+    std::string obstacles_path;
+    int tracer_count = 1 << 20;
+    int flip_ppc = 4;
+    int ensemble_members = 0;
+    int ensemble_size = 128;
+    float ensemble_viscosity_min = -1.0f;
+    float ensemble_viscosity_max = -1.0f;
+    std::string ensemble_out;
+    std::string sweep_path;
+    std::string sweep_out = "sweep_summary.csv";
+    int sweep_cpu_partitions = 0;
+    int slab_size = 0;
+    int slab_devices = 0;
+    int slab_cpu_partitions = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        const std::string arg = argv[i];
+        if (arg == "--benchmark")
+            benchmark_mode = true;
+        else if (arg == "--update-baselines")
+            update_baselines = true;
+        else if (arg == "--retune")
+            retune = true;
+        else if (arg == "--steps" && i + 1 < argc)
+            benchmark_steps = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--threshold" && i + 1 < argc)
+            benchmark_threshold = static_cast<float>(std::atof(argv[++i]));
+        else if (arg == "--checkpoint" && i + 1 < argc)
+            checkpoint_path = argv[++i];
+        else if (arg == "--checkpoint-every" && i + 1 < argc)
+            checkpoint_every = std::atoi(argv[++i]);
+        else if (arg == "--compress-checkpoints")
+            compress_checkpoints = true;
+        else if (arg == "--restart" && i + 1 < argc)
+            restart_path = argv[++i];
+        else if (arg == "--capture-every" && i + 1 < argc)
+        {
+            capture_every = std::max(1, std::atoi(argv[++i]));
+            capture_on_start = true;
+        }
+        else if (arg == "--capture-dir" && i + 1 < argc)
+            capture_dir = argv[++i];
+        else if (arg == "--capture-format" && i + 1 < argc)
+            capture_format = (std::string(argv[++i]) == "raw") ? CAPTURE_RAW : CAPTURE_PNG;
+        else if (arg == "--series" && i + 1 < argc)
+            series_path = argv[++i];
+        else if (arg == "--series-every" && i + 1 < argc)
+            series_every = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--series-capacity" && i + 1 < argc)
+            series_capacity = static_cast<uint32_t>(std::max(1, std::atoi(argv[++i])));
+        else if (arg == "--series-half")
+            series_half = true;
+        else if (arg == "--record" && i + 1 < argc)
+            record_path = argv[++i];
+        else if (arg == "--replay" && i + 1 < argc)
+            replay_path = argv[++i];
+        else if (arg == "--headless")
+            headless = true;
+        else if (arg == "--cfl" && i + 1 < argc)
+            cfl_number = static_cast<float>(std::atof(argv[++i]));
+        else if (arg == "--max-substeps" && i + 1 < argc)
+            max_substeps = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--obstacles" && i + 1 < argc)
+            obstacles_path = argv[++i];
+        else if (arg == "--tracers" && i + 1 < argc)
+            tracer_count = std::max(0, std::atoi(argv[++i]));
+        else if (arg == "--flip-ppc" && i + 1 < argc)
+            flip_ppc = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--ensemble" && i + 1 < argc)
+            ensemble_members = std::max(0, std::atoi(argv[++i]));
+        else if (arg == "--ensemble-size" && i + 1 < argc)
+            ensemble_size = std::max(8, std::atoi(argv[++i]));
+        else if (arg == "--ensemble-viscosity" && i + 2 < argc)
+        {
+            ensemble_viscosity_min = static_cast<float>(std::atof(argv[++i]));
+            ensemble_viscosity_max = static_cast<float>(std::atof(argv[++i]));
+        }
+        else if (arg == "--ensemble-out" && i + 1 < argc)
+            ensemble_out = argv[++i];
+        else if (arg == "--sweep" && i + 1 < argc)
+            sweep_path = argv[++i];
+        else if (arg == "--sweep-out" && i + 1 < argc)
+            sweep_out = argv[++i];
+        else if (arg == "--sweep-cpu-partitions" && i + 1 < argc)
+            sweep_cpu_partitions = std::max(0, std::atoi(argv[++i]));
+        else if (arg == "--slabs" && i + 1 < argc)
+            slab_size = std::max(0, std::atoi(argv[++i]));
+        else if (arg == "--slab-devices" && i + 1 < argc)
+            slab_devices = std::max(0, std::atoi(argv[++i]));
+        else if (arg == "--slab-cpu-partitions" && i + 1 < argc)
+            slab_cpu_partitions = std::max(0, std::atoi(argv[++i]));
+    }
+
     // Load GLFW and Create a Window
     glfwInit();
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
@@ -35,6 +203,8 @@ int main(int argc, char * argv[]) {
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
     glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
     glfwWindowHint(GLFW_RESIZABLE, GL_FALSE);
+    if (headless)
+        glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
     auto mWindow = glfwCreateWindow(mWidth, mHeight, "OpenGL", nullptr, nullptr);
 
     // Check for Valid Context
@@ -53,6 +223,13 @@ int main(int argc, char * argv[]) {
     gui.Init();
     gui_pointer = &gui;
 
+    // A CFL number on the command line enables adaptive time stepping
+    if (cfl_number > 0.0f)
+    {
+        gui.adaptive_timestep = true;
+        gui.cfl_number = cfl_number;
+    }
+
     // OpenGL Callback Functions
     glfwSetCursorPosCallback(mWindow, CursorPositionCallback);
     glfwSetMouseButtonCallback(mWindow, MouseButtonCallback);
@@ -132,11 +309,18 @@ int main(int argc, char * argv[]) {
     // Build program and compile
     program = cl::Program(context, sources);
 
-    if (program.build({ default_device }) != CL_SUCCESS)
+    const std::string build_options = "-D VORTICITY_TILE=" + std::to_string(VORTICITY_TILE) +
+        " -D REDUCTION_TILE=" + std::to_string(REDUCTION_TILE) +
+        " -D ACTIVE_TILE=" + std::to_string(ACTIVE_TILE) +
+        " -D SCAN_TILE=" + std::to_string(SCAN_TILE);
+    if (program.build({ default_device }, build_options.c_str()) != CL_SUCCESS)
     {
         std::cout << " Error building: " << program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(default_device) << "\n";
         exit(1);
     }
+
+    // Work-group sizes tuned in an earlier run
+    autotuner.Init(default_device, PROJECT_SOURCE_DIR "/cache", kernel_source);
     
     // Prepare buffers
     test_buffer = cl::Buffer(context, CL_MEM_READ_WRITE, sizeof(int) * 10);
@@ -144,6 +328,7 @@ int main(int argc, char * argv[]) {
 
     // OpenGL shaders
     Shader simple_shader("C:/Repos/2D_Fluids/Glitter/Shaders/simple_shader.vs", "C:/Repos/2D_Fluids/Glitter/Shaders/simple_shader.fs");
+    Shader tracer_shader("C:/Repos/2D_Fluids/Glitter/Shaders/tracer.vs", "C:/Repos/2D_Fluids/Glitter/Shaders/tracer.fs");
 
     // Setup OpenGL Buffers
     unsigned int VBO, VAO, EBO;
@@ -233,17 +418,6 @@ int main(int argc, char * argv[]) {
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-    // OpenGL vorticity texture
-    unsigned int gl_vorticity;
-    glGenTextures(1, &gl_vorticity);
-    glBindTexture(GL_TEXTURE_2D, gl_vorticity);
-    // set the texture wrapping parameters
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);	// set texture wrapping to GL_REPEAT (default wrapping method)
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    // set texture filtering parameters
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
     // OpenGL dye texture
     unsigned int gl_dye;
     glGenTextures(1, &gl_dye);
@@ -308,9 +482,6 @@ int main(int argc, char * argv[]) {
         glBindTexture(GL_TEXTURE_2D, gl_pressure_new);
         glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width, height, 0, src_channels, GL_UNSIGNED_BYTE, data);
         glGenerateMipmap(GL_TEXTURE_2D);
-        glBindTexture(GL_TEXTURE_2D, gl_vorticity);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width, height, 0, src_channels, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
         glBindTexture(GL_TEXTURE_2D, gl_dye);
         glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width, height, 0, src_channels, GL_UNSIGNED_BYTE, data);
         glGenerateMipmap(GL_TEXTURE_2D);
@@ -353,9 +524,6 @@ int main(int argc, char * argv[]) {
     new_pressure = clCreateFromGLTexture(context(), CL_MEM_READ_WRITE, GL_TEXTURE_2D, 0, gl_pressure_new, &err);
     std::cout << "Created CL Image2D with err:\t" << err << std::endl;
 
-    vorticity = clCreateFromGLTexture(context(), CL_MEM_READ_WRITE, GL_TEXTURE_2D, 0, gl_vorticity, &err);
-    std::cout << "Created CL Image2D with err:\t" << err << std::endl;
-
     dye_texture = clCreateFromGLTexture(context(), CL_MEM_READ_WRITE, GL_TEXTURE_2D, 0, gl_dye, &err);
     std::cout << "Created CL Image2D with err:\t" << err << std::endl;
 
@@ -365,6 +533,17 @@ int main(int argc, char * argv[]) {
     display_texture = clCreateFromGLTexture(context(), CL_MEM_READ_WRITE, GL_TEXTURE_2D, 0, gl_display, &err);
     std::cout << "Created CL Image2D with err:\t" << err << std::endl;
 
+    // Forward result of MacCormack advection, only used by CL
+    advection_scratch = cl::Image2D(context, CL_MEM_READ_WRITE, cl::ImageFormat(CL_RGBA, CL_FLOAT), width, height);
+    CreateStaggeredImages(width, height);
+    CreateSmokeImages(width, height);
+
+    // Obstacles, empty unless loaded or painted
+    obstacle_mask.Init(context, width, height);
+    if (!obstacles_path.empty())
+        obstacle_mask.Load(obstacles_path);
+    obstacle_mask.Upload(queue);
+
     cl_image_format form;
     clGetImageInfo(display_texture(), CL_IMAGE_FORMAT, sizeof(cl_image_format), &form, NULL);
     std::cout << form.image_channel_data_type << std::endl;
@@ -388,8 +567,6 @@ int main(int argc, char * argv[]) {
     std::cout << "Acquired GL objects with err:\t" << err << std::endl;
     err = clEnqueueAcquireGLObjects(queue(), 1, &new_pressure(), 0, NULL, NULL);
     std::cout << "Acquired GL objects with err:\t" << err << std::endl;
-    err = clEnqueueAcquireGLObjects(queue(), 1, &vorticity(), 0, NULL, NULL);
-    std::cout << "Acquired GL objects with err:\t" << err << std::endl;
     err = clEnqueueAcquireGLObjects(queue(), 1, &dye_texture(), 0, NULL, NULL);
     std::cout << "Acquired GL objects with err:\t" << err << std::endl;
     err = clEnqueueAcquireGLObjects(queue(), 1, &dye_texture_new(), 0, NULL, NULL);
@@ -403,8 +580,8 @@ int main(int argc, char * argv[]) {
 #ifdef RAND_TEX
     // Texture randomizer
     tex_randomizer = cl::Kernel(program, "RandomizeTexture");
-    tex_randomizer(cl::EnqueueArgs(queue, global_test), target_texture).wait();
-    tex_randomizer(cl::EnqueueArgs(queue, global_test), old_pressure).wait();
+    tex_randomizer(cl::EnqueueArgs(queue, global_test), 0, target_texture).wait();
+    tex_randomizer(cl::EnqueueArgs(queue, global_test), 1, old_pressure).wait();
 #endif // RAND_TEX
 
 #ifdef TEXTURE_TEST
@@ -423,8 +600,19 @@ int main(int argc, char * argv[]) {
     // Prepare the rest of the kernels
     divergencer = cl::Kernel(program, "Divergence");
     jacobier = cl::Kernel(program, "Jacobi");
+    tile_advecter = cl::Kernel(program, "AdvectFluidTiles");
+    field_advecter = cl::Kernel(program, "AdvectFields");
+    tile_jacobier = cl::Kernel(program, "JacobiTiles");
     gradienter = cl::Kernel(program, "Gradient");
-    vorticitier = cl::Kernel(program, "Vorticity");
+    maccormack_advecter = cl::Kernel(program, "AdvectMacCormack");
+    jacobi_divergencer = cl::Kernel(program, "JacobiDivergence");
+    gradient_bounder = cl::Kernel(program, "GradientBoundary");
+    face_advecter = cl::Kernel(program, "AdvectFace");
+    staggered_divergencer = cl::Kernel(program, "DivergenceStaggered");
+    staggered_jacobier = cl::Kernel(program, "JacobiStaggered");
+    face_gradienter = cl::Kernel(program, "GradientFace");
+    centers_to_facer = cl::Kernel(program, "CentersToFaces");
+    faces_to_centerer = cl::Kernel(program, "FacesToCenters");
     vorticity_confiner = cl::Kernel(program, "VorticityConfinement");
 #ifdef NEUMANN_BOUND
     boundarier = cl::Kernel(program, "NeumannBoundary");
@@ -438,27 +626,33 @@ int main(int argc, char * argv[]) {
     neg_checker = cl::Kernel(program, "CheckNegativeValues");
     click_effect_tester = cl::Kernel(program, "ClickEffectTest");
     image_resetter = cl::Kernel(program, "ResetImage");
-    click_effecter = cl::Kernel(program, "ClickAddPressure");
-    dye_adder = cl::Kernel(program, "AddDye");
-    vel_adder = cl::Kernel(program, "AddVelocity");
+    splat_queue.Init(context, program);
+    adaptive_time_step.Init(context, program, REDUCTION_TILE);
+    active_tiles.Init(context, program, ACTIVE_TILE);
+    tracers.Init(context, program, tracer_count, width, height);
+    flip_solver.Init(context, program, SCAN_TILE, flip_ppc);
+    lattice_boltzmann.Init(context, program);
     gravitier = cl::Kernel(program, "ApplyGravity");
+    smoke_advecter = cl::Kernel(program, "AdvectSmoke");
     velocity_initializer = cl::Kernel(program, "VelocityInitializer");
 
+    // Pick the work-group sizes before the images are reset below
+    TuneWorkGroups(global_test, global_1D, retune);
+
 #ifdef RESET_TEXTURES
-    image_resetter(cl::EnqueueArgs(queue, global_test), target_texture).wait();
-    image_resetter(cl::EnqueueArgs(queue, global_test), new_vel).wait();
-    image_resetter(cl::EnqueueArgs(queue, global_test), velocity_divergence).wait();
-    image_resetter(cl::EnqueueArgs(queue, global_test), old_pressure).wait();
-    image_resetter(cl::EnqueueArgs(queue, global_test), new_pressure).wait();
-    image_resetter(cl::EnqueueArgs(queue, global_test), vorticity).wait();
+    image_resetter(TunedArgs("ResetImage", global_test), target_texture).wait();
+    image_resetter(TunedArgs("ResetImage", global_test), new_vel).wait();
+    image_resetter(TunedArgs("ResetImage", global_test), velocity_divergence).wait();
+    image_resetter(TunedArgs("ResetImage", global_test), old_pressure).wait();
+    image_resetter(TunedArgs("ResetImage", global_test), new_pressure).wait();
 #ifndef INITIALIZE_DYE_FROM_TEX
-    image_resetter(cl::EnqueueArgs(queue, global_test), dye_texture).wait();
+    image_resetter(TunedArgs("ResetImage", global_test), dye_texture).wait();
 #endif // !INITIALIZE_DYE_FROM_TEX
-    image_resetter(cl::EnqueueArgs(queue, global_test), dye_texture_new).wait();
+    image_resetter(TunedArgs("ResetImage", global_test), dye_texture_new).wait();
 #endif // RESET_TEXTURES
 
 #ifdef INITIALIZE_VEL
-    velocity_initializer(cl::EnqueueArgs(queue, global_test), target_texture).wait();
+    velocity_initializer(TunedArgs("VelocityInitializer", global_test), target_texture).wait();
 #endif // INITIALIZE_VEL
 
     // We have to generate the mipmaps again!!!
@@ -472,8 +666,6 @@ int main(int argc, char * argv[]) {
     glGenerateMipmap(GL_TEXTURE_2D);
     glBindTexture(GL_TEXTURE_2D, gl_pressure_new);
     glGenerateMipmap(GL_TEXTURE_2D);
-    glBindTexture(GL_TEXTURE_2D, gl_vorticity);
-    glGenerateMipmap(GL_TEXTURE_2D);
     glBindTexture(GL_TEXTURE_2D, gl_dye);
     glGenerateMipmap(GL_TEXTURE_2D);
     glBindTexture(GL_TEXTURE_2D, gl_dye_new);
@@ -508,8 +700,6 @@ int main(int argc, char * argv[]) {
     std::cout << "Releasing GL objects with err:\t" << err << std::endl;
     err = clEnqueueReleaseGLObjects(queue(), 1, &new_pressure(), 0, NULL, NULL);
     std::cout << "Releasing GL objects with err:\t" << err << std::endl;
-    err = clEnqueueReleaseGLObjects(queue(), 1, &vorticity(), 0, NULL, NULL);
-    std::cout << "Releasing GL objects with err:\t" << err << std::endl;
     err = clEnqueueReleaseGLObjects(queue(), 1, &dye_texture(), 0, NULL, NULL);
     std::cout << "Releasing GL objects with err:\t" << err << std::endl;
     err = clEnqueueReleaseGLObjects(queue(), 1, &dye_texture_new(), 0, NULL, NULL);
@@ -521,6 +711,101 @@ int main(int argc, char * argv[]) {
     err = clFinish(queue());
     std::cout << "Finished CL queue with err:\t" << err << std::endl;
 
+    // Benchmark runs instead of the interactive loop
+    if (benchmark_mode)
+    {
+        const int result = RunBenchmark(gui, benchmark_steps, benchmark_threshold, update_baselines);
+
+        gui.Cleanup();
+        glfwTerminate();
+
+        return result;
+    }
+
+    // Parameter sweeps run on every device instead of the interactive loop
+    if (!sweep_path.empty())
+    {
+        SweepSpec spec;
+        int result = EXIT_FAILURE;
+        if (spec.Load(sweep_path))
+        {
+            SweepScheduler scheduler(kernel_source, build_options, sweep_cpu_partitions);
+            scheduler.Run(spec);
+            scheduler.Report();
+            result = scheduler.WriteSummary(sweep_out) ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+
+        gui.Cleanup();
+        glfwTerminate();
+
+        return result;
+    }
+
+    // Large grids split over several devices, instead of the interactive loop
+    if (slab_size > 0)
+    {
+        const int result = RunSlabs(gui, slab_size, benchmark_steps, slab_devices, slab_cpu_partitions, build_options);
+
+        gui.Cleanup();
+        glfwTerminate();
+
+        return result;
+    }
+
+    // Ensemble runs instead of the interactive loop, the viscosity range defaults to the GUI viscosity
+    if (ensemble_members > 0)
+    {
+        if (ensemble_viscosity_min < 0.0f)
+            ensemble_viscosity_min = ensemble_viscosity_max = gui.viscosity;
+        const int result = RunEnsemble(gui, ensemble_members, ensemble_size, benchmark_steps, ensemble_viscosity_min, ensemble_viscosity_max, ensemble_out);
+
+        gui.Cleanup();
+        glfwTerminate();
+
+        return result;
+    }
+
+    // Resume a previous run
+    uint64_t step_count = 0;
+    if (!restart_path.empty())
+        RestoreCheckpoint(gui, restart_path, width, height, step_count);
+
+    // Checkpoints are read back into pinned memory and written by a background thread
+    const size_t field_size = static_cast<size_t>(width) * height * target_texture.getImageInfo<CL_IMAGE_ELEMENT_SIZE>();
+    const size_t smoke_field_size = static_cast<size_t>(width) * height * temperature.getImageInfo<CL_IMAGE_ELEMENT_SIZE>();
+    CheckpointWriter checkpoint_writer(context, queue, { field_size, field_size, field_size, smoke_field_size, smoke_field_size, obstacle_mask.GetSize() },
+        compress_checkpoints);
+
+    // Frames of the displayed field are read back into a ring of pinned buffers and encoded by a background thread
+    FrameCapture frame_capture(context, queue, width, height, capture_dir, capture_format);
+    gui.capture_enabled = capture_on_start;
+
+    // Every k-th step of velocity, pressure and dye is appended to a memory-mapped time-series file
+    std::unique_ptr<TimeSeriesWriter> series_writer;
+    if (!series_path.empty())
+        series_writer.reset(new TimeSeriesWriter(context, queue, program, series_path, width, height, series_capacity, series_half));
+    double sim_time = 0.0;
+
+    // Input is either recorded for a later replay, or replayed in place of the live input
+    InputRecorder input_recorder;
+    InputReplayer input_replayer;
+    if (!replay_path.empty())
+    {
+        if (!input_replayer.Load(replay_path))
+        {
+            gui.Cleanup();
+            glfwTerminate();
+
+            return EXIT_FAILURE;
+        }
+        replaying_input = true;
+        std::cout << "Replaying " << input_replayer.GetStepCount() << " steps of input from: " << replay_path << std::endl;
+    }
+    else if (!record_path.empty())
+        recorder_pointer = &input_recorder;
+    const std::chrono::steady_clock::time_point replay_start = std::chrono::steady_clock::now();
+    uint64_t replayed_steps = 0;
+
     // Initialize Timer
     main_timer.Init();
 
@@ -539,6 +824,24 @@ int main(int argc, char * argv[]) {
         float time_step = (gui.std_timestep) ? 1.0f : main_timer.GetDeltaTime();
 #endif // STD_TIMESTEP
 
+        // Feed the recorded input of this step, including the time step it was taken with
+        if (replaying_input)
+        {
+            if (input_replayer.IsFinished())
+                break;
+
+            time_step = input_replayer.ApplyStep(gui);
+            replayed_steps++;
+        }
+        else if (recorder_pointer)
+            recorder_pointer->RecordParameters(gui);
+
+        // Substeps honoring the CFL number, planned with the maximum speed of the previous frame. Replays
+        // take the recorded substeps one per frame instead.
+        int substeps = 1;
+        if (gui.adaptive_timestep && !replaying_input)
+            time_step = adaptive_time_step.Plan(time_step, gui.cfl_number, gui.dx, max_substeps, substeps);
+
         // Background Fill Color
         glClearColor(0.25f, 0.25f, 0.25f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT);
@@ -549,7 +852,6 @@ int main(int argc, char * argv[]) {
 
         // Image Copy parameters
         static const size_t imageSize[3] = { width, height, 1 };
-        static const size_t imageOrigin[3] = { 0, 0, 0 };
 
         // Acquire shared objects
         err = clEnqueueAcquireGLObjects(queue(), 1, &init_texture(), 0, NULL, NULL);
@@ -558,278 +860,70 @@ int main(int argc, char * argv[]) {
         err = clEnqueueAcquireGLObjects(queue(), 1, &velocity_divergence(), 0, NULL, NULL);
         err = clEnqueueAcquireGLObjects(queue(), 1, &old_pressure(), 0, NULL, NULL);
         err = clEnqueueAcquireGLObjects(queue(), 1, &new_pressure(), 0, NULL, NULL);
-        err = clEnqueueAcquireGLObjects(queue(), 1, &vorticity(), 0, NULL, NULL);
         err = clEnqueueAcquireGLObjects(queue(), 1, &dye_texture(), 0, NULL, NULL);
         err = clEnqueueAcquireGLObjects(queue(), 1, &dye_texture_new(), 0, NULL, NULL);
         err = clEnqueueAcquireGLObjects(queue(), 1, &display_texture(), 0, NULL, NULL);
 
-        // Reset simulation
-        if (gui.reset_pressed)
-        {
-            image_resetter(cl::EnqueueArgs(queue, global_test), target_texture).wait();
-            image_resetter(cl::EnqueueArgs(queue, global_test), new_vel).wait();
-            image_resetter(cl::EnqueueArgs(queue, global_test), velocity_divergence).wait();
-            image_resetter(cl::EnqueueArgs(queue, global_test), old_pressure).wait();
-            image_resetter(cl::EnqueueArgs(queue, global_test), new_pressure).wait();
-            image_resetter(cl::EnqueueArgs(queue, global_test), vorticity).wait();
-            image_resetter(cl::EnqueueArgs(queue, global_test), dye_texture).wait();
-            image_resetter(cl::EnqueueArgs(queue, global_test), dye_texture_new).wait();
-
-#ifdef INITIALIZE_VEL
-            velocity_initializer(cl::EnqueueArgs(queue, global_test), target_texture).wait();
-            velocity_initializer(cl::EnqueueArgs(queue, global_test), new_vel).wait();
-            /*velocity_initializer(cl::EnqueueArgs(queue, global_test), dye_texture).wait();
-            velocity_initializer(cl::EnqueueArgs(queue, global_test), dye_texture).wait();*/
-#endif // INITIALIZE_VEL
-
-#ifdef INITIALIZE_DYE_FROM_TEX
-            clEnqueueCopyImage(queue(), init_texture(), dye_texture(), imageOrigin, imageOrigin, imageSize, 0, NULL, NULL);
-#endif // INITIALIZE_DYE_FROM_TEX
-
-            gui.reset_pressed = false;
-        }
-
-#ifndef DISABLE_SIM
-        // ****************************************************************************************
-        // Add Dye or Force
-        // ****************************************************************************************
-
-        // Random force
-        if (gui.IsForceEnabled())
-        {
-            force_randomizer(cl::EnqueueArgs(queue, global_test), gui.GetForceScale(), gui.GetForceDirFlag(), target_texture, new_vel).wait();
-            //tex_copier(cl::EnqueueArgs(queue, global_test), new_vel, target_texture).wait();
-            clEnqueueCopyImage(queue(), new_vel(), target_texture(), imageOrigin, imageOrigin, imageSize, 0, NULL, NULL);
-            //force_randomizer(cl::EnqueueArgs(queue, global_test), gui.GetForceScale(), old_pressure, new_pressure).wait();
-            //tex_copier(cl::EnqueueArgs(queue, global_test), old_pressure, new_pressure).wait();
-
-            gui.ResetForceEnabled();
-        }
-
-        // Gravity
-        if (gui.apply_gravity)
+        // Run the steps of the simulation for this frame
+        StepTimings timings;
+        const uint64_t frame_start_step = step_count;
+        for (int substep = 0; substep < substeps; substep++)
         {
-            gravitier(cl::EnqueueArgs(queue, global_test), time_step, target_texture, new_vel).wait();
-            clEnqueueCopyImage(queue(), new_vel(), target_texture(), imageOrigin, imageOrigin, imageSize, 0, NULL, NULL);
-        }
+            StepSimulation(gui, step_count, time_step, global_test, global_1D, imageSize, timings);
+            step_count++;
+            sim_time += time_step;
 
-        // Click adder
-        if (gui.clicked && gui.clicking_enabled)
-        {
-            // Velocity adder
-            /*if (gui.click_mode == VELOCITY_MODE)
-                dye_adder(cl::EnqueueArgs(queue, single_thread), static_cast<int>(gui.mouse_xpos), static_cast<int>(gui.mouse_ypos), gui.GetForceScale(), gui.dye_extreme_mode, target_texture).wait();*/
-            if (gui.click_mode == VELOCITY_MODE)
+            if (recorder_pointer)
             {
-                vel_adder(cl::EnqueueArgs(queue, single_thread), static_cast<int>(gui.mouse_xpos), static_cast<int>(gui.mouse_ypos), static_cast<int>(gui.mouse_prev_xpos), static_cast<int>(gui.mouse_prev_ypos), gui.GetForceScale(), gui.dye_extreme_mode, gui.normalize_vel_dir, target_texture, new_vel).wait();
-                clEnqueueCopyImage(queue(), new_vel(), target_texture(), imageOrigin, imageOrigin, imageSize, 0, NULL, NULL);
+                recorder_pointer->Snapshot(gui);
+                recorder_pointer->EndStep(time_step);
             }
-            // Dye adder
-            else
-                dye_adder(cl::EnqueueArgs(queue, single_thread), static_cast<int>(gui.mouse_xpos), static_cast<int>(gui.mouse_ypos), gui.GetForceScale(), gui.dye_extreme_mode, dye_texture).wait();
         }
 
-        // ****************************************************************************************
-        // Advect Velocity
-        // ****************************************************************************************
-        advecter(cl::EnqueueArgs(queue, global_test), time_step, 1.0f / gui.dx, 1.0f, target_texture, target_texture, new_vel).wait();
-        //advecter(cl::EnqueueArgs(queue, global_test), time_step, 1.0f, 1.0f, target_texture, target_texture, new_vel).wait();
-        //tex_copier(cl::EnqueueArgs(queue, global_test), new_vel, target_texture).wait();
-        clEnqueueCopyImage(queue(), new_vel(), target_texture(), imageOrigin, imageOrigin, imageSize, 0, NULL, NULL);
-
-#ifdef NEUMANN_BOUND
-        boundarier(cl::EnqueueArgs(queue, global_1D), -1.0f, target_texture, new_vel).wait();
-        //tex_copier(cl::EnqueueArgs(queue, global_test), new_vel, target_texture).wait();
-        clEnqueueCopyImage(queue(), new_vel(), target_texture(), imageOrigin, imageOrigin, imageSize, 0, NULL, NULL);
-#else
-        boundarier(cl::EnqueueArgs(queue, global_test), -1.0f, target_texture, new_vel).wait();
-        //tex_copier(cl::EnqueueArgs(queue, global_test), new_vel, target_texture).wait();
-        clEnqueueCopyImage(queue(), new_vel(), target_texture(), imageOrigin, imageOrigin, imageSize, 0, NULL, NULL);
-#endif // NEUMANN_BOUND
-
-        // ****************************************************************************************
-        // Project divergent velocity into divergence-free field
-        // ****************************************************************************************
-
-        // Divergence of velocity field
-        divergencer(cl::EnqueueArgs(queue, global_test), 0.5f / gui.dx, target_texture, velocity_divergence).wait();
-        //divergencer(cl::EnqueueArgs(queue, global_test), 0.5f, target_texture, velocity_divergence).wait();
-
-        // Pressure disturbance
-#ifdef RESET_PRESSURE_EACH_ITER
-        image_resetter(cl::EnqueueArgs(queue, global_test), old_pressure).wait();
-        image_resetter(cl::EnqueueArgs(queue, global_test), new_pressure).wait();
-#endif // RESET_PRESSURE_EACH_ITER
-
-        static std::chrono::time_point<std::chrono::system_clock> start, end;
+        // Read back without waiting, the result is used by the next frame
+        if (gui.adaptive_timestep)
+            adaptive_time_step.Measure(queue, target_texture);
 
-        start = std::chrono::system_clock::now();
+        // Tracers move once per frame, over the time of all substeps
+        if (gui.show_tracers)
+            tracers.Step(queue, target_texture, time_step * substeps, 1.0f / gui.dx, gui.tracer_life, step_count, obstacle_mask.GetBuffer(), obstacle_mask.GetPitch());
 
-        for (int i = 0; i < JACOBI_REPS; i++)
+        // The output below fires when the substeps of this frame passed a multiple of its interval
+        // Checkpoint, skipped while the previous one is still being written
+        if (gui.checkpoint_pressed || (checkpoint_every > 0 && step_count / checkpoint_every != frame_start_step / checkpoint_every))
         {
-//#ifdef NEUMANN_BOUND
-//            boundarier(cl::EnqueueArgs(queue, global_1D), 1.0f, old_pressure, new_pressure).wait();
-//            //tex_copier(cl::EnqueueArgs(queue, global_test), new_pressure, old_pressure).wait();
-//            clEnqueueCopyImage(queue(), new_pressure(), old_pressure(), imageOrigin, imageOrigin, imageSize, 0, NULL, NULL);
-//#else
-//            boundarier(cl::EnqueueArgs(queue, global_test), 1.0f, old_pressure, new_pressure).wait();
-//            //tex_copier(cl::EnqueueArgs(queue, global_test), new_pressure, old_pressure).wait();
-//            clEnqueueCopyImage(queue(), new_pressure(), old_pressure(), imageOrigin, imageOrigin, imageSize, 0, NULL, NULL);
-//#endif // NEUMANN_BOUND
+            const std::vector<cl::Image2D> fields{ target_texture, old_pressure, dye_texture, temperature, smoke_density };
+            const std::vector<cl::Buffer> buffer_fields{ obstacle_mask.GetBuffer() };
+            if (!checkpoint_writer.Write(checkpoint_path, MakeCheckpointHeader(gui, step_count, width, height), fields, buffer_fields))
+                std::cout << "Checkpoint writer busy, skipping step " << step_count << std::endl;
 
-            jacobier(cl::EnqueueArgs(queue, global_test), -1.0f, 0.25f, old_pressure, velocity_divergence, new_pressure).wait();
-            //tex_copier(cl::EnqueueArgs(queue, global_test), new_pressure, old_pressure).wait();
-            clEnqueueCopyImage(queue(), new_pressure(), old_pressure(), imageOrigin, imageOrigin, imageSize, 0, NULL, NULL);
-
-#ifdef NEUMANN_BOUND
-            boundarier(cl::EnqueueArgs(queue, global_1D), 1.0f, old_pressure, new_pressure).wait();
-            //tex_copier(cl::EnqueueArgs(queue, global_test), new_pressure, old_pressure).wait();
-            clEnqueueCopyImage(queue(), new_pressure(), old_pressure(), imageOrigin, imageOrigin, imageSize, 0, NULL, NULL);
-#else
-            boundarier(cl::EnqueueArgs(queue, global_test), 1.0f, old_pressure, new_pressure).wait();
-            //tex_copier(cl::EnqueueArgs(queue, global_test), new_pressure, old_pressure).wait();
-            clEnqueueCopyImage(queue(), new_pressure(), old_pressure(), imageOrigin, imageOrigin, imageSize, 0, NULL, NULL);
-#endif // NEUMANN_BOUND
+            gui.checkpoint_pressed = false;
         }
 
-        end = std::chrono::system_clock::now();
-
-        std::chrono::duration<double> elapsed_seconds = end - start;
-        std::time_t end_time = std::chrono::system_clock::to_time_t(end);
-
-        std::cout << "Pressure Jacobi elapsed time: " << elapsed_seconds.count() << "s\n";
-
-        // Subtract gradient(p) from u to get divergence-free velocity field
-        gradienter(cl::EnqueueArgs(queue, global_test), 0.5f / gui.dx, old_pressure, target_texture, new_vel).wait();
-        //gradienter(cl::EnqueueArgs(queue, global_test), 0.5f, old_pressure, target_texture, new_vel).wait();
-        ////tex_copier(cl::EnqueueArgs(queue, global_test), new_vel, target_texture).wait();
-        clEnqueueCopyImage(queue(), new_vel(), target_texture(), imageOrigin, imageOrigin, imageSize, 0, NULL, NULL);
-
-        // ****************************************************************************************
-        // Bound Velocity
-        // ****************************************************************************************
-#ifdef NEUMANN_BOUND
-        boundarier(cl::EnqueueArgs(queue, global_1D), -1.0f, target_texture, new_vel).wait();
-        //tex_copier(cl::EnqueueArgs(queue, global_test), new_vel, target_texture).wait();
-        clEnqueueCopyImage(queue(), new_vel(), target_texture(), imageOrigin, imageOrigin, imageSize, 0, NULL, NULL);
-#else
-        boundarier(cl::EnqueueArgs(queue, global_test), -1.0f, target_texture, new_vel).wait();
-        //tex_copier(cl::EnqueueArgs(queue, global_test), new_vel, target_texture).wait();
-        clEnqueueCopyImage(queue(), new_vel(), target_texture(), imageOrigin, imageOrigin, imageSize, 0, NULL, NULL);
-#endif // NEUMANN_BOUND
-
-        // ****************************************************************************************
-        // Diffusion for viscous fluid
-        // ****************************************************************************************
-        float centerFactor = 1.0f / (gui.viscosity * time_step);
-        float stencilFactor = 1.0f / (4.0f + centerFactor);
-        if (gui.viscosity > 0.0f)
+        // Capture the displayed field, dropped instead of waiting when the writer falls behind
+        if (gui.capture_enabled && step_count / capture_every != frame_start_step / capture_every)
         {
-            static std::chrono::time_point<std::chrono::system_clock> start, end;
-
-            start = std::chrono::system_clock::now();
-            for (int i = 0; i < JACOBI_REPS; i++)
-            {
-                jacobier(cl::EnqueueArgs(queue, global_test), centerFactor, stencilFactor, target_texture, target_texture, new_vel).wait();
-                //tex_copier(cl::EnqueueArgs(queue, global_test), new_vel, target_texture).wait();
-                clEnqueueCopyImage(queue(), new_vel(), target_texture(), imageOrigin, imageOrigin, imageSize, 0, NULL, NULL);
-            }
-
-            end = std::chrono::system_clock::now();
-
-            std::chrono::duration<double> elapsed_seconds = end - start;
-            std::time_t end_time = std::chrono::system_clock::to_time_t(end);
-
-            std::cout << "Diffusion Jacobi elapsed time: " << elapsed_seconds.count() << "s\n";
+            if (selectables[gui.selected_index] == DYE)
+                frame_capture.Capture(dye_texture, step_count);
+            else if (selectables[gui.selected_index] == VELOCITY)
+                frame_capture.Capture(target_texture, step_count);
+            else if (selectables[gui.selected_index] == PRESSURE)
+                frame_capture.Capture(old_pressure, step_count);
         }
 
-        // ****************************************************************************************
-        // Bound Velocity
-        // ****************************************************************************************
-#ifdef NEUMANN_BOUND
-        boundarier(cl::EnqueueArgs(queue, global_1D), -1.0f, target_texture, new_vel).wait();
-        //tex_copier(cl::EnqueueArgs(queue, global_test), new_vel, target_texture).wait();
-        clEnqueueCopyImage(queue(), new_vel(), target_texture(), imageOrigin, imageOrigin, imageSize, 0, NULL, NULL);
-#else
-        boundarier(cl::EnqueueArgs(queue, global_test), -1.0f, target_texture, new_vel).wait();
-        //tex_copier(cl::EnqueueArgs(queue, global_test), new_vel, target_texture).wait();
-        clEnqueueCopyImage(queue(), new_vel(), target_texture(), imageOrigin, imageOrigin, imageSize, 0, NULL, NULL);
-#endif // NEUMANN_BOUND
-
-        // ****************************************************************************************
-        // Vorticity
-        // ****************************************************************************************
-#ifdef VORTICITY
-        vorticitier(cl::EnqueueArgs(queue, global_test), 0.5f / gui.dx, target_texture, vorticity).wait();
-
-#ifdef NEUMANN_BOUND
-        boundarier(cl::EnqueueArgs(queue, global_1D), -1.0f, target_texture, new_vel).wait();
-        //tex_copier(cl::EnqueueArgs(queue, global_test), new_vel, target_texture).wait();
-        clEnqueueCopyImage(queue(), new_vel(), target_texture(), imageOrigin, imageOrigin, imageSize, 0, NULL, NULL);
-#else
-        boundarier(cl::EnqueueArgs(queue, global_test), -1.0f, target_texture, new_vel).wait();
-        //tex_copier(cl::EnqueueArgs(queue, global_test), new_vel, target_texture).wait();
-        clEnqueueCopyImage(queue(), new_vel(), target_texture(), imageOrigin, imageOrigin, imageSize, 0, NULL, NULL);
-#endif // NEUMANN_BOUND
-
-        vorticity_confiner(cl::EnqueueArgs(queue, global_test), 0.5f / gui.dx, time_step, 0.035f, 0.035f, vorticity, target_texture, new_vel).wait();
-        //tex_copier(cl::EnqueueArgs(queue, global_test), new_vel, target_texture).wait();
-        clEnqueueCopyImage(queue(), new_vel(), target_texture(), imageOrigin, imageOrigin, imageSize, 0, NULL, NULL);
-#endif // VORTICITY
-
-        // ****************************************************************************************
-        // Advect Dye
-        // ****************************************************************************************
-        //advecter(cl::EnqueueArgs(queue, global_test), time_step, 1.0f / gui.dx, 0.995f, target_texture, dye_texture, dye_texture_new).wait();
-        //advecter(cl::EnqueueArgs(queue, global_test), time_step, 1.0f / gui.dx, 1.0f, target_texture, dye_texture, dye_texture_new).wait();
-        //advecter(cl::EnqueueArgs(queue, global_test), time_step, 1.0f, 1.0f, target_texture, dye_texture, dye_texture_new).wait();
-        advecter(cl::EnqueueArgs(queue, global_test), time_step, 1.0f / gui.dx, 1.0f, target_texture, dye_texture, dye_texture_new).wait();
-        //tex_copier(cl::EnqueueArgs(queue, global_test), dye_texture_new, dye_texture).wait();
-        clEnqueueCopyImage(queue(), dye_texture_new(), dye_texture(), imageOrigin, imageOrigin, imageSize, 0, NULL, NULL);
-
-        // ****************************************************************************************
-        // Bound Dye
-        // ****************************************************************************************
-#ifdef NEUMANN_BOUND
-        boundarier(cl::EnqueueArgs(queue, global_1D), 0.0f, dye_texture, dye_texture_new).wait();
-        //tex_copier(cl::EnqueueArgs(queue, global_test), dye_texture_new, dye_texture).wait();
-        clEnqueueCopyImage(queue(), dye_texture_new(), dye_texture(), imageOrigin, imageOrigin, imageSize, 0, NULL, NULL);
-#else
-        boundarier(cl::EnqueueArgs(queue, global_test), 0.0f, dye_texture, dye_texture_new).wait();
-        //tex_copier(cl::EnqueueArgs(queue, global_test), dye_texture_new, dye_texture).wait();
-        clEnqueueCopyImage(queue(), dye_texture_new(), dye_texture(), imageOrigin, imageOrigin, imageSize, 0, NULL, NULL);
-#endif // NEUMANN_BOUND
-
-        //// ****************************************************************************************
-        //// Diffusion for dye
-        //// ****************************************************************************************
-        //centerFactor = 1.0f / (gui.viscosity * time_step);
-        //stencilFactor = 1.0f / (4.0f + centerFactor);
-        //for (int i = 0; i < JACOBI_REPS; i++)
-        //{
-        //    //jacobier(cl::EnqueueArgs(queue, global_test), centerFactor, stencilFactor, dye_texture, target_texture, dye_texture_new).wait();
-        //    jacobier(cl::EnqueueArgs(queue, global_test), centerFactor, stencilFactor, dye_texture, dye_texture, dye_texture_new).wait();
-        //    //tex_copier(cl::EnqueueArgs(queue, global_test), dye_texture_new, dye_texture).wait();
-        //    clEnqueueCopyImage(queue(), dye_texture_new(), dye_texture(), imageOrigin, imageOrigin, imageSize, 0, NULL, NULL);
-        //}
-
-//        // ****************************************************************************************
-//        // Bound Dye
-//        // ****************************************************************************************
-//#ifdef NEUMANN_BOUND
-//        boundarier(cl::EnqueueArgs(queue, global_1D), 0.0f, dye_texture, dye_texture_new).wait();
-//        //tex_copier(cl::EnqueueArgs(queue, global_test), dye_texture_new, dye_texture).wait();
-//        clEnqueueCopyImage(queue(), dye_texture_new(), dye_texture(), imageOrigin, imageOrigin, imageSize, 0, NULL, NULL);
-//#else
-//        boundarier(cl::EnqueueArgs(queue, global_test), 0.0f, dye_texture, dye_texture_new).wait();
-//        //tex_copier(cl::EnqueueArgs(queue, global_test), dye_texture_new, dye_texture).wait();
-//        clEnqueueCopyImage(queue(), dye_texture_new(), dye_texture(), imageOrigin, imageOrigin, imageSize, 0, NULL, NULL);
-//#endif // NEUMANN_BOUND
+        // Time-series output, transferred straight into the file mapping
+        if (series_writer && series_writer->IsOpen() && step_count / series_every != frame_start_step / series_every)
+        {
+            series_writer->Append(target_texture, SERIES_VELOCITY, step_count, sim_time);
+            series_writer->Append(old_pressure, SERIES_PRESSURE, step_count, sim_time);
+            series_writer->Append(dye_texture, SERIES_DYE, step_count, sim_time);
+        }
 
-        // Display stuff
-        mixer(cl::EnqueueArgs(queue, global_test), gui.GetMixBias(), new_vel, new_pressure, display_texture).wait();
-        //display_converter(cl::EnqueueArgs(queue, global_test), new_vel, display_texture).wait();
-#endif // DISABLE_SIM
+        std::cout << "Pressure Jacobi elapsed time: " << timings.pressure << "s\n";
+        if (substeps > 1)
+            std::cout << "CFL substeps: " << substeps << " at max speed " << adaptive_time_step.GetMaxSpeed() << "\n";
+        if (gui.viscosity > 0.0f)
+            std::cout << "Diffusion Jacobi elapsed time: " << timings.diffusion << "s\n";
 
         // Release shared objects
         err = clEnqueueReleaseGLObjects(queue(), 1, &init_texture(), 0, NULL, NULL);
@@ -838,7 +932,6 @@ int main(int argc, char * argv[]) {
         err = clEnqueueReleaseGLObjects(queue(), 1, &velocity_divergence(), 0, NULL, NULL);
         err = clEnqueueReleaseGLObjects(queue(), 1, &old_pressure(), 0, NULL, NULL);
         err = clEnqueueReleaseGLObjects(queue(), 1, &new_pressure(), 0, NULL, NULL);
-        err = clEnqueueReleaseGLObjects(queue(), 1, &vorticity(), 0, NULL, NULL);
         err = clEnqueueReleaseGLObjects(queue(), 1, &dye_texture(), 0, NULL, NULL);
         err = clEnqueueReleaseGLObjects(queue(), 1, &dye_texture_new(), 0, NULL, NULL);
         err = clEnqueueReleaseGLObjects(queue(), 1, &display_texture(), 0, NULL, NULL);
@@ -846,11 +939,21 @@ int main(int argc, char * argv[]) {
         // Flush CL queue
         err = clFinish(queue());
 
+        // Publish the time-series frames transferred this step
+        if (series_writer)
+            series_writer->Commit();
+
+        // Nothing is drawn without a visible window
+        if (headless)
+        {
+            glfwPollEvents();
+            continue;
+        }
+
         // bind Texture
         //glBindTexture(GL_TEXTURE_2D, gl_texture);
         //glBindTexture(GL_TEXTURE_2D, gl_texture_new);
         //glBindTexture(GL_TEXTURE_2D, gl_pressure_old);
-        //glBindTexture(GL_TEXTURE_2D, gl_vorticity);
         //glBindTexture(GL_TEXTURE_2D, gl_display);
 
         /*if (selectables[gui.selected_index] == DYE)
@@ -881,6 +984,21 @@ int main(int argc, char * argv[]) {
         glBlitFramebuffer(0, 0, width, height, 0, 0, width, height,
             GL_COLOR_BUFFER_BIT, GL_NEAREST);
 
+        // Tracers over the blitted field, in grid coordinates
+        if (gui.show_tracers && tracers.IsEnabled())
+        {
+            glViewport(0, 0, width, height);
+            glEnable(GL_BLEND);
+            glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+            tracer_shader.use();
+            tracer_shader.setFloat("width", static_cast<float>(width));
+            tracer_shader.setFloat("height", static_cast<float>(height));
+            tracer_shader.setFloat("max_age", gui.tracer_life);
+            tracers.Draw();
+            glDisable(GL_BLEND);
+            glViewport(0, 0, mWidth, mHeight);
+        }
+
         // render container
         /*simple_shader.use();
         glBindVertexArray(VAO);
@@ -898,10 +1016,24 @@ int main(int argc, char * argv[]) {
         glfwPollEvents();
     }
 
+    // Finish the checkpoint in flight
+    checkpoint_writer.Wait();
+
+    if (replaying_input)
+    {
+        const double replay_time = SecondsSince(replay_start);
+        std::cout << "Replayed " << replayed_steps << " steps in " << replay_time << "s ("
+            << replayed_steps / replay_time << " steps/s)" << std::endl;
+    }
+
+    if (recorder_pointer)
+        recorder_pointer->Save(record_path);
+
     // Cleanup GUI
     gui.Cleanup();
 
     // Clear buffers
+    tracers.Cleanup();
     glDeleteVertexArrays(1, &VAO);
     glDeleteBuffers(1, &VBO);
     glDeleteBuffers(1, &EBO);
@@ -912,79 +1044,1126 @@ int main(int argc, char * argv[]) {
 }
 
 /// <summary>
-/// Callback function for mouse cursor movement
+/// Launch arguments using the tuned work-group size of the kernel
 /// </summary>
-/// <param name="window"></param>
-/// <param name="xpos"></param>
-/// <param name="ypos"></param>
-void CursorPositionCallback(GLFWwindow* window, double xpos, double ypos)
+/// <param name="kernel_name"></param>
+/// <param name="global"></param>
+/// <returns>: the arguments</returns>
+cl::EnqueueArgs TunedArgs(const char* kernel_name, const cl::NDRange& global)
 {
-    gui_pointer->MousePositionUpdate(xpos, ypos);
-
-    ImGui_ImplGlfw_CursorPosCallback(window, xpos, ypos);
+    return cl::EnqueueArgs(queue, global, autotuner.Local(kernel_name, global));
 }
 
 /// <summary>
-/// Callback function for mouse button press
+/// Tune the work-group size of every kernel launched per step that has no stored result.
+/// Scratch images are used as outputs, so this has to run before the images are reset.
 /// </summary>
-/// <param name="window"></param>
-/// <param name="button"></param>
-/// <param name="action"></param>
-/// <param name="mods"></param>
-void MouseButtonCallback(GLFWwindow* window, int button, int action, int mods)
+/// <param name="global_test">: 2D range covering the whole grid</param>
+/// <param name="global_1D">: 1D range used by the boundary kernel</param>
+/// <param name="retune">: tune all kernels again, ignoring the stored results</param>
+void TuneWorkGroups(const cl::NDRange& global_test, const cl::NDRange& global_1D, bool retune)
 {
-    if (!gui_pointer->clicked && button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS)
+    struct TuningJob
     {
-        std::cout << "MOUSE CLICK on x: " << gui_pointer->mouse_xpos << " y: " << gui_pointer->mouse_ypos << std::endl;
-        gui_pointer->clicked = true;
-    }
-    else if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_RELEASE)
+        const char* name;
+        cl::NDRange global;
+        std::function<void(const cl::NDRange&)> launch;
+    };
+
+#ifdef NEUMANN_BOUND
+    const cl::NDRange& boundary_range = global_1D;
+#else
+    const cl::NDRange& boundary_range = global_test;
+#endif // NEUMANN_BOUND
+
+    const std::vector<TuningJob> jobs = {
+        { "AdvectFluid", global_test, [&](const cl::NDRange& local) { advecter(cl::EnqueueArgs(queue, global_test, local), 1.0f, 1.0f, 1.0f, 1, target_texture, target_texture, new_vel, obstacle_mask.GetBuffer(), obstacle_mask.GetPitch()).wait(); } },
+        { "AdvectFields", global_test, [&](const cl::NDRange& local) { field_advecter(cl::EnqueueArgs(queue, global_test, local), 1.0f, 1.0f, 1.0f, 1, 2, target_texture, target_texture, new_vel, dye_texture, dye_texture_new,
+            advection_scratch, advection_scratch, advection_scratch, advection_scratch, obstacle_mask.GetBuffer(), obstacle_mask.GetPitch()).wait(); } },
+        { "AdvectMacCormack", global_test, [&](const cl::NDRange& local) { maccormack_advecter(cl::EnqueueArgs(queue, global_test, local), 1.0f, 1.0f, 1.0f, 1, target_texture, target_texture, new_vel, advection_scratch, obstacle_mask.GetBuffer(), obstacle_mask.GetPitch()).wait(); } },
+        { "Divergence", global_test, [&](const cl::NDRange& local) { divergencer(cl::EnqueueArgs(queue, global_test, local), 0.5f, target_texture, velocity_divergence, obstacle_mask.GetBuffer(), obstacle_mask.GetPitch()).wait(); } },
+        { "Jacobi", global_test, [&](const cl::NDRange& local) { jacobier(cl::EnqueueArgs(queue, global_test, local), -1.0f, 0.25f, old_pressure, velocity_divergence, new_pressure, obstacle_mask.GetBuffer(), obstacle_mask.GetPitch()).wait(); } },
+        { "Gradient", global_test, [&](const cl::NDRange& local) { gradienter(cl::EnqueueArgs(queue, global_test, local), 0.5f, old_pressure, target_texture, new_vel, obstacle_mask.GetBuffer(), obstacle_mask.GetPitch()).wait(); } },
+        { "JacobiDivergence", global_test, [&](const cl::NDRange& local) { jacobi_divergencer(cl::EnqueueArgs(queue, global_test, local), 0.5f, -1.0f, 0.25f, old_pressure, target_texture, new_pressure, velocity_divergence, obstacle_mask.GetBuffer(), obstacle_mask.GetPitch()).wait(); } },
+        { "GradientBoundary", global_test, [&](const cl::NDRange& local) { gradient_bounder(cl::EnqueueArgs(queue, global_test, local), 0.5f, -1.0f, old_pressure, target_texture, new_vel, obstacle_mask.GetBuffer(), obstacle_mask.GetPitch()).wait(); } },
+        { "DivergenceStaggered", global_test, [&](const cl::NDRange& local) { staggered_divergencer(cl::EnqueueArgs(queue, global_test, local), 1.0f, face_u, face_v, velocity_divergence).wait(); } },
+        { "JacobiStaggered", global_test, [&](const cl::NDRange& local) { staggered_jacobier(cl::EnqueueArgs(queue, global_test, local), -1.0f, 0.25f, old_pressure, velocity_divergence, new_pressure, obstacle_mask.GetBuffer(), obstacle_mask.GetPitch()).wait(); } },
+        { "FacesToCenters", global_test, [&](const cl::NDRange& local) { faces_to_centerer(cl::EnqueueArgs(queue, global_test, local), face_u, face_v, target_texture, new_vel).wait(); } },
+        { boundary_kernel_name, boundary_range, [&](const cl::NDRange& local) { boundarier(cl::EnqueueArgs(queue, boundary_range, local), -1.0f, target_texture, new_vel).wait(); } },
+        { "Mix", global_test, [&](const cl::NDRange& local) { mixer(cl::EnqueueArgs(queue, global_test, local), 0.5f, new_vel, new_pressure, display_texture).wait(); } },
+        { "ApplyGravity", global_test, [&](const cl::NDRange& local) { gravitier(cl::EnqueueArgs(queue, global_test, local), 1.0f, target_texture, new_vel).wait(); } },
+        { "AdvectSmoke", global_test, [&](const cl::NDRange& local) { smoke_advecter(cl::EnqueueArgs(queue, global_test, local), 1.0f, 1.0f, 1, 1.0f, 0.05f, 1.0f, cl_float4{ { 0.0f, 0.0f, 0.0f, 0.0f } },
+            target_texture, dye_texture, dye_texture_new, temperature, temperature_new, smoke_density, smoke_density_new, new_vel, obstacle_mask.GetBuffer(), obstacle_mask.GetPitch()).wait(); } },
+        { "RandomForce", global_test, [&](const cl::NDRange& local) { force_randomizer(cl::EnqueueArgs(queue, global_test, local), 0.5f, 0, 0, target_texture, new_vel).wait(); } },
+        { "ResetImage", global_test, [&](const cl::NDRange& local) { image_resetter(cl::EnqueueArgs(queue, global_test, local), display_texture).wait(); } }
+    };
+
+    bool tuned_any = false;
+    for (size_t i = 0; i < jobs.size(); i++)
     {
-        std::cout << "MOUSE RELEASE on x: " << gui_pointer->mouse_xpos << " y: " << gui_pointer->mouse_ypos << std::endl;
-        gui_pointer->clicked = false;
+        if (!retune && autotuner.IsTuned(jobs[i].name))
+            continue;
+
+        autotuner.Tune(program, jobs[i].name, jobs[i].global, jobs[i].launch);
+        tuned_any = true;
     }
 
-    ImGui_ImplGlfw_MouseButtonCallback(window, button, action, mods);
+    if (tuned_any)
+        autotuner.Save();
 }
 
 /// <summary>
-/// Callback Function for keyboard button press
+/// Advance the simulation by one step using the global images and kernels
 /// </summary>
-/// <param name="window"></param>
-/// <param name="key"></param>
-/// <param name="scancode"></param>
-/// <param name="action"></param>
-/// <param name="mods"></param>
-void KeyboardCallback(GLFWwindow* window, int key, int scancode, int action, int mods)
+/// <param name="gui">: source of the simulation parameters and input</param>
+/// <param name="step">: index of the step, keys the random numbers drawn in it</param>
+/// <param name="time_step"></param>
+/// <param name="global_test">: 2D range covering the whole grid</param>
+/// <param name="global_1D">: 1D range used by the boundary kernel</param>
+/// <param name="imageSize">: region of the images</param>
+/// <param name="timings">: filled with the time spent in each phase</param>
+void StepSimulation(GUI& gui, uint64_t step, float time_step, const cl::NDRange& global_test, const cl::NDRange& global_1D, const size_t* imageSize, StepTimings& timings)
 {
-    // Enable/Disable Cursor
-    if (key == GLFW_KEY_SPACE && action == GLFW_PRESS)
-    {
-        if (gui_pointer->cursor_enabled)
-            glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
-        else
-            glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_CAPTURED);
+    static const size_t imageOrigin[3] = { 0, 0, 0 };
 
-        gui_pointer->cursor_enabled = !gui_pointer->cursor_enabled;
-    }
-    // Enable/Disable Viewport clicking
-    else if (key == GLFW_KEY_G && action == GLFW_PRESS)
-    {
-        gui_pointer->clicking_enabled = !gui_pointer->clicking_enabled;
-    }
     // Reset simulation
-    else if (key == GLFW_KEY_R && action == GLFW_PRESS)
+    if (gui.reset_pressed)
     {
-        gui_pointer->reset_pressed = true;
+        image_resetter(TunedArgs("ResetImage", global_test), target_texture).wait();
+        image_resetter(TunedArgs("ResetImage", global_test), new_vel).wait();
+        image_resetter(TunedArgs("ResetImage", global_test), velocity_divergence).wait();
+        image_resetter(TunedArgs("ResetImage", global_test), old_pressure).wait();
+        image_resetter(TunedArgs("ResetImage", global_test), new_pressure).wait();
+        image_resetter(TunedArgs("ResetImage", global_test), dye_texture).wait();
+        image_resetter(TunedArgs("ResetImage", global_test), dye_texture_new).wait();
+        image_resetter(TunedArgs("ResetImage", global_test), temperature).wait();
+        image_resetter(TunedArgs("ResetImage", global_test), smoke_density).wait();
+
+#ifdef INITIALIZE_VEL
+        velocity_initializer(TunedArgs("VelocityInitializer", global_test), target_texture).wait();
+        velocity_initializer(TunedArgs("VelocityInitializer", global_test), new_vel).wait();
+        /*velocity_initializer(cl::EnqueueArgs(queue, global_test), dye_texture).wait();
+        velocity_initializer(cl::EnqueueArgs(queue, global_test), dye_texture).wait();*/
+#endif // INITIALIZE_VEL
+
+#ifdef INITIALIZE_DYE_FROM_TEX
+        clEnqueueCopyImage(queue(), init_texture(), dye_texture(), imageOrigin, imageOrigin, imageSize, 0, NULL, NULL);
+#endif // INITIALIZE_DYE_FROM_TEX
+
+        staggered_faces_valid = false;
+        flip_solver.Invalidate();
+        lattice_boltzmann.Invalidate();
+        gui.reset_pressed = false;
     }
-    // Switch click mode
-    else if (key == GLFW_KEY_M && action == GLFW_PRESS)
+
+#ifndef DISABLE_SIM
+    // ****************************************************************************************
+    // Add Dye or Force
+    // ****************************************************************************************
+
+    std::chrono::steady_clock::time_point phase_start = std::chrono::steady_clock::now();
+
+    // Random force
+    if (gui.IsForceEnabled())
     {
-        gui_pointer->click_mode = (gui_pointer->click_mode == VELOCITY_MODE) ? DYE_MODE : VELOCITY_MODE;
-    }
+        force_randomizer(TunedArgs("RandomForce", global_test), gui.GetForceScale(), gui.GetForceDirFlag(), static_cast<cl_uint>(step), target_texture, new_vel).wait();
+        //tex_copier(cl::EnqueueArgs(queue, global_test), new_vel, target_texture).wait();
+        clEnqueueCopyImage(queue(), new_vel(), target_texture(), imageOrigin, imageOrigin, imageSize, 0, NULL, NULL);
+        //force_randomizer(cl::EnqueueArgs(queue, global_test), gui.GetForceScale(), old_pressure, new_pressure).wait();
+        //tex_copier(cl::EnqueueArgs(queue, global_test), old_pressure, new_pressure).wait();
+
+        gui.ResetForceEnabled();
+    }
+
+    // Gravity
+    if (gui.apply_gravity)
+    {
+        gravitier(TunedArgs("ApplyGravity", global_test), time_step, target_texture, new_vel).wait();
+        clEnqueueCopyImage(queue(), new_vel(), target_texture(), imageOrigin, imageOrigin, imageSize, 0, NULL, NULL);
+    }
+
+    // Obstacle painting takes the clicks instead of the splats
+    if (gui.clicked && gui.clicking_enabled && gui.paint_obstacles)
+    {
+        if (gui.cursor_path.empty())
+            obstacle_mask.Paint(gui.mouse_xpos, gui.mouse_ypos, gui.mouse_xpos, gui.mouse_ypos, 8.0f, true);
+        for (size_t i = 0; i < gui.cursor_path.size(); i++)
+            obstacle_mask.Paint(gui.cursor_path[i].x0, gui.cursor_path[i].y0, gui.cursor_path[i].x1, gui.cursor_path[i].y1, 8.0f, true);
+    }
+
+    if (gui.clear_obstacles_pressed)
+    {
+        obstacle_mask.Clear();
+        gui.clear_obstacles_pressed = false;
+    }
+
+    obstacle_mask.Upload(queue);
+
+    // Click adder
+    if (gui.clicked && gui.clicking_enabled && !gui.paint_obstacles)
+    {
+        const float radius = (gui.dye_extreme_mode) ? 40.0f : 3.0f;
+
+        // A click without movement still splats at the cursor
+        if (gui.cursor_path.empty())
+            gui.cursor_path.push_back({ gui.mouse_xpos, gui.mouse_ypos, gui.mouse_xpos, gui.mouse_ypos });
+
+        // Dye strokes get one random color per step
+        const float red = static_cast<float>(std::rand()) / RAND_MAX;
+        const float green = static_cast<float>(std::rand()) / RAND_MAX;
+
+        // Every segment of the cursor path since the last step is queued, and the queue is applied in one launch
+        for (size_t i = 0; i < gui.cursor_path.size(); i++)
+        {
+            const CursorSegment& segment = gui.cursor_path[i];
+
+            // Velocity adder, pushing along the segment
+            if (gui.click_mode == VELOCITY_MODE)
+            {
+                float dir_x = static_cast<float>(segment.x1 - segment.x0);
+                float dir_y = static_cast<float>(segment.y0 - segment.y1);
+                const float length = std::sqrt(dir_x * dir_x + dir_y * dir_y);
+                if (gui.normalize_vel_dir && length > 0.0f)
+                {
+                    dir_x /= length;
+                    dir_y /= length;
+                }
+
+                const cl_float4 value = { { gui.GetForceScale() * dir_x, gui.GetForceScale() * dir_y, 0.0f, 0.0f } };
+                splat_queue.Add(segment.x0, segment.y0, segment.x1, segment.y1, radius, value, false);
+            }
+            // Dye adder, blending in the stroke color
+            else
+            {
+                const cl_float4 value = { { gui.GetForceScale() * red, gui.GetForceScale() * green, 0.0f, gui.GetForceScale() } };
+                splat_queue.Add(segment.x0, segment.y0, segment.x1, segment.y1, radius, value, true);
+            }
+        }
+
+        if (gui.click_mode == VELOCITY_MODE)
+            splat_queue.Apply(queue, target_texture, new_vel);
+        else
+            splat_queue.Apply(queue, dye_texture, dye_texture_new);
+    }
+
+    // Tiles where the fluid moves after the forces, for the sparse passes of this step
+    if (gui.sparse_tiles)
+        active_tiles.Update(queue, target_texture, ACTIVE_TILE_THRESHOLD);
+
+    timings.forces = SecondsSince(phase_start);
+
+    // ****************************************************************************************
+    // Advect, project and diffuse velocity
+    // ****************************************************************************************
+    if (gui.lbm_solver)
+    {
+        staggered_faces_valid = false;
+        AdvanceVelocityLatticeBoltzmann(gui, time_step, imageSize, timings);
+    }
+    else if (gui.staggered_grid)
+        AdvanceVelocityStaggered(gui, time_step, global_test, imageSize, timings);
+    else
+    {
+        staggered_faces_valid = false;
+        AdvanceVelocityCollocated(gui, step, time_step, global_test, global_1D, imageSize, timings);
+    }
+
+    // Particles and the lattice are seeded from the grid again when they take over the velocity
+    if (!gui.flip_mode || gui.staggered_grid || gui.lbm_solver)
+        flip_solver.Invalidate();
+    if (!gui.lbm_solver)
+        lattice_boltzmann.Invalidate();
+
+    // ****************************************************************************************
+    // Vorticity
+    // ****************************************************************************************
+    phase_start = std::chrono::steady_clock::now();
+#ifdef VORTICITY
+#ifdef NEUMANN_BOUND
+    boundarier(TunedArgs(boundary_kernel_name, global_1D), -1.0f, target_texture, new_vel).wait();
+    //tex_copier(cl::EnqueueArgs(queue, global_test), new_vel, target_texture).wait();
+    clEnqueueCopyImage(queue(), new_vel(), target_texture(), imageOrigin, imageOrigin, imageSize, 0, NULL, NULL);
+#else
+    boundarier(TunedArgs(boundary_kernel_name, global_test), -1.0f, target_texture, new_vel).wait();
+    //tex_copier(cl::EnqueueArgs(queue, global_test), new_vel, target_texture).wait();
+    clEnqueueCopyImage(queue(), new_vel(), target_texture(), imageOrigin, imageOrigin, imageSize, 0, NULL, NULL);
+#endif // NEUMANN_BOUND
+
+    // Curl and confinement are fused, with a fixed work-group size over whole tiles
+    const cl::NDRange vorticity_global((global_test[0] + VORTICITY_TILE - 1) / VORTICITY_TILE * VORTICITY_TILE,
+        (global_test[1] + VORTICITY_TILE - 1) / VORTICITY_TILE * VORTICITY_TILE);
+    vorticity_confiner(cl::EnqueueArgs(queue, vorticity_global, cl::NDRange(VORTICITY_TILE, VORTICITY_TILE)),
+        0.5f / gui.dx, time_step, 0.035f, 0.035f, target_texture, new_vel).wait();
+    //tex_copier(cl::EnqueueArgs(queue, global_test), new_vel, target_texture).wait();
+    clEnqueueCopyImage(queue(), new_vel(), target_texture(), imageOrigin, imageOrigin, imageSize, 0, NULL, NULL);
+#endif // VORTICITY
+
+    timings.vorticity = SecondsSince(phase_start);
+
+    // ****************************************************************************************
+    // Advect Dye
+    // ****************************************************************************************
+    phase_start = std::chrono::steady_clock::now();
+    //advecter(cl::EnqueueArgs(queue, global_test), time_step, 1.0f / gui.dx, 0.995f, target_texture, dye_texture, dye_texture_new).wait();
+    //advecter(cl::EnqueueArgs(queue, global_test), time_step, 1.0f / gui.dx, 1.0f, target_texture, dye_texture, dye_texture_new).wait();
+    //advecter(cl::EnqueueArgs(queue, global_test), time_step, 1.0f, 1.0f, target_texture, dye_texture, dye_texture_new).wait();
+    if (FusedDyeAdvection(gui))
+    {
+        // Advected with the velocity, dye_texture_new already matches dye_texture
+    }
+    else if (gui.smoke_buoyancy)
+    {
+        // One pass advects the smoke with the dye and adds its buoyancy, so the force enters the next projection
+        const cl_float4 source = { { 0.5f * imageSize[0], 0.1f * imageSize[1], 0.05f * imageSize[0], 0.0f } };
+        smoke_advecter(TunedArgs("AdvectSmoke", global_test), time_step, 1.0f / gui.dx, gui.backtrace_order, gui.smoke_lift, gui.smoke_weight, SMOKE_COOLING, source,
+            target_texture, dye_texture, dye_texture_new, temperature, temperature_new, smoke_density, smoke_density_new, new_vel, obstacle_mask.GetBuffer(), obstacle_mask.GetPitch()).wait();
+        clEnqueueCopyImage(queue(), temperature_new(), temperature(), imageOrigin, imageOrigin, imageSize, 0, NULL, NULL);
+        clEnqueueCopyImage(queue(), smoke_density_new(), smoke_density(), imageOrigin, imageOrigin, imageSize, 0, NULL, NULL);
+        clEnqueueCopyImage(queue(), new_vel(), target_texture(), imageOrigin, imageOrigin, imageSize, 0, NULL, NULL);
+    }
+    else if (gui.maccormack_advection)
+    {
+        advecter(TunedArgs("AdvectFluid", global_test), time_step, 1.0f / gui.dx, 1.0f, gui.backtrace_order, target_texture, dye_texture, advection_scratch, obstacle_mask.GetBuffer(), obstacle_mask.GetPitch()).wait();
+        maccormack_advecter(TunedArgs("AdvectMacCormack", global_test), time_step, 1.0f / gui.dx, 1.0f, gui.backtrace_order, target_texture, dye_texture, advection_scratch, dye_texture_new, obstacle_mask.GetBuffer(), obstacle_mask.GetPitch()).wait();
+    }
+    // Dye in still fluid stays where it is, and dye_texture_new already holds it
+    else if (gui.sparse_tiles && active_tiles.IsSparse())
+    {
+        if (active_tiles.GetCount() > 0)
+            tile_advecter(active_tiles.Args(queue), time_step, 1.0f / gui.dx, 1.0f, gui.backtrace_order, target_texture, dye_texture, dye_texture_new, obstacle_mask.GetBuffer(), obstacle_mask.GetPitch(), active_tiles.GetList()).wait();
+    }
+    else
+        advecter(TunedArgs("AdvectFluid", global_test), time_step, 1.0f / gui.dx, 1.0f, gui.backtrace_order, target_texture, dye_texture, dye_texture_new, obstacle_mask.GetBuffer(), obstacle_mask.GetPitch()).wait();
+    //tex_copier(cl::EnqueueArgs(queue, global_test), dye_texture_new, dye_texture).wait();
+    clEnqueueCopyImage(queue(), dye_texture_new(), dye_texture(), imageOrigin, imageOrigin, imageSize, 0, NULL, NULL);
+
+    // ****************************************************************************************
+    // Bound Dye
+    // ****************************************************************************************
+#ifdef NEUMANN_BOUND
+    boundarier(TunedArgs(boundary_kernel_name, global_1D), 0.0f, dye_texture, dye_texture_new).wait();
+    //tex_copier(cl::EnqueueArgs(queue, global_test), dye_texture_new, dye_texture).wait();
+    clEnqueueCopyImage(queue(), dye_texture_new(), dye_texture(), imageOrigin, imageOrigin, imageSize, 0, NULL, NULL);
+#else
+    boundarier(TunedArgs(boundary_kernel_name, global_test), 0.0f, dye_texture, dye_texture_new).wait();
+    //tex_copier(cl::EnqueueArgs(queue, global_test), dye_texture_new, dye_texture).wait();
+    clEnqueueCopyImage(queue(), dye_texture_new(), dye_texture(), imageOrigin, imageOrigin, imageSize, 0, NULL, NULL);
+#endif // NEUMANN_BOUND
+
+    //// ****************************************************************************************
+    //// Diffusion for dye
+    //// ****************************************************************************************
+    //centerFactor = 1.0f / (gui.viscosity * time_step);
+    //stencilFactor = 1.0f / (4.0f + centerFactor);
+    //for (int i = 0; i < JACOBI_REPS; i++)
+    //{
+    //    //jacobier(cl::EnqueueArgs(queue, global_test), centerFactor, stencilFactor, dye_texture, target_texture, dye_texture_new).wait();
+    //    jacobier(cl::EnqueueArgs(queue, global_test), centerFactor, stencilFactor, dye_texture, dye_texture, dye_texture_new).wait();
+    //    //tex_copier(cl::EnqueueArgs(queue, global_test), dye_texture_new, dye_texture).wait();
+    //    clEnqueueCopyImage(queue(), dye_texture_new(), dye_texture(), imageOrigin, imageOrigin, imageSize, 0, NULL, NULL);
+    //}
+
+//        // ****************************************************************************************
+//        // Bound Dye
+//        // ****************************************************************************************
+//#ifdef NEUMANN_BOUND
+//        boundarier(cl::EnqueueArgs(queue, global_1D), 0.0f, dye_texture, dye_texture_new).wait();
+//        //tex_copier(cl::EnqueueArgs(queue, global_test), dye_texture_new, dye_texture).wait();
+//        clEnqueueCopyImage(queue(), dye_texture_new(), dye_texture(), imageOrigin, imageOrigin, imageSize, 0, NULL, NULL);
+//#else
+//        boundarier(cl::EnqueueArgs(queue, global_test), 0.0f, dye_texture, dye_texture_new).wait();
+//        //tex_copier(cl::EnqueueArgs(queue, global_test), dye_texture_new, dye_texture).wait();
+//        clEnqueueCopyImage(queue(), dye_texture_new(), dye_texture(), imageOrigin, imageOrigin, imageSize, 0, NULL, NULL);
+//#endif // NEUMANN_BOUND
+
+    timings.dye = SecondsSince(phase_start);
+
+    // Display stuff
+    phase_start = std::chrono::steady_clock::now();
+    mixer(TunedArgs("Mix", global_test), gui.GetMixBias(), new_vel, new_pressure, display_texture).wait();
+    //display_converter(cl::EnqueueArgs(queue, global_test), new_vel, display_texture).wait();
+    timings.display = SecondsSince(phase_start);
+#endif // DISABLE_SIM
+
+    // The cursor path of this step has been consumed
+    gui.cursor_path.clear();
+}
+
+/// <summary>
+/// Advect, project and diffuse the collocated velocity field
+/// </summary>
+/// <param name="gui"></param>
+/// <param name="step">: seeds the FLIP particles</param>
+/// <param name="time_step"></param>
+/// <param name="global_test">: 2D range covering the whole grid</param>
+/// <param name="global_1D">: 1D range used by the boundary kernel</param>
+/// <param name="imageSize">: region of the images</param>
+/// <param name="timings">: filled with the time spent in each phase</param>
+void AdvanceVelocityCollocated(GUI& gui, uint64_t step, float time_step, const cl::NDRange& global_test, const cl::NDRange& global_1D, const size_t* imageSize, StepTimings& timings)
+{
+    static const size_t imageOrigin[3] = { 0, 0, 0 };
+
+    // ****************************************************************************************
+    // Advect Velocity
+    // ****************************************************************************************
+    std::chrono::steady_clock::time_point phase_start = std::chrono::steady_clock::now();
+
+    // The passes over the "new" images only write the active tiles, the rest still mirrors the current images
+    const bool sparse = gui.sparse_tiles && active_tiles.IsSparse();
+    if (gui.flip_mode)
+    {
+        // The particles carry the velocity, the grid is gathered from them and projected below
+        flip_solver.Advance(queue, target_texture, new_vel, time_step, 1.0f / gui.dx, gui.flip_ratio, step, obstacle_mask.GetBuffer(), obstacle_mask.GetPitch());
+    }
+    else if (gui.maccormack_advection)
+    {
+        advecter(TunedArgs("AdvectFluid", global_test), time_step, 1.0f / gui.dx, 1.0f, gui.backtrace_order, target_texture, target_texture, advection_scratch, obstacle_mask.GetBuffer(), obstacle_mask.GetPitch()).wait();
+        maccormack_advecter(TunedArgs("AdvectMacCormack", global_test), time_step, 1.0f / gui.dx, 1.0f, gui.backtrace_order, target_texture, target_texture, advection_scratch, new_vel, obstacle_mask.GetBuffer(), obstacle_mask.GetPitch()).wait();
+    }
+    else if (FusedDyeAdvection(gui))
+    {
+        // The dye takes the backtrace of the velocity, the dye pass below then only bounds it
+        field_advecter(TunedArgs("AdvectFields", global_test), time_step, 1.0f / gui.dx, 1.0f, gui.backtrace_order, 2, target_texture, target_texture, new_vel, dye_texture, dye_texture_new,
+            advection_scratch, advection_scratch, advection_scratch, advection_scratch, obstacle_mask.GetBuffer(), obstacle_mask.GetPitch()).wait();
+        clEnqueueCopyImage(queue(), dye_texture_new(), dye_texture(), imageOrigin, imageOrigin, imageSize, 0, NULL, NULL);
+    }
+    else if (sparse)
+    {
+        if (active_tiles.GetCount() > 0)
+            tile_advecter(active_tiles.Args(queue), time_step, 1.0f / gui.dx, 1.0f, gui.backtrace_order, target_texture, target_texture, new_vel, obstacle_mask.GetBuffer(), obstacle_mask.GetPitch(), active_tiles.GetList()).wait();
+    }
+    else
+        advecter(TunedArgs("AdvectFluid", global_test), time_step, 1.0f / gui.dx, 1.0f, gui.backtrace_order, target_texture, target_texture, new_vel, obstacle_mask.GetBuffer(), obstacle_mask.GetPitch()).wait();
+    //advecter(cl::EnqueueArgs(queue, global_test), time_step, 1.0f, 1.0f, target_texture, target_texture, new_vel).wait();
+    //tex_copier(cl::EnqueueArgs(queue, global_test), new_vel, target_texture).wait();
+    clEnqueueCopyImage(queue(), new_vel(), target_texture(), imageOrigin, imageOrigin, imageSize, 0, NULL, NULL);
+
+#ifdef NEUMANN_BOUND
+    boundarier(TunedArgs(boundary_kernel_name, global_1D), -1.0f, target_texture, new_vel).wait();
+    //tex_copier(cl::EnqueueArgs(queue, global_test), new_vel, target_texture).wait();
+    clEnqueueCopyImage(queue(), new_vel(), target_texture(), imageOrigin, imageOrigin, imageSize, 0, NULL, NULL);
+#else
+    boundarier(TunedArgs(boundary_kernel_name, global_test), -1.0f, target_texture, new_vel).wait();
+    //tex_copier(cl::EnqueueArgs(queue, global_test), new_vel, target_texture).wait();
+    clEnqueueCopyImage(queue(), new_vel(), target_texture(), imageOrigin, imageOrigin, imageSize, 0, NULL, NULL);
+#endif // NEUMANN_BOUND
+
+    // ****************************************************************************************
+    // Project divergent velocity into divergence-free field
+    // ****************************************************************************************
+
+    timings.advection = SecondsSince(phase_start);
+
+    // Divergence of velocity field, computed by the first pressure sweep when fused
+    phase_start = std::chrono::steady_clock::now();
+#ifndef FUSED_PROJECTION
+    divergencer(TunedArgs("Divergence", global_test), 0.5f / gui.dx, target_texture, velocity_divergence, obstacle_mask.GetBuffer(), obstacle_mask.GetPitch()).wait();
+#endif // !FUSED_PROJECTION
+    //divergencer(cl::EnqueueArgs(queue, global_test), 0.5f, target_texture, velocity_divergence).wait();
+
+    // Pressure disturbance
+#ifdef RESET_PRESSURE_EACH_ITER
+    image_resetter(TunedArgs("ResetImage", global_test), old_pressure).wait();
+    image_resetter(TunedArgs("ResetImage", global_test), new_pressure).wait();
+#endif // RESET_PRESSURE_EACH_ITER
+
+    timings.divergence = SecondsSince(phase_start);
+    phase_start = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < JACOBI_REPS; i++)
+    {
+//#ifdef NEUMANN_BOUND
+//            boundarier(cl::EnqueueArgs(queue, global_1D), 1.0f, old_pressure, new_pressure).wait();
+//            //tex_copier(cl::EnqueueArgs(queue, global_test), new_pressure, old_pressure).wait();
+//            clEnqueueCopyImage(queue(), new_pressure(), old_pressure(), imageOrigin, imageOrigin, imageSize, 0, NULL, NULL);
+//#else
+//            boundarier(cl::EnqueueArgs(queue, global_test), 1.0f, old_pressure, new_pressure).wait();
+//            //tex_copier(cl::EnqueueArgs(queue, global_test), new_pressure, old_pressure).wait();
+//            clEnqueueCopyImage(queue(), new_pressure(), old_pressure(), imageOrigin, imageOrigin, imageSize, 0, NULL, NULL);
+//#endif // NEUMANN_BOUND
+
+#ifdef FUSED_PROJECTION
+        if (i == 0)
+            jacobi_divergencer(TunedArgs("JacobiDivergence", global_test), 0.5f / gui.dx, -1.0f, 0.25f, old_pressure, target_texture, new_pressure, velocity_divergence, obstacle_mask.GetBuffer(), obstacle_mask.GetPitch()).wait();
+        else
+#endif // FUSED_PROJECTION
+        if (sparse)
+        {
+            if (active_tiles.GetCount() > 0)
+                tile_jacobier(active_tiles.Args(queue), -1.0f, 0.25f, old_pressure, velocity_divergence, new_pressure, obstacle_mask.GetBuffer(), obstacle_mask.GetPitch(), active_tiles.GetList()).wait();
+        }
+        else
+            jacobier(TunedArgs("Jacobi", global_test), -1.0f, 0.25f, old_pressure, velocity_divergence, new_pressure, obstacle_mask.GetBuffer(), obstacle_mask.GetPitch()).wait();
+        //tex_copier(cl::EnqueueArgs(queue, global_test), new_pressure, old_pressure).wait();
+        clEnqueueCopyImage(queue(), new_pressure(), old_pressure(), imageOrigin, imageOrigin, imageSize, 0, NULL, NULL);
+
+#ifdef NEUMANN_BOUND
+        boundarier(TunedArgs(boundary_kernel_name, global_1D), 1.0f, old_pressure, new_pressure).wait();
+        //tex_copier(cl::EnqueueArgs(queue, global_test), new_pressure, old_pressure).wait();
+        clEnqueueCopyImage(queue(), new_pressure(), old_pressure(), imageOrigin, imageOrigin, imageSize, 0, NULL, NULL);
+#else
+        boundarier(TunedArgs(boundary_kernel_name, global_test), 1.0f, old_pressure, new_pressure).wait();
+        //tex_copier(cl::EnqueueArgs(queue, global_test), new_pressure, old_pressure).wait();
+        clEnqueueCopyImage(queue(), new_pressure(), old_pressure(), imageOrigin, imageOrigin, imageSize, 0, NULL, NULL);
+#endif // NEUMANN_BOUND
+    }
+
+    timings.pressure = SecondsSince(phase_start);
+
+    // Subtract gradient(p) from u to get divergence-free velocity field
+    phase_start = std::chrono::steady_clock::now();
+#if defined(FUSED_PROJECTION) && defined(NEUMANN_BOUND)
+    // Gradient and velocity boundary in one pass
+    gradient_bounder(TunedArgs("GradientBoundary", global_test), 0.5f / gui.dx, -1.0f, old_pressure, target_texture, new_vel, obstacle_mask.GetBuffer(), obstacle_mask.GetPitch()).wait();
+    clEnqueueCopyImage(queue(), new_vel(), target_texture(), imageOrigin, imageOrigin, imageSize, 0, NULL, NULL);
+#else
+    gradienter(TunedArgs("Gradient", global_test), 0.5f / gui.dx, old_pressure, target_texture, new_vel, obstacle_mask.GetBuffer(), obstacle_mask.GetPitch()).wait();
+    //gradienter(cl::EnqueueArgs(queue, global_test), 0.5f, old_pressure, target_texture, new_vel).wait();
+    ////tex_copier(cl::EnqueueArgs(queue, global_test), new_vel, target_texture).wait();
+    clEnqueueCopyImage(queue(), new_vel(), target_texture(), imageOrigin, imageOrigin, imageSize, 0, NULL, NULL);
+
+    // ****************************************************************************************
+    // Bound Velocity
+    // ****************************************************************************************
+#ifdef NEUMANN_BOUND
+    boundarier(TunedArgs(boundary_kernel_name, global_1D), -1.0f, target_texture, new_vel).wait();
+    //tex_copier(cl::EnqueueArgs(queue, global_test), new_vel, target_texture).wait();
+    clEnqueueCopyImage(queue(), new_vel(), target_texture(), imageOrigin, imageOrigin, imageSize, 0, NULL, NULL);
+#else
+    boundarier(TunedArgs(boundary_kernel_name, global_test), -1.0f, target_texture, new_vel).wait();
+    //tex_copier(cl::EnqueueArgs(queue, global_test), new_vel, target_texture).wait();
+    clEnqueueCopyImage(queue(), new_vel(), target_texture(), imageOrigin, imageOrigin, imageSize, 0, NULL, NULL);
+#endif // NEUMANN_BOUND
+#endif // FUSED_PROJECTION && NEUMANN_BOUND
+
+    timings.gradient = SecondsSince(phase_start);
+
+    // ****************************************************************************************
+    // Diffusion for viscous fluid
+    // ****************************************************************************************
+    phase_start = std::chrono::steady_clock::now();
+    float centerFactor = 1.0f / (gui.viscosity * time_step);
+    float stencilFactor = 1.0f / (4.0f + centerFactor);
+    if (gui.viscosity > 0.0f)
+    {
+        for (int i = 0; i < JACOBI_REPS; i++)
+        {
+            if (sparse)
+            {
+                if (active_tiles.GetCount() > 0)
+                    tile_jacobier(active_tiles.Args(queue), centerFactor, stencilFactor, target_texture, target_texture, new_vel, obstacle_mask.GetBuffer(), obstacle_mask.GetPitch(), active_tiles.GetList()).wait();
+            }
+            else
+                jacobier(TunedArgs("Jacobi", global_test), centerFactor, stencilFactor, target_texture, target_texture, new_vel, obstacle_mask.GetBuffer(), obstacle_mask.GetPitch()).wait();
+            //tex_copier(cl::EnqueueArgs(queue, global_test), new_vel, target_texture).wait();
+            clEnqueueCopyImage(queue(), new_vel(), target_texture(), imageOrigin, imageOrigin, imageSize, 0, NULL, NULL);
+        }
+    }
+
+    // ****************************************************************************************
+    // Bound Velocity
+    // ****************************************************************************************
+#ifdef NEUMANN_BOUND
+    boundarier(TunedArgs(boundary_kernel_name, global_1D), -1.0f, target_texture, new_vel).wait();
+    //tex_copier(cl::EnqueueArgs(queue, global_test), new_vel, target_texture).wait();
+    clEnqueueCopyImage(queue(), new_vel(), target_texture(), imageOrigin, imageOrigin, imageSize, 0, NULL, NULL);
+#else
+    boundarier(TunedArgs(boundary_kernel_name, global_test), -1.0f, target_texture, new_vel).wait();
+    //tex_copier(cl::EnqueueArgs(queue, global_test), new_vel, target_texture).wait();
+    clEnqueueCopyImage(queue(), new_vel(), target_texture(), imageOrigin, imageOrigin, imageSize, 0, NULL, NULL);
+#endif // NEUMANN_BOUND
+
+    timings.diffusion = SecondsSince(phase_start);
+}
+
+/// <summary>
+/// Advect, diffuse and project the velocity on the staggered faces, then write the collocated field from them.
+/// Changes made to the collocated field since the last step are transferred to the faces first.
+/// </summary>
+/// <param name="gui"></param>
+/// <param name="time_step"></param>
+/// <param name="global_test">: 2D range covering the whole grid</param>
+/// <param name="imageSize">: region of the images</param>
+/// <param name="timings">: filled with the time spent in each phase</param>
+void AdvanceVelocityStaggered(GUI& gui, float time_step, const cl::NDRange& global_test, const size_t* imageSize, StepTimings& timings)
+{
+    static const size_t imageOrigin[3] = { 0, 0, 0 };
+
+    // The face images are one texel larger along their axis. Odd sizes, so the driver picks the work-groups.
+    const size_t uSize[3] = { imageSize[0] + 1, imageSize[1], 1 };
+    const size_t vSize[3] = { imageSize[0], imageSize[1] + 1, 1 };
+    const cl::NDRange global_u(uSize[0], uSize[1]);
+    const cl::NDRange global_v(vSize[0], vSize[1]);
+
+    // ****************************************************************************************
+    // Transfer collocated changes to the faces
+    // ****************************************************************************************
+    std::chrono::steady_clock::time_point phase_start = std::chrono::steady_clock::now();
+
+    // Starting from zero faces and centers transfers the whole collocated field
+    if (!staggered_faces_valid)
+    {
+        image_resetter(cl::EnqueueArgs(queue, global_u), face_u).wait();
+        image_resetter(cl::EnqueueArgs(queue, global_v), face_v).wait();
+        image_resetter(TunedArgs("ResetImage", global_test), staggered_centers).wait();
+        staggered_faces_valid = true;
+    }
+
+    centers_to_facer(cl::EnqueueArgs(queue, global_u), 0, target_texture, staggered_centers, face_u, face_u_new, obstacle_mask.GetBuffer(), obstacle_mask.GetPitch()).wait();
+    centers_to_facer(cl::EnqueueArgs(queue, global_v), 1, target_texture, staggered_centers, face_v, face_v_new, obstacle_mask.GetBuffer(), obstacle_mask.GetPitch()).wait();
+    clEnqueueCopyImage(queue(), face_u_new(), face_u(), imageOrigin, imageOrigin, uSize, 0, NULL, NULL);
+    clEnqueueCopyImage(queue(), face_v_new(), face_v(), imageOrigin, imageOrigin, vSize, 0, NULL, NULL);
+
+    // ****************************************************************************************
+    // Advect Velocity
+    // ****************************************************************************************
+    // Both components are advected by the old faces before either is replaced
+    face_advecter(cl::EnqueueArgs(queue, global_u), time_step, 1.0f / gui.dx, gui.backtrace_order, 0, face_u, face_v, face_u, face_u_new, obstacle_mask.GetBuffer(), obstacle_mask.GetPitch()).wait();
+    face_advecter(cl::EnqueueArgs(queue, global_v), time_step, 1.0f / gui.dx, gui.backtrace_order, 1, face_u, face_v, face_v, face_v_new, obstacle_mask.GetBuffer(), obstacle_mask.GetPitch()).wait();
+    clEnqueueCopyImage(queue(), face_u_new(), face_u(), imageOrigin, imageOrigin, uSize, 0, NULL, NULL);
+    clEnqueueCopyImage(queue(), face_v_new(), face_v(), imageOrigin, imageOrigin, vSize, 0, NULL, NULL);
+
+    timings.advection = SecondsSince(phase_start);
+
+    // ****************************************************************************************
+    // Diffusion for viscous fluid
+    // ****************************************************************************************
+    // Diffused before the projection, which restores the walls
+    phase_start = std::chrono::steady_clock::now();
+    if (gui.viscosity > 0.0f)
+    {
+        const float centerFactor = 1.0f / (gui.viscosity * time_step);
+        const float stencilFactor = 1.0f / (4.0f + centerFactor);
+        for (int i = 0; i < JACOBI_REPS; i++)
+        {
+            jacobier(cl::EnqueueArgs(queue, global_u), centerFactor, stencilFactor, face_u, face_u, face_u_new, obstacle_mask.GetBuffer(), 0).wait();
+            jacobier(cl::EnqueueArgs(queue, global_v), centerFactor, stencilFactor, face_v, face_v, face_v_new, obstacle_mask.GetBuffer(), 0).wait();
+            clEnqueueCopyImage(queue(), face_u_new(), face_u(), imageOrigin, imageOrigin, uSize, 0, NULL, NULL);
+            clEnqueueCopyImage(queue(), face_v_new(), face_v(), imageOrigin, imageOrigin, vSize, 0, NULL, NULL);
+        }
+    }
+
+    timings.diffusion = SecondsSince(phase_start);
+
+    // ****************************************************************************************
+    // Project divergent velocity into divergence-free field
+    // ****************************************************************************************
+    phase_start = std::chrono::steady_clock::now();
+    staggered_divergencer(TunedArgs("DivergenceStaggered", global_test), 1.0f / gui.dx, face_u, face_v, velocity_divergence).wait();
+
+#ifdef RESET_PRESSURE_EACH_ITER
+    image_resetter(TunedArgs("ResetImage", global_test), old_pressure).wait();
+    image_resetter(TunedArgs("ResetImage", global_test), new_pressure).wait();
+#endif // RESET_PRESSURE_EACH_ITER
+
+    timings.divergence = SecondsSince(phase_start);
+    phase_start = std::chrono::steady_clock::now();
+
+    // Compact 5-point Laplacian matching the face divergence and gradient, with the Neumann walls in the sweep
+    for (int i = 0; i < JACOBI_REPS; i++)
+    {
+        staggered_jacobier(TunedArgs("JacobiStaggered", global_test), -gui.dx * gui.dx, 0.25f, old_pressure, velocity_divergence, new_pressure, obstacle_mask.GetBuffer(), obstacle_mask.GetPitch()).wait();
+        clEnqueueCopyImage(queue(), new_pressure(), old_pressure(), imageOrigin, imageOrigin, imageSize, 0, NULL, NULL);
+    }
+
+    timings.pressure = SecondsSince(phase_start);
+
+    // Subtract gradient(p) from the faces
+    phase_start = std::chrono::steady_clock::now();
+    face_gradienter(cl::EnqueueArgs(queue, global_u), 1.0f / gui.dx, 0, old_pressure, face_u, face_u_new, obstacle_mask.GetBuffer(), obstacle_mask.GetPitch()).wait();
+    face_gradienter(cl::EnqueueArgs(queue, global_v), 1.0f / gui.dx, 1, old_pressure, face_v, face_v_new, obstacle_mask.GetBuffer(), obstacle_mask.GetPitch()).wait();
+    clEnqueueCopyImage(queue(), face_u_new(), face_u(), imageOrigin, imageOrigin, uSize, 0, NULL, NULL);
+    clEnqueueCopyImage(queue(), face_v_new(), face_v(), imageOrigin, imageOrigin, vSize, 0, NULL, NULL);
+
+    // Collocated velocity for the dye, the display and the forces of the next step
+    faces_to_centerer(TunedArgs("FacesToCenters", global_test), face_u, face_v, target_texture, new_vel).wait();
+    clEnqueueCopyImage(queue(), new_vel(), target_texture(), imageOrigin, imageOrigin, imageSize, 0, NULL, NULL);
+    clEnqueueCopyImage(queue(), new_vel(), staggered_centers(), imageOrigin, imageOrigin, imageSize, 0, NULL, NULL);
+
+    timings.gradient = SecondsSince(phase_start);
+}
+
+/// <summary>
+/// Advance the velocity one lattice Boltzmann step, which streams, collides and takes the forces of this step in one
+/// pass. The pressure follows from the lattice density, so there is no divergence, pressure or diffusion pass.
+/// </summary>
+/// <param name="gui"></param>
+/// <param name="time_step"></param>
+/// <param name="imageSize">: region of the images</param>
+/// <param name="timings">: filled with the time spent in each phase</param>
+void AdvanceVelocityLatticeBoltzmann(GUI& gui, float time_step, const size_t* imageSize, StepTimings& timings)
+{
+    static const size_t imageOrigin[3] = { 0, 0, 0 };
+
+    std::chrono::steady_clock::time_point phase_start = std::chrono::steady_clock::now();
+    lattice_boltzmann.Advance(queue, target_texture, new_vel, time_step, 1.0f / gui.dx, gui.viscosity, obstacle_mask.GetBuffer(), obstacle_mask.GetPitch());
+    clEnqueueCopyImage(queue(), new_vel(), target_texture(), imageOrigin, imageOrigin, imageSize, 0, NULL, NULL);
+    timings.advection = SecondsSince(phase_start);
+}
+
+/// <summary>
+/// Create the face images of the staggered grid, which are rebuilt from the collocated field on their next use
+/// </summary>
+/// <param name="width">: grid width in cells</param>
+/// <param name="height">: grid height in cells</param>
+void CreateStaggeredImages(int width, int height)
+{
+    face_u = cl::Image2D(context, CL_MEM_READ_WRITE, cl::ImageFormat(CL_R, CL_FLOAT), width + 1, height);
+    face_u_new = cl::Image2D(context, CL_MEM_READ_WRITE, cl::ImageFormat(CL_R, CL_FLOAT), width + 1, height);
+    face_v = cl::Image2D(context, CL_MEM_READ_WRITE, cl::ImageFormat(CL_R, CL_FLOAT), width, height + 1);
+    face_v_new = cl::Image2D(context, CL_MEM_READ_WRITE, cl::ImageFormat(CL_R, CL_FLOAT), width, height + 1);
+    staggered_centers = cl::Image2D(context, CL_MEM_READ_WRITE, cl::ImageFormat(CL_RGBA, CL_FLOAT), width, height);
+    staggered_faces_valid = false;
+}
+
+/// <summary>
+/// Whether the dye is advected in the AdvectFields pass of the collocated velocity, instead of a pass of its own
+/// </summary>
+/// <param name="gui"></param>
+/// <returns>: the flag</returns>
+bool FusedDyeAdvection(const GUI& gui)
+{
+    // MacCormack needs two passes, FLIP moves particles and the lattice streams instead of backtracing, the smoke pass advects the dye itself and the staggered path has no center backtrace
+    return gui.fused_advection && !gui.maccormack_advection && !gui.smoke_buoyancy && !gui.staggered_grid && !gui.flip_mode && !gui.lbm_solver;
+}
+
+/// <summary>
+/// Create the smoke temperature and density images, starting cold and empty
+/// </summary>
+/// <param name="width"></param>
+/// <param name="height"></param>
+void CreateSmokeImages(int width, int height)
+{
+    std::vector<float> zeros(static_cast<size_t>(width) * height, 0.0f);
+    temperature = cl::Image2D(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, cl::ImageFormat(CL_R, CL_FLOAT), width, height, 0, &zeros[0]);
+    temperature_new = cl::Image2D(context, CL_MEM_READ_WRITE, cl::ImageFormat(CL_R, CL_FLOAT), width, height);
+    smoke_density = cl::Image2D(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, cl::ImageFormat(CL_R, CL_FLOAT), width, height, 0, &zeros[0]);
+    smoke_density_new = cl::Image2D(context, CL_MEM_READ_WRITE, cl::ImageFormat(CL_R, CL_FLOAT), width, height);
+}
+
+/// <summary>
+/// Run the full step benchmark at several resolutions and compare the throughput with the stored baselines
+/// </summary>
+/// <param name="gui">: its input fields are driven by the scripted force injection</param>
+/// <param name="steps">: number of timed steps per resolution</param>
+/// <param name="threshold">: allowed relative throughput drop</param>
+/// <param name="update_baselines">: store the results as the new baselines instead of checking them</param>
+/// <returns>: EXIT_SUCCESS, or EXIT_FAILURE on a throughput regression</returns>
+int RunBenchmark(GUI& gui, int steps, float threshold, bool update_baselines)
+{
+    const int resolutions[] = { 256, 512, 1024 };
+    const int warmup_steps = 10;
+
+    // Fixed initial condition
+    int tex_width, tex_height, tex_channels;
+    unsigned char* data = stbi_load(PROJECT_SOURCE_DIR "/textures/bricks1K.png", &tex_width, &tex_height, &tex_channels, 4);
+    if (!data)
+    {
+        std::cout << "Failed to load benchmark texture" << std::endl;
+        return EXIT_FAILURE;
+    }
+    cl::Image2D source_texture(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, cl::ImageFormat(CL_RGBA, CL_UNORM_INT8), tex_width, tex_height, 0, data);
+    stbi_image_free(data);
+
+    resampler = cl::Kernel(program, "ResampleImage");
+
+    Benchmark benchmark(default_device.getInfo<CL_DEVICE_NAME>(), PROJECT_SOURCE_DIR "/benchmarks/baselines.txt", threshold);
+
+    // Fixed parameters, independent of the GUI defaults
+    gui.viscosity = 0.5f;
+    gui.dx = 1.0f;
+    gui.apply_gravity = false;
+    gui.clicking_enabled = true;
+    gui.click_mode = VELOCITY_MODE;
+    gui.dye_extreme_mode = true;
+    gui.normalize_vel_dir = true;
+    gui.reset_pressed = false;
+
+    for (int resolution : resolutions)
+    {
+        const size_t imageSize[3] = { static_cast<size_t>(resolution), static_cast<size_t>(resolution), 1 };
+        cl::NDRange global_2D(resolution, resolution);
+        cl::NDRange global_boundary(resolution * resolution);
+
+        // Plain CL images replace the shared GL images for the benchmark
+        init_texture = cl::Image2D(context, CL_MEM_READ_WRITE, cl::ImageFormat(CL_RGBA, CL_FLOAT), resolution, resolution);
+        target_texture = cl::Image2D(context, CL_MEM_READ_WRITE, cl::ImageFormat(CL_RGBA, CL_FLOAT), resolution, resolution);
+        new_vel = cl::Image2D(context, CL_MEM_READ_WRITE, cl::ImageFormat(CL_RGBA, CL_FLOAT), resolution, resolution);
+        velocity_divergence = cl::Image2D(context, CL_MEM_READ_WRITE, cl::ImageFormat(CL_RGBA, CL_FLOAT), resolution, resolution);
+        old_pressure = cl::Image2D(context, CL_MEM_READ_WRITE, cl::ImageFormat(CL_RGBA, CL_FLOAT), resolution, resolution);
+        new_pressure = cl::Image2D(context, CL_MEM_READ_WRITE, cl::ImageFormat(CL_RGBA, CL_FLOAT), resolution, resolution);
+        dye_texture = cl::Image2D(context, CL_MEM_READ_WRITE, cl::ImageFormat(CL_RGBA, CL_FLOAT), resolution, resolution);
+        dye_texture_new = cl::Image2D(context, CL_MEM_READ_WRITE, cl::ImageFormat(CL_RGBA, CL_FLOAT), resolution, resolution);
+        display_texture = cl::Image2D(context, CL_MEM_READ_WRITE, cl::ImageFormat(CL_RGBA, CL_FLOAT), resolution, resolution);
+        advection_scratch = cl::Image2D(context, CL_MEM_READ_WRITE, cl::ImageFormat(CL_RGBA, CL_FLOAT), resolution, resolution);
+        CreateStaggeredImages(resolution, resolution);
+        CreateSmokeImages(resolution, resolution);
+        obstacle_mask.Init(context, resolution, resolution);
+        obstacle_mask.Upload(queue);
+
+        image_resetter(TunedArgs("ResetImage", global_2D), target_texture).wait();
+        image_resetter(TunedArgs("ResetImage", global_2D), new_vel).wait();
+        image_resetter(TunedArgs("ResetImage", global_2D), velocity_divergence).wait();
+        image_resetter(TunedArgs("ResetImage", global_2D), old_pressure).wait();
+        image_resetter(TunedArgs("ResetImage", global_2D), new_pressure).wait();
+        image_resetter(TunedArgs("ResetImage", global_2D), dye_texture_new).wait();
+        image_resetter(TunedArgs("ResetImage", global_2D), display_texture).wait();
+        resampler(TunedArgs("ResampleImage", global_2D), source_texture, init_texture).wait();
+        resampler(TunedArgs("ResampleImage", global_2D), source_texture, dye_texture).wait();
+
+        // Scripted force injection: the cursor circles around the center of the grid
+        const float center = 0.5f * resolution;
+        const float radius = 0.25f * resolution;
+        gui.MousePositionUpdate(center + radius, center);
+        gui.MousePositionUpdate(center + radius, center);
+
+        StepTimings total;
+        double elapsed = 0.0;
+        for (int i = 0; i < warmup_steps + steps; i++)
+        {
+            const float angle = 2.0f * 3.14159265358979f * static_cast<float>(i) / 120.0f;
+            gui.MousePositionUpdate(center + radius * std::cos(angle), center + radius * std::sin(angle));
+            gui.clicked = (i % 40) < 30;
+
+            std::chrono::steady_clock::time_point step_start = std::chrono::steady_clock::now();
+            StepTimings timings;
+            StepSimulation(gui, i, 1.0f, global_2D, global_boundary, imageSize, timings);
+            queue.finish();
+
+            if (i >= warmup_steps)
+            {
+                total += timings;
+                elapsed += SecondsSince(step_start);
+            }
+        }
+
+        BenchmarkResult result;
+        result.resolution = resolution;
+        result.steps = steps;
+        result.steps_per_sec = steps / elapsed;
+        result.average = total / steps;
+        result.velocity = Benchmark::Checksum(queue, target_texture, resolution, resolution);
+        result.pressure = Benchmark::Checksum(queue, old_pressure, resolution, resolution);
+        result.dye = Benchmark::Checksum(queue, dye_texture, resolution, resolution);
+        benchmark.AddResult(result);
+    }
+
+    gui.clicked = false;
+
+    benchmark.Report();
+
+    if (update_baselines)
+        return benchmark.SaveBaselines() ? EXIT_SUCCESS : EXIT_FAILURE;
+
+    return benchmark.CheckBaselines() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/// <summary>
+/// Describe the current simulation state for a checkpoint
+/// </summary>
+/// <param name="gui">: source of the parameters</param>
+/// <param name="step">: number of steps taken so far</param>
+/// <param name="width"></param>
+/// <param name="height"></param>
+/// <returns>: the header</returns>
+CheckpointHeader MakeCheckpointHeader(GUI& gui, uint64_t step, int width, int height)
+{
+    const cl_image_format format = target_texture.getImageInfo<CL_IMAGE_FORMAT>();
+
+    CheckpointHeader header;
+    header.width = width;
+    header.height = height;
+    header.channel_order = format.image_channel_order;
+    header.channel_type = format.image_channel_data_type;
+    header.element_size = static_cast<uint32_t>(target_texture.getImageInfo<CL_IMAGE_ELEMENT_SIZE>());
+    header.step = step;
+    header.viscosity = gui.viscosity;
+    header.dx = gui.dx;
+    header.force_scale = gui.GetForceScale();
+    header.mix_bias = gui.GetMixBias();
+    header.click_mode = gui.click_mode;
+    header.selected_index = gui.selected_index;
+    header.smoke_lift = gui.smoke_lift;
+    header.smoke_weight = gui.smoke_weight;
+    header.flags = (gui.apply_gravity ? static_cast<uint32_t>(CHECKPOINT_APPLY_GRAVITY) : 0u) |
+        (gui.dye_extreme_mode ? static_cast<uint32_t>(CHECKPOINT_DYE_EXTREME) : 0u) |
+        (gui.normalize_vel_dir ? static_cast<uint32_t>(CHECKPOINT_NORMALIZE_VEL) : 0u) |
+        (gui.std_timestep ? static_cast<uint32_t>(CHECKPOINT_STD_TIMESTEP) : 0u) |
+        (gui.GetForceDirFlag() ? static_cast<uint32_t>(CHECKPOINT_FORCE_DIR) : 0u) |
+        (gui.maccormack_advection ? static_cast<uint32_t>(CHECKPOINT_MACCORMACK) : 0u) |
+        (gui.backtrace_order == 2 ? static_cast<uint32_t>(CHECKPOINT_BACKTRACE_RK2) : 0u) |
+        (gui.backtrace_order == 3 ? static_cast<uint32_t>(CHECKPOINT_BACKTRACE_RK3) : 0u) |
+        (gui.adaptive_timestep ? static_cast<uint32_t>(CHECKPOINT_ADAPTIVE_TIMESTEP) : 0u) |
+        (gui.staggered_grid ? static_cast<uint32_t>(CHECKPOINT_STAGGERED_GRID) : 0u) |
+        (gui.sparse_tiles ? static_cast<uint32_t>(CHECKPOINT_SPARSE_TILES) : 0u) |
+        (gui.smoke_buoyancy ? static_cast<uint32_t>(CHECKPOINT_SMOKE_BUOYANCY) : 0u) |
+        (gui.fused_advection ? static_cast<uint32_t>(CHECKPOINT_FUSED_ADVECTION) : 0u) |
+        (gui.flip_mode ? static_cast<uint32_t>(CHECKPOINT_FLIP) : 0u) |
+        (gui.lbm_solver ? static_cast<uint32_t>(CHECKPOINT_LBM) : 0u);
+
+    return header;
+}
+
+/// <summary>
+/// Load a checkpoint and upload its fields directly into the velocity, pressure, dye and smoke images and the obstacles
+/// </summary>
+/// <param name="gui">: receives the stored parameters</param>
+/// <param name="path"></param>
+/// <param name="width">: must match the checkpoint</param>
+/// <param name="height">: must match the checkpoint</param>
+/// <param name="step">: receives the stored step count</param>
+/// <returns>: whether the checkpoint was restored</returns>
+bool RestoreCheckpoint(GUI& gui, const std::string& path, int width, int height, uint64_t& step)
+{
+    CheckpointHeader header;
+    std::vector<std::vector<unsigned char>> fields;
+    if (!LoadCheckpoint(path, header, fields))
+        return false;
+
+    const CheckpointHeader current = MakeCheckpointHeader(gui, 0, width, height);
+    if (header.width != current.width || header.height != current.height || header.channel_order != current.channel_order ||
+        header.channel_type != current.channel_type || header.element_size != current.element_size || fields.size() != 6 ||
+        fields[5].size() != obstacle_mask.GetSize())
+    {
+        std::cout << "Checkpoint does not match the simulation: " << header.width << "x" << header.height << std::endl;
+        return false;
+    }
+
+    cl::Image2D images[] = { target_texture, old_pressure, dye_texture, temperature, smoke_density };
+    for (int i = 0; i < 5; i++)
+    {
+        if (fields[i].size() != static_cast<size_t>(width) * height * images[i].getImageInfo<CL_IMAGE_ELEMENT_SIZE>())
+        {
+            std::cout << "Checkpoint field " << i << " has the wrong size: " << fields[i].size() << std::endl;
+            return false;
+        }
+    }
+
+    cl::size_t<3> origin;
+    cl::size_t<3> region;
+    region[0] = width;
+    region[1] = height;
+    region[2] = 1;
+
+    glFinish();
+    for (int i = 0; i < 3; i++)
+    {
+        clEnqueueAcquireGLObjects(queue(), 1, &images[i](), 0, NULL, NULL);
+        queue.enqueueWriteImage(images[i], CL_TRUE, origin, region, 0, 0, &fields[i][0]);
+        clEnqueueReleaseGLObjects(queue(), 1, &images[i](), 0, NULL, NULL);
+    }
+
+    // The smoke fields are not shared with GL
+    for (int i = 3; i < 5; i++)
+        queue.enqueueWriteImage(images[i], CL_TRUE, origin, region, 0, 0, &fields[i][0]);
+    obstacle_mask.Restore(fields[5]);
+    obstacle_mask.Upload(queue);
+    clFinish(queue());
+
+    gui.viscosity = header.viscosity;
+    gui.dx = header.dx;
+    gui.SetForceScale(header.force_scale);
+    gui.SetMixBias(header.mix_bias);
+    gui.SetForceDirFlag((header.flags & CHECKPOINT_FORCE_DIR) != 0);
+    gui.click_mode = static_cast<ClickMode>(header.click_mode);
+    gui.selected_index = header.selected_index;
+    gui.smoke_lift = header.smoke_lift;
+    gui.smoke_weight = header.smoke_weight;
+    gui.apply_gravity = (header.flags & CHECKPOINT_APPLY_GRAVITY) != 0;
+    gui.dye_extreme_mode = (header.flags & CHECKPOINT_DYE_EXTREME) != 0;
+    gui.normalize_vel_dir = (header.flags & CHECKPOINT_NORMALIZE_VEL) != 0;
+    gui.std_timestep = (header.flags & CHECKPOINT_STD_TIMESTEP) != 0;
+    gui.maccormack_advection = (header.flags & CHECKPOINT_MACCORMACK) != 0;
+    gui.backtrace_order = (header.flags & CHECKPOINT_BACKTRACE_RK3) ? 3 : ((header.flags & CHECKPOINT_BACKTRACE_RK2) ? 2 : 1);
+    gui.adaptive_timestep = (header.flags & CHECKPOINT_ADAPTIVE_TIMESTEP) != 0;
+    gui.staggered_grid = (header.flags & CHECKPOINT_STAGGERED_GRID) != 0;
+    gui.sparse_tiles = (header.flags & CHECKPOINT_SPARSE_TILES) != 0;
+    gui.smoke_buoyancy = (header.flags & CHECKPOINT_SMOKE_BUOYANCY) != 0;
+    gui.fused_advection = (header.flags & CHECKPOINT_FUSED_ADVECTION) != 0;
+    gui.flip_mode = (header.flags & CHECKPOINT_FLIP) != 0;
+    gui.lbm_solver = (header.flags & CHECKPOINT_LBM) != 0;
+    staggered_faces_valid = false;
+    flip_solver.Invalidate();
+    lattice_boltzmann.Invalidate();
+    step = header.step;
+
+    std::cout << "Restarted from checkpoint at step " << step << ": " << path << std::endl;
+
+    return true;
+}
+
+/// <summary>
+/// Callback function for mouse cursor movement
+/// </summary>
+/// <param name="window"></param>
+/// <param name="xpos"></param>
+/// <param name="ypos"></param>
+void CursorPositionCallback(GLFWwindow* window, double xpos, double ypos)
+{
+    // The replayed input drives the simulation instead
+    if (!replaying_input)
+    {
+        gui_pointer->MousePositionUpdate(xpos, ypos);
+
+        if (recorder_pointer)
+            recorder_pointer->RecordMouseMove(xpos, ypos);
+    }
+
+    ImGui_ImplGlfw_CursorPosCallback(window, xpos, ypos);
+}
+
+/// <summary>
+/// Callback function for mouse button press
+/// </summary>
+/// <param name="window"></param>
+/// <param name="button"></param>
+/// <param name="action"></param>
+/// <param name="mods"></param>
+void MouseButtonCallback(GLFWwindow* window, int button, int action, int mods)
+{
+    if (replaying_input)
+    {
+        // The replayed input drives the simulation instead
+    }
+    else if (!gui_pointer->clicked && button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS)
+    {
+        std::cout << "MOUSE CLICK on x: " << gui_pointer->mouse_xpos << " y: " << gui_pointer->mouse_ypos << std::endl;
+        gui_pointer->clicked = true;
+
+        if (recorder_pointer)
+            recorder_pointer->RecordMouseButton(true);
+    }
+    else if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_RELEASE)
+    {
+        std::cout << "MOUSE RELEASE on x: " << gui_pointer->mouse_xpos << " y: " << gui_pointer->mouse_ypos << std::endl;
+        gui_pointer->clicked = false;
+
+        if (recorder_pointer)
+            recorder_pointer->RecordMouseButton(false);
+    }
+
+    ImGui_ImplGlfw_MouseButtonCallback(window, button, action, mods);
+}
+
+/// <summary>
+/// Callback Function for keyboard button press
+/// </summary>
+/// <param name="window"></param>
+/// <param name="key"></param>
+/// <param name="scancode"></param>
+/// <param name="action"></param>
+/// <param name="mods"></param>
+void KeyboardCallback(GLFWwindow* window, int key, int scancode, int action, int mods)
+{
+    // Enable/Disable Cursor
+    if (key == GLFW_KEY_SPACE && action == GLFW_PRESS)
+    {
+        if (gui_pointer->cursor_enabled)
+            glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+        else
+            glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_CAPTURED);
+
+        gui_pointer->cursor_enabled = !gui_pointer->cursor_enabled;
+    }
+    // Clicking, reset and click mode keys, recorded since they change the simulation
+    else if (action == GLFW_PRESS && !replaying_input && gui_pointer->ApplySimulationKey(key))
+    {
+        if (recorder_pointer)
+            recorder_pointer->RecordKey(key);
+    }
     // Enable/Disable GUI
     else if (key == GLFW_KEY_TAB && action == GLFW_PRESS)
     {
         gui_pointer->gui_enabled = !gui_pointer->gui_enabled;
     }
 }
+
+/// <summary>
+/// Advance an ensemble of small simulations together and report the final state of every member. Member i takes
+/// its own random force seed and a viscosity spread linearly over the range; dx and the force scale come from the GUI.
+/// </summary>
+/// <param name="gui"></param>
+/// <param name="members">: number of members</param>
+/// <param name="size">: width and height of each member</param>
+/// <param name="steps"></param>
+/// <param name="viscosity_min">: viscosity of the first member</param>
+/// <param name="viscosity_max">: viscosity of the last member</param>
+/// <param name="out_path">: CSV file of the member results, none when empty</param>
+/// <returns>: exit code</returns>
+int RunEnsemble(GUI& gui, int members, int size, int steps, float viscosity_min, float viscosity_max, const std::string& out_path)
+{
+    std::vector<EnsembleMember> parameters(members);
+    for (int i = 0; i < members; i++)
+    {
+        const float t = (members > 1) ? static_cast<float>(i) / (members - 1) : 0.0f;
+        parameters[i].viscosity = viscosity_min + t * (viscosity_max - viscosity_min);
+        parameters[i].dx = gui.dx;
+        parameters[i].force_scale = gui.GetForceScale();
+        parameters[i].seed = static_cast<cl_uint>(i);
+    }
+
+    Ensemble ensemble;
+    ensemble.Init(context, program, JACOBI_REPS);
+    ensemble.Create(queue, size, parameters);
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int i = 0; i < steps; i++)
+        ensemble.Step(queue, 1.0f, static_cast<uint32_t>(i));
+    queue.finish();
+    const double elapsed = SecondsSince(start);
+
+    const std::vector<EnsembleStats> stats = ensemble.Measure(queue);
+
+    std::cout << "Ensemble of " << members << " members at " << size << "x" << size << ", " << steps << " steps in " << elapsed << "s ("
+        << members * static_cast<double>(steps) / elapsed << " member steps/s)\n";
+    for (int i = 0; i < members; i++)
+        std::cout << "  member " << i << ": viscosity " << parameters[i].viscosity << ", kinetic energy " << stats[i].kinetic_energy
+            << ", max speed " << stats[i].max_speed << "\n";
+
+    if (out_path.empty())
+        return EXIT_SUCCESS;
+
+    std::ofstream file(out_path.c_str());
+    if (!file.is_open())
+    {
+        std::cout << "ERROR::ENSEMBLE::COULD_NOT_WRITE: " << out_path << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    file << "member,viscosity,dx,force_scale,seed,kinetic_energy,max_speed\n";
+    for (int i = 0; i < members; i++)
+        file << i << "," << parameters[i].viscosity << "," << parameters[i].dx << "," << parameters[i].force_scale << "," << parameters[i].seed << ","
+            << stats[i].kinetic_energy << "," << stats[i].max_speed << "\n";
+
+    return file.good() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/// <summary>
+/// Run the velocity solver on a large square grid split into slabs over several devices and report its throughput
+/// </summary>
+/// <param name="gui">: provides viscosity, dx and the force scale</param>
+/// <param name="size">: width and height of the grid</param>
+/// <param name="steps"></param>
+/// <param name="max_devices">: 0 for all devices</param>
+/// <param name="cpu_partitions">: sub-devices per CPU device</param>
+/// <param name="build_options"></param>
+/// <returns>: exit code</returns>
+int RunSlabs(GUI& gui, int size, int steps, int max_devices, int cpu_partitions, const std::string& build_options)
+{
+    SlabDecomposition slabs;
+    if (!slabs.Init(kernel_source, build_options, max_devices, cpu_partitions))
+        return EXIT_FAILURE;
+    slabs.Create(size, size);
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int i = 0; i < steps; i++)
+        slabs.Step(1.0f, gui.viscosity, gui.dx, gui.GetForceScale(), static_cast<uint32_t>(i), JACOBI_REPS);
+    slabs.Finish();
+    const double elapsed = SecondsSince(start);
+
+    std::cout << size << "x" << size << " grid on " << slabs.GetSlabCount() << " slabs, " << steps << " steps in " << elapsed << "s ("
+        << 1000.0 * elapsed / steps << " ms/step, " << static_cast<double>(size) * size * steps / elapsed / 1.0e6 << " Mcell steps/s)\n";
+    std::cout << "Mean kinetic energy: " << slabs.KineticEnergy() << std::endl;
+
+    return EXIT_SUCCESS;
+}